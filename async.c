@@ -0,0 +1,640 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if LINUX
+#  include <poll.h>
+#  include <errno.h>
+#  include <unistd.h>
+#endif
+
+#if WIN
+#  include <windows.h>
+#endif
+
+#include <serial.h>
+#include <command.h>
+#include <pattern.h>
+#include <crc16.h>
+#include <frame.h>
+#include <checkpoint.h>
+#include <upload.h>
+#include <options.h>
+#include <timing.h>
+#include <framecache.h>
+
+#define ASYNC_SRC 1
+#include <async.h>
+#undef ASYNC_SRC
+
+#include <cmddesc.h>
+
+#define DEFAULT_TIMEOUT_MS  (1000)
+#define DEFAULT_INTERVAL_MS (100)
+#define DISPLAY_DURATION    (1)
+#define MAX_PORTS_LEN       (4096)
+
+typedef struct {
+  ASYNC_LOOP    *loop;
+  ASYNC_DEVICE  *devices;
+  char         **ports;
+  int           *results;       /* RET_COMMAND_* per device */
+  int            ndevices;
+  unsigned char *patterns;
+  int            npatterns;
+  int            frame;         /* next frame of a display run */
+  int            nframes;
+  int            interval_ms;
+} FANOUT;
+
+static void start_frame(ASYNC_DEVICE *dev, unsigned long long now);
+static void finish_frame(ASYNC_DEVICE *dev, int rc, unsigned long long now);
+static void write_frame(ASYNC_DEVICE *dev, unsigned long long now);
+static void read_response(ASYNC_DEVICE *dev, unsigned long long now);
+static int queue_request(ASYNC_DEVICE *dev, unsigned char *patterns,
+                         int count, int store, unsigned char duration,
+                         ASYNC_DONE *done, void *ctx);
+static int fire_timers(ASYNC_LOOP *loop, unsigned long long now,
+                       unsigned long long *next);
+static int wait_devices(ASYNC_LOOP *loop, unsigned long long until);
+static void display_next(void *ctx, int rc);
+static void device_done(void *ctx, int rc);
+
+
+/*
+ * A single threaded event loop driving many devices at once. Requests are
+ * queued into fixed slots of their device and their completion function
+ * is called from run_loop(), which may queue the next request right away.
+ * Nothing is allocated per request; the frame being sent lives in the
+ * device, the patterns are the caller's until completion.
+ */
+void init_loop(ASYNC_LOOP *loop)
+{
+  memset(loop, 0, sizeof(ASYNC_LOOP));
+}
+
+
+int add_device(ASYNC_LOOP *loop, ASYNC_DEVICE *dev, SERHDL hdl,
+               int timeout_ms)
+{
+  if (loop->ndevices == ASYNC_MAX_DEVICES)
+  {
+    return RET_ASYNC_ERR_BUSY;
+  }
+
+  memset(dev, 0, sizeof(ASYNC_DEVICE));
+  dev->hdl = hdl;
+  dev->timeout_ms = timeout_ms;
+  dev->state = ASYNC_IDLE;
+  loop->devices[loop->ndevices++] = dev;
+
+  return RET_ASYNC_OK;
+}
+
+
+int async_display(ASYNC_DEVICE *dev, unsigned char *pattern,
+                  ASYNC_DONE *done, void *ctx)
+{
+  return queue_request(dev, pattern, 1, 0, 0, done, ctx);
+}
+
+
+/* the whole animation completes at once, after the last 'I' is acked */
+int async_store(ASYNC_DEVICE *dev, unsigned char *patterns, int count,
+                unsigned char duration, ASYNC_DONE *done, void *ctx)
+{
+  return queue_request(dev, patterns, count, 1, duration, done, ctx);
+}
+
+
+int async_timer(ASYNC_LOOP *loop, int delay_ms, ASYNC_DONE *done, void *ctx)
+{
+  int i;
+
+  for (i = 0; i < ASYNC_TIMERS; i++)
+  {
+    if (loop->timers[i].expires == 0)
+    {
+      loop->timers[i].expires = get_time_us() + delay_ms * 1000ULL;
+      loop->timers[i].done = done;
+      loop->timers[i].ctx = ctx;
+      return RET_ASYNC_OK;
+    }
+  }
+
+  return RET_ASYNC_ERR_BUSY;
+}
+
+
+/* runs until no request and no timer is left */
+int run_loop(ASYNC_LOOP *loop)
+{
+  int rc;
+  int i;
+  int active;
+  unsigned long long now;
+  unsigned long long until;
+  ASYNC_DEVICE *dev;
+
+  rc = RET_ASYNC_OK;
+  for (;;)
+  {
+    now = get_time_us();
+    until = 0;
+    active = fire_timers(loop, now, &until);
+
+    for (i = 0; i < loop->ndevices; i++)
+    {
+      dev = loop->devices[i];
+      if ((dev->state != ASYNC_IDLE) && (now >= dev->deadline))
+      {
+        finish_frame(dev, (dev->state == ASYNC_WRITING) ?
+                     RET_COMMAND_ERR_WRITE : RET_COMMAND_ERR_READ, now);
+      }
+      if ((dev->state == ASYNC_IDLE) && (dev->queued > 0))
+      {
+        start_frame(dev, now);
+      }
+      if (dev->state != ASYNC_IDLE)
+      {
+        active = 1;
+        if ((until == 0) || (dev->deadline < until))
+        {
+          until = dev->deadline;
+        }
+      }
+    }
+
+    if (!active)
+    {
+      break;
+    }
+
+    if ((rc = wait_devices(loop, until)) != RET_ASYNC_OK)
+    {
+      break;
+    }
+  }
+
+  return rc;
+}
+
+
+static int queue_request(ASYNC_DEVICE *dev, unsigned char *patterns,
+                         int count, int store, unsigned char duration,
+                         ASYNC_DONE *done, void *ctx)
+{
+  ASYNC_REQUEST *req;
+
+  if (dev->queued == ASYNC_SLOTS)
+  {
+    return RET_ASYNC_ERR_BUSY;
+  }
+
+  req = &dev->requests[(dev->first + dev->queued) % ASYNC_SLOTS];
+  req->patterns = patterns;
+  req->count = count;
+  req->next = 0;
+  req->store = store;
+  req->duration = duration;
+  req->done = done;
+  req->ctx = ctx;
+  dev->queued++;
+
+  return RET_ASYNC_OK;
+}
+
+
+/* encodes the next frame of the oldest request */
+static void start_frame(ASYNC_DEVICE *dev, unsigned long long now)
+{
+  ASYNC_REQUEST *req;
+  unsigned char stored[CMD_NPARAM(CMD_STORENEXTPATTERN)];
+
+  req = &dev->requests[dev->first];
+
+  if (!req->store)
+  {
+    dev->framelen = cached_display_frame(req->patterns +
+                                         req->next * LINES_PER_PATTERN,
+                                         dev->frame);
+  }
+  else
+  {
+    memcpy(stored, req->patterns + req->next * LINES_PER_PATTERN,
+           LINES_PER_PATTERN);
+    stored[LINES_PER_PATTERN] = req->duration;
+    if (req->next == 0)
+    {
+      dev->framelen = ENCODE_CMD(CMD_STOREFIRSTPATTERN, stored, dev->frame);
+    }
+    else
+    {
+      dev->framelen = ENCODE_CMD(CMD_STORENEXTPATTERN, stored, dev->frame);
+    }
+  }
+
+  dev->nbytes = 0;
+  dev->state = ASYNC_WRITING;
+  dev->deadline = now + dev->timeout_ms * 1000ULL;
+}
+
+
+/* moves on to the next pattern, or completes the request */
+static void finish_frame(ASYNC_DEVICE *dev, int rc, unsigned long long now)
+{
+  ASYNC_REQUEST *req;
+  ASYNC_DONE *done;
+  void *ctx;
+
+  req = &dev->requests[dev->first];
+  dev->state = ASYNC_IDLE;
+
+  if ((rc == RET_COMMAND_OK) && (++req->next < req->count))
+  {
+    start_frame(dev, now);
+    return;
+  }
+
+  /* free the slot first, done may queue the next request */
+  done = req->done;
+  ctx = req->ctx;
+  dev->first = (dev->first + 1) % ASYNC_SLOTS;
+  dev->queued--;
+
+  if (done != NULL)
+  {
+    done(ctx, rc);
+  }
+}
+
+
+static int fire_timers(ASYNC_LOOP *loop, unsigned long long now,
+                       unsigned long long *next)
+{
+  int i;
+  int pending;
+  ASYNC_TIMER timer;
+
+  for (i = 0; i < ASYNC_TIMERS; i++)
+  {
+    if ((loop->timers[i].expires != 0) && (loop->timers[i].expires <= now))
+    {
+      timer = loop->timers[i];
+      loop->timers[i].expires = 0;
+      timer.done(timer.ctx, RET_COMMAND_OK);
+    }
+  }
+
+  /* done may have set up new timers, in any slot */
+  pending = 0;
+  for (i = 0; i < ASYNC_TIMERS; i++)
+  {
+    if (loop->timers[i].expires == 0)
+    {
+      continue;
+    }
+    pending = 1;
+    if ((*next == 0) || (loop->timers[i].expires < *next))
+    {
+      *next = loop->timers[i].expires;
+    }
+  }
+
+  return pending;
+}
+
+
+#if LINUX
+
+/* waits until a device is ready or until, then serves the ready ones */
+static int wait_devices(ASYNC_LOOP *loop, unsigned long long until)
+{
+  int rc;
+  int i;
+  int nfds;
+  int timeout_ms;
+  unsigned long long now;
+  struct pollfd fds[ASYNC_MAX_DEVICES];
+  ASYNC_DEVICE *polled[ASYNC_MAX_DEVICES];
+
+  nfds = 0;
+  for (i = 0; i < loop->ndevices; i++)
+  {
+    if (loop->devices[i]->state == ASYNC_IDLE)
+    {
+      continue;
+    }
+    polled[nfds] = loop->devices[i];
+    fds[nfds].fd = loop->devices[i]->hdl;
+    fds[nfds].events = (loop->devices[i]->state == ASYNC_WRITING) ?
+                       POLLOUT : POLLIN;
+    nfds++;
+  }
+
+  now = get_time_us();
+  timeout_ms = (until > now) ? (int) ((until - now + 999) / 1000) : 0;
+
+  rc = poll(fds, nfds, timeout_ms);
+  if (rc == -1)
+  {
+    rc = (errno == EINTR) ? RET_ASYNC_OK : RET_ASYNC_ERR_POLL;
+    goto EXIT;
+  }
+
+  now = get_time_us();
+  for (i = 0; i < nfds; i++)
+  {
+    if (fds[i].revents == 0)
+    {
+      continue;
+    }
+    if (polled[i]->state == ASYNC_WRITING)
+    {
+      write_frame(polled[i], now);
+    }
+    else
+    {
+      read_response(polled[i], now);
+    }
+  }
+
+  rc = RET_ASYNC_OK;
+
+EXIT:
+  return rc;
+}
+
+
+static void write_frame(ASYNC_DEVICE *dev, unsigned long long now)
+{
+  int rc;
+
+  rc = write(dev->hdl, dev->frame + dev->nbytes, dev->framelen - dev->nbytes);
+  if (rc == -1)
+  {
+    if (errno != EAGAIN)
+    {
+      finish_frame(dev, RET_COMMAND_ERR_WRITE, now);
+    }
+    return;
+  }
+
+  dev->nbytes += rc;
+  if (dev->nbytes == dev->framelen)
+  {
+    dev->nbytes = 0;
+    dev->state = ASYNC_READING;
+    dev->deadline = now + dev->timeout_ms * 1000ULL;
+  }
+}
+
+
+static void read_response(ASYNC_DEVICE *dev, unsigned long long now)
+{
+  int rc;
+
+  rc = read(dev->hdl, dev->response + dev->nbytes,
+            ASYNC_RSPLEN - dev->nbytes);
+  if ((rc == 0) || ((rc == -1) && (errno != EAGAIN)))
+  {
+    finish_frame(dev, RET_COMMAND_ERR_READ, now);
+    return;
+  }
+  if (rc == -1)
+  {
+    return;
+  }
+
+  dev->nbytes += rc;
+  if (dev->nbytes == ASYNC_RSPLEN)
+  {
+    finish_frame(dev, ((dev->response[0] != STX) || (dev->response[3] == NAK)) ?
+                 RET_COMMAND_ERR_NAK : RET_COMMAND_OK, now);
+  }
+}
+
+#endif
+
+
+#if WIN
+
+/*
+ * Without overlapped I/O the ports cannot be waited for together, so each
+ * busy device gets its frame sent and answered in turn.
+ */
+static int wait_devices(ASYNC_LOOP *loop, unsigned long long until)
+{
+  int i;
+  int busy;
+  unsigned long long now;
+
+  busy = 0;
+  for (i = 0; i < loop->ndevices; i++)
+  {
+    if (loop->devices[i]->state != ASYNC_IDLE)
+    {
+      now = get_time_us();
+      write_frame(loop->devices[i], now);
+      read_response(loop->devices[i], now);
+      busy = 1;
+    }
+  }
+
+  now = get_time_us();
+  if (!busy && (until > now))
+  {
+    Sleep((DWORD) ((until - now + 999) / 1000));
+  }
+
+  return RET_ASYNC_OK;
+}
+
+
+static void write_frame(ASYNC_DEVICE *dev, unsigned long long now)
+{
+  if (write_serial(dev->hdl, dev->frame, dev->framelen) != dev->framelen)
+  {
+    finish_frame(dev, RET_COMMAND_ERR_WRITE, now);
+    return;
+  }
+  dev->state = ASYNC_READING;
+}
+
+
+static void read_response(ASYNC_DEVICE *dev, unsigned long long now)
+{
+  if (dev->state != ASYNC_READING)
+  {
+    return;
+  }
+  if (read_serial_timeout(dev->hdl, dev->response, ASYNC_RSPLEN,
+                          dev->timeout_ms) != ASYNC_RSPLEN)
+  {
+    finish_frame(dev, RET_COMMAND_ERR_READ, now);
+    return;
+  }
+  finish_frame(dev, ((dev->response[0] != STX) || (dev->response[3] == NAK)) ?
+               RET_COMMAND_ERR_NAK : RET_COMMAND_OK, now);
+}
+
+#endif
+
+
+/*
+ * Sends one animation to many devices from a single thread: either stored
+ * with 'G'/'I' ("store") or shown in lockstep with one 'D' per frame every
+ * --interval ms ("display"). Ports are given as a comma separated list.
+ */
+int fanout_patterns(int myargc, char **myargv)
+{
+  int rc;
+  FANOUT fanout;
+  ASYNC_LOOP loop;
+  char ports[MAX_PORTS_LEN];
+  char *port;
+  int store;
+  int timeout_ms;
+  int failed;
+  int i;
+  unsigned long long start;
+
+  if ((strcmp(myargv[0], "store") != 0) && (strcmp(myargv[0], "display") != 0))
+  {
+    fprintf(stderr, "fanout mode must be display or store.\n");
+    rc = RET_COMMAND_ERR_WRITE;
+    goto EXIT;
+  }
+  store = (strcmp(myargv[0], "store") == 0);
+  timeout_ms = get_int_option("timeout", DEFAULT_TIMEOUT_MS);
+
+  memset(&fanout, 0, sizeof(fanout));
+  fanout.loop = &loop;
+  fanout.interval_ms = get_int_option("interval", DEFAULT_INTERVAL_MS);
+  if (load_patternfile(myargv[1], &fanout.patterns, &fanout.npatterns)
+      != RET_SOURCE_OK)
+  {
+    rc = RET_COMMAND_ERR_READ;
+    goto EXIT;
+  }
+  fanout.nframes = fanout.npatterns * get_int_option("repeat", 1);
+
+  fanout.devices = calloc(ASYNC_MAX_DEVICES, sizeof(ASYNC_DEVICE));
+  fanout.ports = calloc(ASYNC_MAX_DEVICES, sizeof(char *));
+  fanout.results = calloc(ASYNC_MAX_DEVICES, sizeof(int));
+  if ((fanout.devices == NULL) || (fanout.ports == NULL) ||
+      (fanout.results == NULL))
+  {
+    rc = RET_COMMAND_ERR_WRITE;
+    goto FREE_EXIT;
+  }
+
+  init_loop(&loop);
+  snprintf(ports, sizeof(ports), "%s", myargv[2]);
+  for (port = strtok(ports, ","); port != NULL; port = strtok(NULL, ","))
+  {
+    i = fanout.ndevices;
+    if (i == ASYNC_MAX_DEVICES)
+    {
+      fprintf(stderr, "more than %d ports, ignoring %s.\n",
+              ASYNC_MAX_DEVICES, port);
+      continue;
+    }
+    if (open_serial(port, &fanout.devices[i].hdl) != RET_SERIAL_OK)
+    {
+      fprintf(stderr, "open of device %s has failed.\n", port);
+      continue;
+    }
+    add_device(&loop, &fanout.devices[i], fanout.devices[i].hdl, timeout_ms);
+    fanout.ports[i] = port;
+    fanout.ndevices++;
+  }
+
+  start = get_time_us();
+  for (i = 0; i < fanout.ndevices; i++)
+  {
+    if (store)
+    {
+      async_store(&fanout.devices[i], fanout.patterns, fanout.npatterns,
+                  DISPLAY_DURATION, device_done, &fanout.results[i]);
+    }
+  }
+  if (!store)
+  {
+    display_next(&fanout, RET_COMMAND_OK);
+  }
+
+  rc = run_loop(&loop);
+
+  failed = 0;
+  for (i = 0; i < fanout.ndevices; i++)
+  {
+    printf("%-16s %s\n", fanout.ports[i],
+           (fanout.results[i] == RET_COMMAND_OK) ? "ok" : "failed");
+    if (fanout.results[i] != RET_COMMAND_OK)
+    {
+      failed++;
+    }
+    close_serial(fanout.devices[i].hdl);
+  }
+  printf("%d of %d devices in %.1f s\n", fanout.ndevices - failed,
+         fanout.ndevices, (get_time_us() - start) / 1000000.0);
+
+  if ((rc == RET_ASYNC_OK) && ((failed > 0) || (fanout.ndevices == 0)))
+  {
+    rc = RET_COMMAND_ERR_WRITE;
+  }
+
+FREE_EXIT:
+  free(fanout.results);
+  free(fanout.ports);
+  free(fanout.devices);
+  free(fanout.patterns);
+
+EXIT:
+  return rc;
+}
+
+
+/* timer callback of a display run, queues the next frame on all devices */
+static void display_next(void *ctx, int rc)
+{
+  FANOUT *fanout;
+  unsigned char *pattern;
+  int i;
+
+  fanout = (FANOUT *) ctx;
+  if (fanout->frame == fanout->nframes)
+  {
+    return;
+  }
+
+  pattern = fanout->patterns +
+            (fanout->frame % fanout->npatterns) * LINES_PER_PATTERN;
+  for (i = 0; i < fanout->ndevices; i++)
+  {
+    /* a device still busy with the last frame skips this one */
+    if ((fanout->results[i] == RET_COMMAND_OK) &&
+        (fanout->devices[i].queued == 0))
+    {
+      async_display(&fanout->devices[i], pattern, device_done,
+                    &fanout->results[i]);
+    }
+  }
+
+  fanout->frame++;
+  async_timer(fanout->loop, fanout->interval_ms, display_next, fanout);
+}
+
+
+/* keeps the first failure of a device */
+static void device_done(void *ctx, int rc)
+{
+  int *result;
+
+  result = (int *) ctx;
+  if (*result == RET_COMMAND_OK)
+  {
+    *result = rc;
+  }
+}
@@ -0,0 +1,77 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#define ASYNC_MAX_DEVICES (64)
+#define ASYNC_SLOTS       (8)     /* pending requests per device */
+#define ASYNC_TIMERS      (64)
+#define ASYNC_MAX_PARAM   (9)     /* pattern plus duration */
+#define ASYNC_RSPLEN      (6)
+
+#define RET_ASYNC_OK       (0)
+#define RET_ASYNC_ERR_BUSY (1)    /* no free slot, run the loop first */
+#define RET_ASYNC_ERR_POLL (2)
+
+#define ASYNC_IDLE    (0)
+#define ASYNC_WRITING (1)
+#define ASYNC_READING (2)
+
+/* called with RET_COMMAND_* once a request has completed */
+typedef void ASYNC_DONE(void *ctx, int rc);
+
+typedef struct {
+  unsigned char *patterns;      /* the caller's, 8 bytes each */
+  int            count;
+  int            next;          /* pattern being sent */
+  int            store;         /* 'G'/'I' upload instead of 'D' */
+  unsigned char  duration;
+  ASYNC_DONE    *done;
+  void          *ctx;
+} ASYNC_REQUEST;
+
+typedef struct {
+  SERHDL         hdl;
+  int            timeout_ms;
+  ASYNC_REQUEST  requests[ASYNC_SLOTS];  /* ring, first is in progress */
+  int            first;
+  int            queued;
+  int            state;
+  unsigned char  frame[FRAME_ENCODED_LEN(ASYNC_MAX_PARAM)];
+  int            framelen;
+  int            nbytes;        /* written or received so far */
+  unsigned char  response[ASYNC_RSPLEN];
+  unsigned long long deadline;
+} ASYNC_DEVICE;
+
+typedef struct {
+  unsigned long long expires;   /* 0 if unused */
+  ASYNC_DONE        *done;
+  void              *ctx;
+} ASYNC_TIMER;
+
+typedef struct {
+  ASYNC_DEVICE *devices[ASYNC_MAX_DEVICES];
+  int           ndevices;
+  ASYNC_TIMER   timers[ASYNC_TIMERS];
+} ASYNC_LOOP;
+
+#if ASYNC_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN void init_loop(ASYNC_LOOP *loop);
+EXTERN int add_device(ASYNC_LOOP *loop, ASYNC_DEVICE *dev, SERHDL hdl,
+                      int timeout_ms);
+EXTERN int async_display(ASYNC_DEVICE *dev, unsigned char *pattern,
+                         ASYNC_DONE *done, void *ctx);
+EXTERN int async_store(ASYNC_DEVICE *dev, unsigned char *patterns, int count,
+                       unsigned char duration, ASYNC_DONE *done, void *ctx);
+EXTERN int async_timer(ASYNC_LOOP *loop, int delay_ms, ASYNC_DONE *done,
+                       void *ctx);
+EXTERN int run_loop(ASYNC_LOOP *loop);
+EXTERN int fanout_patterns(int myargc, char **myargv);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <serial.h>
+#include <command.h>
+#include <pattern.h>
+#include <crc16.h>
+#include <frame.h>
+#include <checkpoint.h>
+#include <upload.h>
+#include <options.h>
+#include <timing.h>
+
+#include <cmddesc.h>
+
+/*
+ * Microbenchmarks of the per byte paths: CRC, frame encoding, sending
+ * with the port replaced by a buffer, pattern file parsing and response
+ * handling. Every benchmark is calibrated to batches of at least
+ * --batch ms, run --warmup times unmeasured and then --reps times; the
+ * ns per frame of the batches give min, median, mean and deviation.
+ * Built and run by "make bench", nothing here touches a serial port.
+ */
+
+#define DEFAULT_REPS     (15)
+#define DEFAULT_WARMUP   (3)
+#define DEFAULT_BATCH_MS (20)
+#define MAX_REPS         (1000)
+#define CRC_BUF_LEN      (4096)
+#define TEXT_LEN         (250)          /* longest text of one frame */
+#define PARSE_PATTERNS   (1024)
+#define WIRE_LEN         (65536)
+
+typedef void (*BENCH_FCT)(void *ctx);
+
+typedef struct {
+  char          command;
+  int           nparam;
+  unsigned char params[TEXT_LEN];
+  unsigned char frame[FRAME_ENCODED_LEN(TEXT_LEN)];
+} PAYLOAD;
+
+typedef struct {
+  FILE *file;
+  int   npatterns;
+  long  size;
+} PARSE_INPUT;
+
+/* the stubbed port: writes land in wire, reads return response */
+static unsigned char wire[WIRE_LEN];
+static int wirepos;
+static unsigned char response[CMD_RSPLEN(CMD_FIRMWAREVERSION)] =
+  { STX, 0x00, 0x08, 0x06, 0x00, 0x01, 0x00, 0x02, 0x00, 0x03, 0x00, 0x00 };
+
+static unsigned char crc_buf[CRC_BUF_LEN];
+static volatile unsigned long long sink;
+
+static void run_bench(char *name, BENCH_FCT fct, void *ctx, int frames,
+                      long bytes);
+static void make_payload(PAYLOAD *p, char command, int nparam, int escaped);
+static int make_parse_input(PARSE_INPUT *input);
+static void bench_crc(void *ctx);
+static void bench_encode(void *ctx);
+static void bench_send(void *ctx);
+static void bench_parse(void *ctx);
+static void bench_response(void *ctx);
+static void bench_probe(void *ctx);
+static int compare_doubles(const void *a, const void *b);
+
+
+int main(int argc, char **argv)
+{
+  int rc;
+  PAYLOAD plain;
+  PAYLOAD escaped;
+  PAYLOAD store;
+  PAYLOAD text;
+  PAYLOAD text_escaped;
+  PARSE_INPUT input;
+  int i;
+
+  if (parse_options(&argc, argv) != RET_OPTIONS_OK)
+  {
+    fprintf(stderr, "Usage: mmm8x8bench [--reps=<n>] [--warmup=<n>] "
+                    "[--batch=<ms>]\n");
+    rc = 1;
+    goto EXIT;
+  }
+
+  trace_responses(0);
+  srand(1);
+  for (i = 0; i < CRC_BUF_LEN; i++)
+  {
+    crc_buf[i] = rand();
+  }
+  make_payload(&plain, CMD_LETTER(CMD_DISPLAYPATTERN),
+               CMD_NPARAM(CMD_DISPLAYPATTERN), 0);
+  make_payload(&escaped, CMD_LETTER(CMD_DISPLAYPATTERN),
+               CMD_NPARAM(CMD_DISPLAYPATTERN), 1);
+  make_payload(&store, CMD_LETTER(CMD_STORENEXTPATTERN),
+               CMD_NPARAM(CMD_STORENEXTPATTERN), 0);
+  make_payload(&text, CMD_LETTER(CMD_DISPLAYTEXT), TEXT_LEN, 0);
+  make_payload(&text_escaped, CMD_LETTER(CMD_DISPLAYTEXT), TEXT_LEN, 1);
+
+  if ((rc = make_parse_input(&input)) != 0)
+  {
+    fprintf(stderr, "write of the pattern file has failed.\n");
+    goto EXIT;
+  }
+
+  printf("%-22s %10s %10s %10s %10s %8s %8s\n", "benchmark", "min ns",
+         "median ns", "mean ns", "stddev ns", "bytes", "ns/byte");
+
+  run_bench("crc16 4k", bench_crc, NULL, 1, CRC_BUF_LEN);
+
+  run_bench("encode D plain", bench_encode, &plain, 1, plain.nparam);
+  run_bench("encode D escaped", bench_encode, &escaped, 1, escaped.nparam);
+  run_bench("encode I plain", bench_encode, &store, 1, store.nparam);
+  run_bench("encode E 250", bench_encode, &text, 1, text.nparam);
+  run_bench("encode E 250 escaped", bench_encode, &text_escaped, 1,
+            text_escaped.nparam);
+
+  run_bench("send D plain", bench_send, &plain, 1, plain.nparam);
+  run_bench("send D escaped", bench_send, &escaped, 1, escaped.nparam);
+  run_bench("send E 250", bench_send, &text, 1, text.nparam);
+  run_bench("send E 250 escaped", bench_send, &text_escaped, 1,
+            text_escaped.nparam);
+
+  run_bench("parse patterns", bench_parse, &input, input.npatterns,
+            input.size);
+
+  run_bench("response ack", bench_response, NULL, 1,
+            CMD_RSPLEN(CMD_DISPLAYPATTERN));
+  run_bench("response version", bench_probe, NULL, 1,
+            CMD_RSPLEN(CMD_FIRMWAREVERSION));
+
+  fclose(input.file);
+  rc = 0;
+
+EXIT:
+  return rc;
+}
+
+
+/*
+ * ns are per frame, bytes the payload of one frame (the parameters, not
+ * the encoded frame) so escaping shows up as a higher ns/byte.
+ */
+static void run_bench(char *name, BENCH_FCT fct, void *ctx, int frames,
+                      long bytes)
+{
+  double ns[MAX_REPS];
+  unsigned long long batch_us;
+  unsigned long long start;
+  unsigned long long elapsed;
+  long iterations;
+  long n;
+  int reps;
+  int warmup;
+  double mean;
+  double var;
+  int i;
+
+  reps = get_int_option("reps", DEFAULT_REPS);
+  reps = (reps < 1) ? 1 : (reps > MAX_REPS) ? MAX_REPS : reps;
+  warmup = get_int_option("warmup", DEFAULT_WARMUP);
+  batch_us = get_int_option("batch", DEFAULT_BATCH_MS) * 1000ULL;
+
+  /* double the batch until it takes long enough to time it well */
+  for (iterations = 1; ; iterations *= 2)
+  {
+    start = get_time_us();
+    for (n = 0; n < iterations; n++)
+    {
+      fct(ctx);
+    }
+    if (get_time_us() - start >= batch_us)
+    {
+      break;
+    }
+  }
+
+  for (i = -warmup; i < reps; i++)
+  {
+    start = get_time_us();
+    for (n = 0; n < iterations; n++)
+    {
+      fct(ctx);
+    }
+    elapsed = get_time_us() - start;
+    if (i >= 0)
+    {
+      ns[i] = elapsed * 1000.0 / (iterations * frames);
+    }
+  }
+
+  qsort(ns, reps, sizeof(double), compare_doubles);
+  mean = 0.0;
+  for (i = 0; i < reps; i++)
+  {
+    mean += ns[i];
+  }
+  mean /= reps;
+  var = 0.0;
+  for (i = 0; i < reps; i++)
+  {
+    var += (ns[i] - mean) * (ns[i] - mean);
+  }
+
+  printf("%-22s %10.1f %10.1f %10.1f %10.1f %8ld %8.2f\n", name, ns[0],
+         ns[reps / 2], mean, sqrt(var / reps), bytes / frames,
+         ns[reps / 2] * frames / bytes);
+  fflush(stdout);
+}
+
+
+/* escaped payloads alternate STX and ESC, the worst case */
+static void make_payload(PAYLOAD *p, char command, int nparam, int escaped)
+{
+  int i;
+
+  p->command = command;
+  p->nparam = nparam;
+  for (i = 0; i < nparam; i++)
+  {
+    p->params[i] = escaped ? ((i & 1) ? ESC : STX) : 'A' + i % 26;
+  }
+}
+
+
+/* a pattern file of random patterns in a temporary file */
+static int make_parse_input(PARSE_INPUT *input)
+{
+  int i;
+  int j;
+  int k;
+
+  if ((input->file = tmpfile()) == NULL)
+  {
+    return 1;
+  }
+
+  for (i = 0; i < PARSE_PATTERNS; i++)
+  {
+    if (i > 0)
+    {
+      fputc('\n', input->file);
+    }
+    for (j = 0; j < LINES_PER_PATTERN; j++)
+    {
+      for (k = 0; k < COLUMNS_PER_PATTERN; k++)
+      {
+        fputc((rand() & 1) ? 'x' : '-', input->file);
+      }
+      fputc('\n', input->file);
+    }
+  }
+
+  input->npatterns = PARSE_PATTERNS;
+  input->size = ftell(input->file);
+
+  return (fflush(input->file) == 0) ? 0 : 1;
+}
+
+
+static void bench_crc(void *ctx)
+{
+  unsigned short crc16;
+  int i;
+
+  crc16 = INITIAL_VALUE;
+  for (i = 0; i < CRC_BUF_LEN; i++)
+  {
+    crc16 = calc_crc16(crc16, crc_buf[i]);
+  }
+  sink += crc16;
+}
+
+
+static void bench_encode(void *ctx)
+{
+  PAYLOAD *p;
+
+  p = (PAYLOAD *) ctx;
+  sink += encode_frame(p->command, p->nparam, p->params, p->frame);
+}
+
+
+/* send_command() as the commands call it: allocate, encode, write */
+static void bench_send(void *ctx)
+{
+  PAYLOAD *p;
+
+  p = (PAYLOAD *) ctx;
+  sink += send_command(0, p->command, p->nparam, p->params);
+}
+
+
+/* next_file_pattern() over the whole file, blank lines included */
+static void bench_parse(void *ctx)
+{
+  PARSE_INPUT *input;
+  PATTERNFILE_SOURCE source;
+  unsigned char pattern[LINES_PER_PATTERN];
+
+  input = (PARSE_INPUT *) ctx;
+  rewind(input->file);
+  source.patternfile = input->file;
+  source.path = "bench";
+  source.count = 0;
+  while (next_file_pattern(&source, pattern) == RET_SOURCE_OK)
+  {
+    sink += pattern[0];
+  }
+}
+
+
+static void bench_response(void *ctx)
+{
+  unsigned char rsp[CMD_RSPLEN(CMD_DISPLAYPATTERN)];
+
+  sink += RECEIVE_RSP(0, CMD_DISPLAYPATTERN, rsp);
+}
+
+
+/* 'v' frame out, 12 byte response in and decoded */
+static void bench_probe(void *ctx)
+{
+  int version[3];
+
+  sink += probe_firmwareversion(0, READ_TIMEOUT_MS, version);
+}
+
+
+static int compare_doubles(const void *a, const void *b)
+{
+  double x;
+  double y;
+
+  x = *(double *) a;
+  y = *(double *) b;
+  return (x > y) - (x < y);
+}
+
+
+/* the serial port, replaced */
+int open_serial(char *serialport, SERHDL *hdl)
+{
+  return RET_SERIAL_ERR_OPEN;
+}
+
+
+int close_serial(SERHDL hdl)
+{
+  return RET_SERIAL_OK;
+}
+
+
+int read_serial(SERHDL hdl, unsigned char *buf, int count)
+{
+  return read_serial_timeout(hdl, buf, count, READ_TIMEOUT_MS);
+}
+
+
+int read_serial_timeout(SERHDL hdl, unsigned char *buf, int count,
+                        int timeout_ms)
+{
+  memcpy(buf, response, count);
+  return count;
+}
+
+
+int write_serial(SERHDL hdl, unsigned char *buf, int count)
+{
+  if (wirepos + count > WIRE_LEN)
+  {
+    wirepos = 0;
+  }
+  memcpy(wire + wirepos, buf, count);
+  wirepos += count;
+
+  return count;
+}
@@ -0,0 +1,165 @@
+#define BITBOARD_SRC 1
+#include <bitboard.h>
+#undef BITBOARD_SRC
+
+#define LEFT_COLUMN  (0x8080808080808080ULL)
+#define RIGHT_COLUMN (0x0101010101010101ULL)
+
+/*
+ * All operations work on the whole frame at once with shifts and masks,
+ * there are no loops over pixels. Scrolling wraps around the edges.
+ */
+
+BITBOARD scroll_left(BITBOARD board)
+{
+  return ((board << 1) & ~RIGHT_COLUMN) | ((board >> 7) & RIGHT_COLUMN);
+}
+
+
+BITBOARD scroll_right(BITBOARD board)
+{
+  return ((board >> 1) & ~LEFT_COLUMN) | ((board << 7) & LEFT_COLUMN);
+}
+
+
+BITBOARD scroll_up(BITBOARD board)
+{
+  return (board >> 8) | (board << 56);
+}
+
+
+BITBOARD scroll_down(BITBOARD board)
+{
+  return (board << 8) | (board >> 56);
+}
+
+
+/* left to right */
+BITBOARD mirror_bitboard(BITBOARD board)
+{
+  const BITBOARD k1 = 0x5555555555555555ULL;
+  const BITBOARD k2 = 0x3333333333333333ULL;
+  const BITBOARD k4 = 0x0f0f0f0f0f0f0f0fULL;
+
+  board = ((board >> 1) & k1) | ((board & k1) << 1);
+  board = ((board >> 2) & k2) | ((board & k2) << 2);
+  board = ((board >> 4) & k4) | ((board & k4) << 4);
+
+  return board;
+}
+
+
+/* top to bottom */
+BITBOARD flip_bitboard(BITBOARD board)
+{
+  const BITBOARD k1 = 0x00ff00ff00ff00ffULL;
+  const BITBOARD k2 = 0x0000ffff0000ffffULL;
+
+  board = ((board >>  8) & k1) | ((board & k1) <<  8);
+  board = ((board >> 16) & k2) | ((board & k2) << 16);
+  board = ( board >> 32)       | ( board       << 32);
+
+  return board;
+}
+
+
+/* lines become columns, by three delta swaps */
+BITBOARD transpose_bitboard(BITBOARD board)
+{
+  BITBOARD t;
+  const BITBOARD k1 = 0xaa00aa00aa00aa00ULL;
+  const BITBOARD k2 = 0xcccc0000cccc0000ULL;
+  const BITBOARD k4 = 0xf0f0f0f00f0f0f0fULL;
+
+  t      =       board ^ (board << 36);
+  board ^= k4 & (t ^ (board >> 36));
+  t      = k2 & (board ^ (board << 18));
+  board ^=       t ^ (t >> 18);
+  t      = k1 & (board ^ (board <<  9));
+  board ^=       t ^ (t >>  9);
+
+  return board;
+}
+
+
+/* 90 degrees clockwise */
+BITBOARD rotate_bitboard(BITBOARD board)
+{
+  return mirror_bitboard(transpose_bitboard(board));
+}
+
+
+/*
+ * One generation of Conway's Game of Life on a torus. The eight neighbour
+ * boards are summed bit-sliced, so all 64 cells are counted in parallel;
+ * a count of 8 wraps to 0, which is dead either way.
+ */
+BITBOARD step_life(BITBOARD board)
+{
+  BITBOARD neighbour[8];
+  BITBOARD left;
+  BITBOARD right;
+  BITBOARD s0;
+  BITBOARD s1;
+  BITBOARD s2;
+  BITBOARD c0;
+  BITBOARD c1;
+  int i;
+
+  left = scroll_left(board);
+  right = scroll_right(board);
+  neighbour[0] = left;
+  neighbour[1] = right;
+  neighbour[2] = scroll_up(board);
+  neighbour[3] = scroll_down(board);
+  neighbour[4] = scroll_up(left);
+  neighbour[5] = scroll_down(left);
+  neighbour[6] = scroll_up(right);
+  neighbour[7] = scroll_down(right);
+
+  s0 = s1 = s2 = 0;
+  for (i = 0; i < 8; i++)
+  {
+    c0 = s0 & neighbour[i];
+    s0 ^= neighbour[i];
+    c1 = s1 & c0;
+    s1 ^= c0;
+    s2 ^= c1;
+  }
+
+  /* born with 3, survive with 2 or 3 */
+  return s1 & ~s2 & (s0 | board);
+}
+
+
+/*
+ * The transposed form sent with 'D', 'G' and 'I': pattern[column] has
+ * bit n set for a pixel in line n, which is the byte layout of the board
+ * rotated clockwise.
+ */
+void bitboard_to_pattern(BITBOARD board, unsigned char *pattern)
+{
+  int i;
+
+  board = rotate_bitboard(board);
+  for (i = 0; i < 8; i++)
+  {
+    pattern[i] = BITBOARD_LINE(board, i);
+  }
+}
+
+
+BITBOARD pattern_to_bitboard(unsigned char *pattern)
+{
+  BITBOARD board;
+  int i;
+
+  board = 0;
+  for (i = 0; i < 8; i++)
+  {
+    board |= (BITBOARD) pattern[i] << (8 * i);
+  }
+
+  /* rotate back counterclockwise */
+  return transpose_bitboard(mirror_bitboard(board));
+}
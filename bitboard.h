@@ -0,0 +1,33 @@
+#ifndef BITBOARD_H
+#define BITBOARD_H
+
+/*
+ * One 8x8 frame in a 64-bit word: byte n holds line n, bit 7 of a byte is
+ * the leftmost column, just like the value read_patternfile() returns.
+ */
+typedef unsigned long long BITBOARD;
+
+#define BITBOARD_LINE(board, line) \
+        ((unsigned char) ((board) >> (8 * (line))))
+
+#if BITBOARD_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN BITBOARD scroll_left(BITBOARD board);
+EXTERN BITBOARD scroll_right(BITBOARD board);
+EXTERN BITBOARD scroll_up(BITBOARD board);
+EXTERN BITBOARD scroll_down(BITBOARD board);
+EXTERN BITBOARD mirror_bitboard(BITBOARD board);
+EXTERN BITBOARD flip_bitboard(BITBOARD board);
+EXTERN BITBOARD transpose_bitboard(BITBOARD board);
+EXTERN BITBOARD rotate_bitboard(BITBOARD board);
+EXTERN BITBOARD step_life(BITBOARD board);
+EXTERN void bitboard_to_pattern(BITBOARD board, unsigned char *pattern);
+EXTERN BITBOARD pattern_to_bitboard(unsigned char *pattern);
+
+#undef EXTERN
+
+#endif
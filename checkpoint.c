@@ -0,0 +1,136 @@
+#include <stdio.h>
+
+#define CHECKPOINT_SRC 1
+#include <checkpoint.h>
+#undef CHECKPOINT_SRC
+
+#define FNV_OFFSET (0xcbf29ce484222325ULL)
+#define FNV_PRIME  (0x100000001b3ULL)
+
+#define CHECKPOINT_FORMAT      "mmm8x8 checkpoint\nhash %016llx\nacked %010d\n"
+#define CHECKPOINT_SCAN_FORMAT "mmm8x8 checkpoint hash %llx acked %d"
+
+
+/* FNV-1a over the whole file, identifies the animation of an upload */
+int hash_file(char *path, unsigned long long *hash)
+{
+  int rc;
+  FILE *handle;
+  unsigned char buf[4096];
+  size_t n;
+  size_t i;
+
+  if ((handle = fopen(path, "rb")) == NULL)
+  {
+    rc = RET_CHECKPOINT_ERR_OPEN;
+    goto EXIT;
+  }
+
+  *hash = FNV_OFFSET;
+  while ((n = fread(buf, 1, sizeof(buf), handle)) > 0)
+  {
+    for (i = 0; i < n; i++)
+    {
+      *hash = (*hash ^ buf[i]) * FNV_PRIME;
+    }
+  }
+
+  rc = ferror(handle) ? RET_CHECKPOINT_ERR_READ : RET_CHECKPOINT_OK;
+  fclose(handle);
+
+EXIT:
+  return rc;
+}
+
+
+/*
+ * Returns the index of the last acknowledged pattern of an earlier upload,
+ * if the checkpoint at path belongs to the animation with hash.
+ */
+int read_checkpoint(char *path, unsigned long long hash, int *acked)
+{
+  int rc;
+  FILE *handle;
+  unsigned long long ckpt_hash;
+
+  if ((handle = fopen(path, "r")) == NULL)
+  {
+    rc = RET_CHECKPOINT_ERR_OPEN;
+    goto EXIT;
+  }
+
+  if (fscanf(handle, CHECKPOINT_SCAN_FORMAT, &ckpt_hash, acked) != 2)
+  {
+    rc = RET_CHECKPOINT_ERR_READ;
+    goto CLOSE_EXIT;
+  }
+
+  rc = (ckpt_hash == hash) ? RET_CHECKPOINT_OK : RET_CHECKPOINT_ERR_NOMATCH;
+
+CLOSE_EXIT:
+  fclose(handle);
+
+EXIT:
+  return rc;
+}
+
+
+int open_checkpoint(char *path, unsigned long long hash,
+                    CHECKPOINT *checkpoint)
+{
+  int rc;
+
+  if ((checkpoint->handle = fopen(path, "w")) == NULL)
+  {
+    rc = RET_CHECKPOINT_ERR_OPEN;
+    goto EXIT;
+  }
+  checkpoint->path = path;
+  checkpoint->hash = hash;
+
+  rc = RET_CHECKPOINT_OK;
+
+EXIT:
+  return rc;
+}
+
+
+/* records pattern acked as stored; the fixed width keeps the size constant */
+int update_checkpoint(CHECKPOINT *checkpoint, int acked)
+{
+  int rc;
+
+  rewind(checkpoint->handle);
+  if ((fprintf(checkpoint->handle, CHECKPOINT_FORMAT, checkpoint->hash,
+               acked) < 0) ||
+      (fflush(checkpoint->handle) != 0))
+  {
+    rc = RET_CHECKPOINT_ERR_WRITE;
+    goto EXIT;
+  }
+
+  rc = RET_CHECKPOINT_OK;
+
+EXIT:
+  return rc;
+}
+
+
+/* a completed upload needs no checkpoint any more */
+int close_checkpoint(CHECKPOINT *checkpoint, int complete)
+{
+  int rc;
+
+  rc = RET_CHECKPOINT_OK;
+  if (fclose(checkpoint->handle) != 0)
+  {
+    rc = RET_CHECKPOINT_ERR_WRITE;
+  }
+
+  if (complete)
+  {
+    remove(checkpoint->path);
+  }
+
+  return rc;
+}
@@ -0,0 +1,33 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#define RET_CHECKPOINT_OK         (0)
+#define RET_CHECKPOINT_ERR_OPEN   (1)
+#define RET_CHECKPOINT_ERR_READ   (2)
+#define RET_CHECKPOINT_ERR_WRITE  (3)
+#define RET_CHECKPOINT_ERR_NOMATCH (4)
+
+#define CHECKPOINT_SUFFIX ".ckpt"
+
+typedef struct {
+  FILE              *handle;
+  char              *path;
+  unsigned long long hash;       /* of the animation being uploaded */
+} CHECKPOINT;
+
+#if CHECKPOINT_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int hash_file(char *path, unsigned long long *hash);
+EXTERN int read_checkpoint(char *path, unsigned long long hash, int *acked);
+EXTERN int open_checkpoint(char *path, unsigned long long hash,
+                           CHECKPOINT *checkpoint);
+EXTERN int update_checkpoint(CHECKPOINT *checkpoint, int acked);
+EXTERN int close_checkpoint(CHECKPOINT *checkpoint, int complete);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef CMDDESC_H
+#define CMDDESC_H
+
+/*
+ * Command descriptors: letter, no of parameter bytes and response length
+ * of every command, plus macros that check buffer sizes against them and
+ * build parameterless frames, CRC included, at compile time.
+ * Needs crc16.h and frame.h, and command.h for the send/receive macros.
+ */
+
+#define CMD_VARIABLE (-1)       /* texts, no fixed no of parameters */
+
+#define CMD_FIRMWAREVERSION_LETTER    'v'
+#define CMD_FIRMWAREVERSION_NPARAM    0
+#define CMD_FIRMWAREVERSION_RSPLEN    12
+
+#define CMD_DISPLAYTEXT_LETTER        'E'
+#define CMD_DISPLAYTEXT_NPARAM        CMD_VARIABLE
+#define CMD_DISPLAYTEXT_RSPLEN        6
+
+#define CMD_STORETEXT_LETTER          'J'
+#define CMD_STORETEXT_NPARAM          CMD_VARIABLE
+#define CMD_STORETEXT_RSPLEN          6
+
+#define CMD_SETTEXTSPEED_LETTER       'F'
+#define CMD_SETTEXTSPEED_NPARAM       1
+#define CMD_SETTEXTSPEED_RSPLEN       6
+
+#define CMD_DISPLAYPATTERN_LETTER     'D'
+#define CMD_DISPLAYPATTERN_NPARAM     8
+#define CMD_DISPLAYPATTERN_RSPLEN     6
+
+#define CMD_STOREFIRSTPATTERN_LETTER  'G'
+#define CMD_STOREFIRSTPATTERN_NPARAM  9
+#define CMD_STOREFIRSTPATTERN_RSPLEN  6
+
+#define CMD_STORENEXTPATTERN_LETTER   'I'
+#define CMD_STORENEXTPATTERN_NPARAM   9
+#define CMD_STORENEXTPATTERN_RSPLEN   6
+
+#define CMD_SETNORMALMODE_LETTER      'A'
+#define CMD_SETNORMALMODE_NPARAM      0
+#define CMD_SETNORMALMODE_RSPLEN      6
+
+#define CMD_SETPATTERNMODE_LETTER     'B'
+#define CMD_SETPATTERNMODE_NPARAM     0
+#define CMD_SETPATTERNMODE_RSPLEN     6
+
+#define CMD_SETTEXTMODE_LETTER        'C'
+#define CMD_SETTEXTMODE_NPARAM        0
+#define CMD_SETTEXTMODE_RSPLEN        6
+
+#define CMD_FACTORYRESET_LETTER       'X'
+#define CMD_FACTORYRESET_NPARAM       0
+#define CMD_FACTORYRESET_RSPLEN       0     /* the device does not answer */
+
+#define CMD_LETTER(cmd) (cmd##_LETTER)
+#define CMD_NPARAM(cmd) (cmd##_NPARAM)
+#define CMD_RSPLEN(cmd) (cmd##_RSPLEN)
+
+/* evaluates to len, but does not compile unless array has len bytes */
+#define CHECKED_LEN(array, len) \
+        ((int) (sizeof(char[(sizeof(array) == (len)) ? 1 : -1]) * (len)))
+
+#define ENCODE_CMD(cmd, params, frame) \
+        encode_frame(CMD_LETTER(cmd), CHECKED_LEN(params, CMD_NPARAM(cmd)), \
+                     (params), (frame))
+#define SEND_CMD(hdl, cmd, params) \
+        send_command((hdl), CMD_LETTER(cmd), \
+                     CHECKED_LEN(params, CMD_NPARAM(cmd)), (params))
+#define RECEIVE_RSP(hdl, cmd, response) \
+        receive_response((hdl), (response), \
+                         CHECKED_LEN(response, CMD_RSPLEN(cmd)))
+
+/* calc_crc16() as a constant expression, one bit and one byte */
+#define CRC16_CONST_BIT(crc, byte, bit) \
+        ((((crc) << 1) & 0xffff) ^ \
+         (((((crc) >> 15) ^ ((byte) >> (7 - (bit)))) & 1) ? CRC16_POLYNOM : 0))
+#define CRC16_CONST(crc, byte) \
+        CRC16_CONST_BIT(CRC16_CONST_BIT(CRC16_CONST_BIT(CRC16_CONST_BIT( \
+        CRC16_CONST_BIT(CRC16_CONST_BIT(CRC16_CONST_BIT(CRC16_CONST_BIT( \
+        (crc), (byte), 0), (byte), 1), (byte), 2), (byte), 3), \
+        (byte), 4), (byte), 5), (byte), 6), (byte), 7)
+
+#define NEEDS_ESC(byte) (((byte) == STX) || ((byte) == ESC))
+
+/*
+ * Defines cmd##_FRAME and cmd##_FRAMELEN, the complete encoded frame of a
+ * parameterless command: STX, length 0 1, letter and the CRC, each CRC
+ * byte escaped if needed. The CRC is chained through enum constants so
+ * that every step is expanded only once.
+ */
+#define DEFINE_FIXED_FRAME(cmd) \
+  _Static_assert(CMD_NPARAM(cmd) == 0, #cmd " takes parameters"); \
+  _Static_assert(!NEEDS_ESC(CMD_LETTER(cmd)), #cmd " letter needs escape"); \
+  enum { \
+    cmd##_CRC_STX  = CRC16_CONST(INITIAL_VALUE, STX), \
+    cmd##_CRC_LENH = CRC16_CONST(cmd##_CRC_STX, 0), \
+    cmd##_CRC_LENL = CRC16_CONST(cmd##_CRC_LENH, 1), \
+    cmd##_CRC      = CRC16_CONST(cmd##_CRC_LENL, CMD_LETTER(cmd)), \
+    cmd##_CRC_HI   = (cmd##_CRC >> 8) & 0xff, \
+    cmd##_CRC_LO   = cmd##_CRC & 0xff, \
+    cmd##_FRAMELEN = 6 + NEEDS_ESC(cmd##_CRC_HI) + NEEDS_ESC(cmd##_CRC_LO) \
+  }; \
+  static unsigned char cmd##_FRAME[FRAME_ENCODED_LEN(0)] = \
+  { \
+    STX, 0, 1, CMD_LETTER(cmd), \
+    NEEDS_ESC(cmd##_CRC_HI) ? ESC : cmd##_CRC_HI, \
+    NEEDS_ESC(cmd##_CRC_HI) ? (cmd##_CRC_HI | FLAG) : \
+      (NEEDS_ESC(cmd##_CRC_LO) ? ESC : cmd##_CRC_LO), \
+    NEEDS_ESC(cmd##_CRC_HI) ? \
+      (NEEDS_ESC(cmd##_CRC_LO) ? ESC : cmd##_CRC_LO) : \
+      (NEEDS_ESC(cmd##_CRC_LO) ? (cmd##_CRC_LO | FLAG) : 0), \
+    (NEEDS_ESC(cmd##_CRC_HI) && NEEDS_ESC(cmd##_CRC_LO)) ? \
+      (cmd##_CRC_LO | FLAG) : 0, \
+  }
+
+#define SEND_FIXED_CMD(hdl, cmd) \
+        send_frame((hdl), cmd##_FRAME, cmd##_FRAMELEN)
+
+#endif
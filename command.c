@@ -2,47 +2,92 @@
 #include <string.h>
 #include <stdlib.h>
 
+#if LINUX
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+
 #include <serial.h>
 #include <pattern.h>
 #include <crc16.h>
+#include <frame.h>
+#include <checkpoint.h>
+#include <upload.h>
+#include <options.h>
+#include <profile.h>
+#include <framecache.h>
 
 #define COMMAND_SRC 1
 #include <command.h>
 #undef COMMAND_SRC
 
-#define STX 0x02
-#define ESC 0x10
-#define FLAG 0x80
-#define NAK 0x15
-
-#define LINES_PER_PATTERN (8)
-#define COLUMNS_PER_PATTERN (8)
-
-static int send_command(SERHDL hdl, char command, int nparam,
-                        unsigned char *params);
-static int receive_response(SERHDL hdl, unsigned char *response, int rsplen);
-static int write_serial_with_escape(SERHDL hdl, unsigned char byte,
-                                    unsigned short *crc16);
-static int write_and_crc_byte(SERHDL hdl, unsigned char byte,
-                              unsigned short *crc16);
-
-static int read_one_pattern(FILE *patternfile, unsigned char *pattern);
+#include <cmddesc.h>
+
+/* frames of the parameterless commands, built by the compiler */
+DEFINE_FIXED_FRAME(CMD_FIRMWAREVERSION);
+DEFINE_FIXED_FRAME(CMD_SETNORMALMODE);
+DEFINE_FIXED_FRAME(CMD_SETPATTERNMODE);
+DEFINE_FIXED_FRAME(CMD_SETTEXTMODE);
+DEFINE_FIXED_FRAME(CMD_FACTORYRESET);
+
+#define TEXT_CHUNK (1024)     /* text bytes encoded per write */
+#define TEXT_TOO_LONG (-1)    /* open_text(): more than a frame takes */
+#define MAX_TEXT_FILE (MAX_FRAME_PARAM + 2)    /* a CR LF line end more */
+
+/* print every response received, off for the bulk tools */
+static int response_trace = 1;
+
+typedef struct {
+  unsigned char *text;
+  int            textlen;
+  size_t         size;          /* of the mapping, 0 if read into memory */
+} TEXT_SOURCE;
+
+/* --dry-run: frames are counted instead of sent, responses made up */
+typedef struct {
+  long frames;
+  long bytes;                   /* as on the wire, escapes included */
+  long escapes;                 /* bytes added by escaping */
+  long rspbytes;
+  long letters[128];            /* frames per command letter */
+  long patterns;                /* in device memory afterwards */
+  long textbytes;
+} WIRE_COST;
+
+static int dry_run;
+static WIRE_COST wire_cost;
+
+static void count_frame(unsigned char *bytes, int len, int start);
+static int write_frame_bytes(SERHDL hdl, unsigned char *bytes, int len,
+                             int start);
+static int send_text(SERHDL hdl, char command, unsigned char *text,
+                     int textlen);
+static int receive_text_response(SERHDL hdl, unsigned char *response,
+                                 int rsplen, int textlen);
+static int text_command(SERHDL hdl, char command, char *name, char *path);
+static int open_text(char *path, TEXT_SOURCE *source);
+static int read_text(FILE *handle, TEXT_SOURCE *source);
+static void close_text(TEXT_SOURCE *source);
+
+static int start_checkpoint(char *patternfile, CHECKPOINT *checkpoint,
+                            int *first);
 
 
 int get_firmwareversion(SERHDL hdl, int myargc, char **myargv)
 {
   int rc;
-  #define CMD_GET_FIRMWARE_RSP_LEN (12)
-  unsigned char response[CMD_GET_FIRMWARE_RSP_LEN];
+  unsigned char response[CMD_RSPLEN(CMD_FIRMWAREVERSION)];
 
-  rc = send_command(hdl, 'v', 0, NULL);
+  rc = SEND_FIXED_CMD(hdl, CMD_FIRMWAREVERSION);
   if (rc != RET_COMMAND_OK) 
   {
     fprintf(stderr, "sending command firmwareversion has failed.\n");
     goto EXIT;
   }
 
-  rc = receive_response(hdl, response, CMD_GET_FIRMWARE_RSP_LEN);
+  rc = RECEIVE_RSP(hdl, CMD_FIRMWAREVERSION, response);
   if (rc != RET_COMMAND_OK) 
   {
     fprintf(stderr, "receiving response of command firmwareversion "
@@ -58,22 +103,72 @@ EXIT:
 }
 
 
+/*
+ * Asks for the firmware version with a short timeout and without tracing,
+ * used to find out whether a port has an MMM8x8 attached at all.
+ */
+int probe_firmwareversion(SERHDL hdl, int timeout_ms, int *version)
+{
+  int rc;
+  unsigned char response[CMD_RSPLEN(CMD_FIRMWAREVERSION)];
+
+  rc = SEND_FIXED_CMD(hdl, CMD_FIRMWAREVERSION);
+  if (rc != RET_COMMAND_OK) 
+  {
+    goto EXIT;
+  }
+
+  if (dry_run)
+  {
+    receive_response(hdl, response, sizeof(response));
+  }
+  else if (read_serial_timeout(hdl, response, sizeof(response), timeout_ms)
+           != sizeof(response))
+  {
+    rc = RET_COMMAND_ERR_READ;
+    goto EXIT;
+  }
+
+  if ((response[0] != STX) || (response[3] == NAK))
+  {
+    rc = RET_COMMAND_ERR_NAK;
+    goto EXIT;
+  }
+
+  version[0] = response[4] * 256 + response[5];
+  version[1] = response[6] * 256 + response[7];
+  version[2] = response[8] * 256 + response[9];
+
+  rc = RET_COMMAND_OK;
+
+EXIT:
+  return rc;
+}
+
+
 int display_text(SERHDL hdl, int myargc, char **myargv)
 {
   int rc;
-  #define CMD_DISPLAY_TEXT_RSP_LEN (6)
-  unsigned char response[CMD_DISPLAY_TEXT_RSP_LEN];
+  unsigned char response[CMD_RSPLEN(CMD_DISPLAYTEXT)];
   int textlen;
 
   textlen = strlen(myargv[0]);
-  rc = send_command(hdl, 'E', textlen, (unsigned char *) myargv[0]); 
+  if (textlen > MAX_FRAME_PARAM)
+  {
+    fprintf(stderr, "text is longer than %d bytes.\n", MAX_FRAME_PARAM);
+    rc = RET_COMMAND_ERR_WRITE;
+    goto EXIT;
+  }
+
+  rc = send_text(hdl, CMD_LETTER(CMD_DISPLAYTEXT), (unsigned char *) myargv[0],
+                 textlen);
   if (rc != RET_COMMAND_OK) 
   {
     fprintf(stderr, "sending command displaytext has failed.\n");
     goto EXIT;
   }
 
-  rc = receive_response(hdl, response, CMD_DISPLAY_TEXT_RSP_LEN);
+  rc = receive_text_response(hdl, response, sizeof(response), textlen);
   if (rc != RET_COMMAND_OK) 
   {
     fprintf(stderr, "receiving response of command displaytext "
@@ -89,19 +184,26 @@ EXIT:
 int store_text(SERHDL hdl, int myargc, char **myargv)
 {
   int rc;
-  #define CMD_STORE_TEXT_RSP_LEN (6)
-  unsigned char response[CMD_STORE_TEXT_RSP_LEN];
+  unsigned char response[CMD_RSPLEN(CMD_STORETEXT)];
   int textlen;
 
   textlen = strlen(myargv[0]);
-  rc = send_command(hdl, 'J', textlen, (unsigned char *) myargv[0]);
+  if (textlen > MAX_FRAME_PARAM)
+  {
+    fprintf(stderr, "text is longer than %d bytes.\n", MAX_FRAME_PARAM);
+    rc = RET_COMMAND_ERR_WRITE;
+    goto EXIT;
+  }
+
+  rc = send_text(hdl, CMD_LETTER(CMD_STORETEXT), (unsigned char *) myargv[0],
+                 textlen);
   if (rc != RET_COMMAND_OK) 
   {
     fprintf(stderr, "sending command storetext has failed.\n");
     goto EXIT;
   }
 
-  rc = receive_response(hdl, response, CMD_STORE_TEXT_RSP_LEN);
+  rc = receive_text_response(hdl, response, sizeof(response), textlen);
   if (rc != RET_COMMAND_OK) 
   {
     fprintf(stderr, "receiving response of command storetext "
@@ -114,22 +216,36 @@ EXIT:
 }
 
 
+/* displaytextfile <file | ->, a text of any length up to the frame limit */
+int display_textfile(SERHDL hdl, int myargc, char **myargv)
+{
+  return text_command(hdl, CMD_LETTER(CMD_DISPLAYTEXT), "displaytextfile",
+                      myargv[0]);
+}
+
+
+int store_textfile(SERHDL hdl, int myargc, char **myargv)
+{
+  return text_command(hdl, CMD_LETTER(CMD_STORETEXT), "storetextfile",
+                      myargv[0]);
+}
+
+
 int set_textspeed(SERHDL hdl, int myargc, char **myargv)
 {
   int rc;
-  #define CMD_SET_TEXTSPEED_RSP_LEN (6)
-  unsigned char response[CMD_SET_TEXTSPEED_RSP_LEN];
-  unsigned char speed[1];
+  unsigned char response[CMD_RSPLEN(CMD_SETTEXTSPEED)];
+  unsigned char speed[CMD_NPARAM(CMD_SETTEXTSPEED)];
   
   speed[0] = atoi(myargv[0]);
-  rc = send_command(hdl, 'F', 1, speed);
+  rc = SEND_CMD(hdl, CMD_SETTEXTSPEED, speed);
   if (rc != RET_COMMAND_OK) 
   {
     fprintf(stderr, "sending command settextspeed has failed.\n");
     goto EXIT;
   }
 
-  rc = receive_response(hdl, response, CMD_SET_TEXTSPEED_RSP_LEN);
+  rc = RECEIVE_RSP(hdl, CMD_SETTEXTSPEED, response);
   if (rc != RET_COMMAND_OK) 
   {
     fprintf(stderr, "receiving response of command settextspeed "
@@ -145,10 +261,11 @@ EXIT:
 int display_pattern(SERHDL hdl, int myargc, char **myargv)
 {
   int rc;
-#define CMD_DISPLAY_PATTERN_RSP_LEN (6)
-  unsigned char response[CMD_DISPLAY_PATTERN_RSP_LEN];
+  unsigned char response[CMD_RSPLEN(CMD_DISPLAYPATTERN)];
   FILE *patternfile;
   unsigned char pattern[LINES_PER_PATTERN];
+  unsigned char frame[FRAME_ENCODED_LEN(CMD_NPARAM(CMD_DISPLAYPATTERN))];
+  int framelen;
   
   if ((rc = open_patternfile(myargv[0], &patternfile)) != RET_PATTERN_OK)
   {
@@ -157,20 +274,22 @@ int display_pattern(SERHDL hdl, int myargc, char **myargv)
   }
 
   
-  if ((rc = read_one_pattern(patternfile, pattern)) != RET_COMMAND_OK)
+  if ((rc = read_one_pattern(patternfile, pattern)) != RET_PATTERN_OK)
   {
     fprintf(stderr, "read of patternfile %s has failed\n", myargv[0]);
     goto CLOSE_EXIT;
   }
 
-  rc = send_command(hdl, 'D', LINES_PER_PATTERN, pattern);
+  /* from the cache if the pattern is in --framecache */
+  framelen = cached_display_frame(pattern, frame);
+  rc = send_frame(hdl, frame, framelen);
   if (rc != RET_COMMAND_OK) 
   {
     fprintf(stderr, "sending command displaypattern has failed.\n");
     goto CLOSE_EXIT;
   }
 
-  rc = receive_response(hdl, response, CMD_DISPLAY_PATTERN_RSP_LEN);
+  rc = RECEIVE_RSP(hdl, CMD_DISPLAYPATTERN, response);
   if (rc != RET_COMMAND_OK) 
   {
     fprintf(stderr, "receiving response of command displaypattern "
@@ -190,82 +309,35 @@ EXIT:
 int store_pattern(SERHDL hdl, int myargc, char **myargv)
 {
   int rc;
-#define CMD_STORE_PATTERN_RSP_LEN (6)
-  unsigned char response[CMD_STORE_PATTERN_RSP_LEN];
-  FILE *patternfile;
-  unsigned char dummy;
-  unsigned char pattern[LINES_PER_PATTERN + 1];
+  PATTERNFILE_SOURCE source;
+  CHECKPOINT checkpoint;
+  int checkpointed;
+  int first;
 #define DISPLAY_DURATION (1)
   
   /* open pattern file */
-  if ((rc = open_patternfile(myargv[0], &patternfile)) != RET_PATTERN_OK)
+  if ((rc = open_patternfile(myargv[0], &source.patternfile))
+      != RET_PATTERN_OK)
   {
     fprintf(stderr, "open of patternfile %s has failed\n", myargv[0]);
     goto EXIT;
   }
+  source.path = myargv[0];
+  source.count = 0;
 
-  /* read the first pattern */
-  if ((rc = read_one_pattern(patternfile, pattern)) != RET_COMMAND_OK)
-  {
-      fprintf(stderr, "read of patternfile %s has failed\n", myargv[0]);
-      goto CLOSE_EXIT;
-  }
+  checkpointed = (start_checkpoint(myargv[0], &checkpoint, &first)
+                  == RET_CHECKPOINT_OK);
 
   /* set duration of display in multiples of 100 ms */
-  pattern[LINES_PER_PATTERN] = DISPLAY_DURATION;
+  rc = upload_patterns(hdl, next_file_pattern, &source, DISPLAY_DURATION,
+                       first, checkpointed ? &checkpoint : NULL);
 
-  /* write first pattern */
-  rc = send_command(hdl, 'G', LINES_PER_PATTERN + 1, pattern);
-  if (rc != RET_COMMAND_OK) 
+  if (checkpointed)
   {
-    fprintf(stderr, "sending command storepattern has failed.\n");
-    goto CLOSE_EXIT;
+    close_checkpoint(&checkpoint, rc == RET_COMMAND_OK);
+    free(checkpoint.path);
   }
-
-  rc = receive_response(hdl, response, CMD_STORE_PATTERN_RSP_LEN);
-  if (rc != RET_COMMAND_OK) 
-  {
-    fprintf(stderr, "receiving response of command storepattern "
-                    "has failed.\n");
-    goto CLOSE_EXIT;
-  }
-  
-  /* read the subsequent patterns */
-  while (read_patternfile(patternfile, &dummy) == RET_PATTERN_OK)
-  {
-    if ((rc = read_one_pattern(patternfile, pattern)) != RET_COMMAND_OK)
-    {
-      fprintf(stderr, "read of patternfile %s has failed\n", myargv[0]);
-      goto CLOSE_EXIT;
-    }
-
-    /* set duration of display in multiples of 100 ms */
-    pattern[LINES_PER_PATTERN] = DISPLAY_DURATION;
-    rc = send_command(hdl, 'I', LINES_PER_PATTERN + 1, pattern);
-    if (rc != RET_COMMAND_OK) 
-    {
-      fprintf(stderr, "sending command storepattern has failed.\n");
-      goto CLOSE_EXIT;
-    }
-
-    rc = receive_response(hdl, response, CMD_STORE_PATTERN_RSP_LEN);
-    if (rc != RET_COMMAND_OK) 
-    {
-      if (rc == RET_COMMAND_ERR_NAK)
-      {
-        fprintf(stderr, "storage for patterns is exhausted.\n");
-      }
-      else
-      {
-        fprintf(stderr, "receiving response of command storepattern "
-                        "has failed.\n");
-      }
-      goto CLOSE_EXIT;
-    }
-  }
-
-CLOSE_EXIT:
-  close_patternfile(patternfile);
+  close_patternfile(source.patternfile);
 
 EXIT:
   return rc;
@@ -275,17 +347,16 @@ EXIT:
 int set_normalmode(SERHDL hdl, int myargc, char **myargv)
 {
   int rc;
-  #define CMD_SET_NORMALMODE_RSP_LEN (6)
-  unsigned char response[CMD_SET_NORMALMODE_RSP_LEN];
+  unsigned char response[CMD_RSPLEN(CMD_SETNORMALMODE)];
 
-  rc = send_command(hdl, 'A', 0, NULL);
+  rc = SEND_FIXED_CMD(hdl, CMD_SETNORMALMODE);
   if (rc != RET_COMMAND_OK) 
   {
     fprintf(stderr, "sending command setnormalmode has failed.\n");
     goto EXIT;
   }
 
-  rc = receive_response(hdl, response, CMD_SET_NORMALMODE_RSP_LEN);
+  rc = RECEIVE_RSP(hdl, CMD_SETNORMALMODE, response);
   if (rc != RET_COMMAND_OK) 
   {
     fprintf(stderr, "receiving response of command setnormalmode "
@@ -301,17 +372,16 @@ EXIT:
 int set_textmode(SERHDL hdl, int myargc, char **myargv)
 {
   int rc;
-  #define CMD_SET_TEXTMODE_RSP_LEN (6)
-  unsigned char response[CMD_SET_TEXTMODE_RSP_LEN];
+  unsigned char response[CMD_RSPLEN(CMD_SETTEXTMODE)];
 
-  rc = send_command(hdl, 'C', 0, NULL);
+  rc = SEND_FIXED_CMD(hdl, CMD_SETTEXTMODE);
   if (rc != RET_COMMAND_OK) 
   {
     fprintf(stderr, "sending command settextmode has failed.\n");
     goto EXIT;
   }
 
-  rc = receive_response(hdl, response, CMD_SET_TEXTMODE_RSP_LEN);
+  rc = RECEIVE_RSP(hdl, CMD_SETTEXTMODE, response);
   if (rc != RET_COMMAND_OK) 
   {
     fprintf(stderr, "receiving response of command settextmode "
@@ -327,17 +397,16 @@ EXIT:
 int set_patternmode(SERHDL hdl, int myargc, char **myargv)
 {
   int rc;
-  #define CMD_SET_PATTERNMODE_RSP_LEN (6)
-  unsigned char response[CMD_SET_PATTERNMODE_RSP_LEN];
+  unsigned char response[CMD_RSPLEN(CMD_SETPATTERNMODE)];
 
-  rc = send_command(hdl, 'B', 0, NULL);
+  rc = SEND_FIXED_CMD(hdl, CMD_SETPATTERNMODE);
   if (rc != RET_COMMAND_OK) 
   {
     fprintf(stderr, "sending command setpatternmode has failed.\n");
     goto EXIT;
   }
 
-  rc = receive_response(hdl, response, CMD_SET_PATTERNMODE_RSP_LEN);
+  rc = RECEIVE_RSP(hdl, CMD_SETPATTERNMODE, response);
   if (rc != RET_COMMAND_OK) 
   {
     fprintf(stderr, "receiving response of command setpatternmode "
@@ -354,7 +423,7 @@ int exe_factoryreset(SERHDL hdl, int myargc, char **myargv)
 {
   int rc;
 
-  rc = send_command(hdl, 'X', 0, NULL);
+  rc = SEND_FIXED_CMD(hdl, CMD_FACTORYRESET);
   if (rc != RET_COMMAND_OK) 
   {
     fprintf(stderr, "sending command factoryreset has failed.\n");
@@ -364,78 +433,123 @@ int exe_factoryreset(SERHDL hdl, int myargc, char **myargv)
 }
 
 
-static int send_command(SERHDL hdl, char command, int nparam,
-                        unsigned char *params)
+int send_command(SERHDL hdl, char command, int nparam,
+                 unsigned char *params)
 {
   int rc;
-  unsigned char checksum[2];
-  unsigned char length_high;
-  unsigned char length_low;
-  unsigned short crc16;
-  unsigned short dummy;
-  int i;
+  unsigned char *frame;
+  int framelen;
 
-  /* set initial value for crc16 computation */
-  crc16 = INITIAL_VALUE;
+  PROBE2(send_command_entry, command, nparam);
 
-  /* write start frame character */
-  rc = write_and_crc_byte(hdl, STX, &crc16);
-  if (rc != 1)
+  frame = malloc(FRAME_ENCODED_LEN(nparam));
+  if (frame == NULL)
   {
     rc = RET_COMMAND_ERR_WRITE;
     goto EXIT;
   }
 
-  /* write two byte length, command + params */
-  length_high = 0;
-  rc = write_serial_with_escape(hdl, length_high, &crc16);
-  if (rc != 1)
+  framelen = encode_frame(command, nparam, params, frame);
+  rc = send_frame(hdl, frame, framelen);
+
+  free(frame);
+
+EXIT:
+  PROBE1(send_command_return, rc);
+  return rc;
+}
+
+
+int send_frame(SERHDL hdl, unsigned char *frame, int framelen)
+{
+  return write_frame_bytes(hdl, frame, framelen, 1);
+}
+
+
+int receive_response(SERHDL hdl, unsigned char *response, int rsplen)
+{
+  int rc;
+
+  PROBE1(receive_response_entry, rsplen);
+  rc = receive_text_response(hdl, response, rsplen, 0);
+  PROBE1(receive_response_return, rc);
+
+  return rc;
+}
+
+
+/*
+ * A frame may still be on its way when write() returns, the module answers
+ * after its last byte, so the timeout grows with the wire time of textlen.
+ */
+static int receive_text_response(SERHDL hdl, unsigned char *response,
+                                 int rsplen, int textlen)
+{
+  int rc;
+  int i;
+
+  if (dry_run)
   {
-    rc = RET_COMMAND_ERR_WRITE;
+    /* an ACK of the right length, no NAK */
+    memset(response, 0, rsplen);
+    response[0] = STX;
+    wire_cost.rspbytes += rsplen;
+    rc = RET_COMMAND_OK;
     goto EXIT;
   }
   
-  length_low = 1 + nparam;
-  rc = write_serial_with_escape(hdl, length_low, &crc16);
-  if (rc != 1)
+  rc = read_serial_timeout(hdl, response, rsplen, READ_TIMEOUT_MS +
+                           2 * textlen * 1000LL / LINE_BYTES_PER_S);
+  if ( (rc == -1) || (rc != rsplen) )
   {
-    rc = RET_COMMAND_ERR_WRITE;
+    rc = RET_COMMAND_ERR_READ;
     goto EXIT;
   }
-
-  /* write command */
-  rc = write_serial_with_escape(hdl, command, &crc16);
-  if (rc != 1)
+    
+  if ( (rsplen >= 4) && (response[3] == NAK) )
   {
-    rc = RET_COMMAND_ERR_WRITE;
+    rc = RET_COMMAND_ERR_NAK;
     goto EXIT;
   }
-
-  /* write params */
-  if (nparam) 
+ 
+  if (response_trace)
   {
-    for (i = 0; i < nparam; i++)
+    printf("rsp: ");
+    for (i = 0; i < rsplen; i++)
     {
-      rc = write_serial_with_escape(hdl, params[i], &crc16);
-      if (rc != 1)
-      {
-        rc = RET_COMMAND_ERR_WRITE;
-        goto EXIT;
-      }
+      printf("%02X ", *(response + i));
     }
+    printf("\n");
   }
 
-  /* write checksum CRC16 */
-  checksum[0] = (crc16 >> 8) & 0xff;
-  checksum[1] = crc16 & 0xff;
-  rc = write_serial_with_escape(hdl, checksum[0], &dummy); 
-  if (rc != 1)
+  rc = RET_COMMAND_OK;
+
+EXIT:
+  return rc;
+}
+
+
+
+void trace_responses(int on)
+{
+  response_trace = on;
+}
+
+
+static int write_frame_bytes(SERHDL hdl, unsigned char *bytes, int len,
+                             int start)
+{
+  int rc;
+
+  if (dry_run)
   {
-    rc = RET_COMMAND_ERR_WRITE;
+    count_frame(bytes, len, start);
+    rc = RET_COMMAND_OK;
     goto EXIT;
   }
-  rc = write_serial_with_escape(hdl, checksum[1], &dummy); 
-  if (rc != 1)
+
+  rc = write_serial(hdl, bytes, len);
+  if (rc != len)
   {
     rc = RET_COMMAND_ERR_WRITE;
     goto EXIT;
@@ -448,120 +562,427 @@ EXIT:
 }
 
 
-static int write_serial_with_escape(SERHDL hdl, unsigned char byte,
-                                    unsigned short *crc16)
+/*
+ * Encodes and writes a text frame in one pass over the text, TEXT_CHUNK
+ * bytes at a time, so neither a copy of the text nor its encoded frame is
+ * ever held in memory.
+ */
+static int send_text(SERHDL hdl, char command, unsigned char *text,
+                     int textlen)
 {
   int rc;
+  FRAME_ENCODER encoder;
+  unsigned char out[FRAME_HEAD_LEN + 2 * TEXT_CHUNK + FRAME_TAIL_LEN];
+  int pos;
+  int done;
+  int n;
+  unsigned long long start;
+
+  pos = 0;
+  done = 0;
+  do
+  {
+    start = begin_phase();
+    if (done == 0)
+    {
+      pos = begin_frame(&encoder, command, textlen, out);
+    }
+    n = (textlen - done > TEXT_CHUNK) ? TEXT_CHUNK : textlen - done;
+    pos += encode_params(&encoder, n, text + done, out + pos);
+    if (done + n == textlen)
+    {
+      pos += end_frame(&encoder, out + pos);
+    }
+    end_phase(PHASE_ENCODE, start);
+    if ((rc = write_frame_bytes(hdl, out, pos, done == 0)) != RET_COMMAND_OK)
+    {
+      goto EXIT;
+    }
+    done += n;
+    pos = 0;
+  } while (done < textlen);
 
-  switch (byte)
-  {
-    case STX:
-      rc = write_and_crc_byte(hdl, ESC, crc16);
-      if (rc != 1) 
-      {
-        goto EXIT;
-      }
-      rc = write_and_crc_byte(hdl, STX | FLAG, crc16);
-      break;
-
-    case ESC:
-      rc = write_and_crc_byte(hdl, ESC, crc16);
-      if (rc != 1) 
-      {
-        goto EXIT;
-      }
-      rc = write_and_crc_byte(hdl, ESC | FLAG, crc16);
-      break;
-
-    default:
-      rc = write_and_crc_byte(hdl, byte, crc16);
-      break;
-  }
+  rc = RET_COMMAND_OK;
 
 EXIT:
   return rc;
 }
 
 
-static int write_and_crc_byte(SERHDL hdl, unsigned char byte,
-                              unsigned short *crc16)
+static int text_command(SERHDL hdl, char command, char *name, char *path)
 {
   int rc;
+  TEXT_SOURCE source;
+  unsigned char response[CMD_RSPLEN(CMD_DISPLAYTEXT)];
 
-  rc = write_serial(hdl, &byte, 1); 
-  if (rc == 1)
+  if ((rc = open_text(path, &source)) == TEXT_TOO_LONG)
   {
-    *crc16 = calc_crc16(*crc16, byte);
+    fprintf(stderr, "text is longer than %d bytes.\n", MAX_FRAME_PARAM);
+    rc = RET_COMMAND_ERR_WRITE;
+    goto EXIT;
+  }
+  if (rc != RET_COMMAND_OK)
+  {
+    fprintf(stderr, "read of text file %s has failed.\n", path);
+    goto EXIT;
   }
 
+  if (source.textlen > MAX_FRAME_PARAM)
+  {
+    fprintf(stderr, "text is longer than %d bytes.\n", MAX_FRAME_PARAM);
+    rc = RET_COMMAND_ERR_WRITE;
+    goto CLOSE_EXIT;
+  }
+
+  if ((rc = send_text(hdl, command, source.text, source.textlen))
+      != RET_COMMAND_OK)
+  {
+    fprintf(stderr, "sending command %s has failed.\n", name);
+    goto CLOSE_EXIT;
+  }
+
+  if ((rc = receive_text_response(hdl, response, sizeof(response),
+                                  source.textlen)) != RET_COMMAND_OK)
+  {
+    fprintf(stderr, "receiving response of command %s has failed.\n", name);
+    goto CLOSE_EXIT;
+  }
+
+CLOSE_EXIT:
+  close_text(&source);
+
+EXIT:
   return rc;
 }
 
 
-static int receive_response(SERHDL hdl, unsigned char *response, int rsplen)
+#if LINUX
+
+/* regular files are mapped, pipes and stdin ("-") read into memory */
+static int open_text(char *path, TEXT_SOURCE *source)
 {
   int rc;
-  int i;
-  
-  rc = read_serial(hdl, response, rsplen);
-  if ( (rc == -1) || (rc != rsplen) )
+  int fd;
+  struct stat st;
+  FILE *handle;
+  void *map;
+
+  memset(source, 0, sizeof(TEXT_SOURCE));
+  if (strcmp(path, "-") == 0)
+  {
+    rc = read_text(stdin, source);
+    goto EXIT;
+  }
+
+  if ((fd = open(path, O_RDONLY)) == -1)
   {
     rc = RET_COMMAND_ERR_READ;
     goto EXIT;
   }
-    
-  if ( (rsplen >= 4) && (response[3] == NAK) )
+  if ((fstat(fd, &st) == -1) || !S_ISREG(st.st_mode) || (st.st_size == 0))
   {
-    rc = RET_COMMAND_ERR_NAK;
+    if ((handle = fdopen(fd, "rb")) == NULL)
+    {
+      close(fd);
+      rc = RET_COMMAND_ERR_READ;
+      goto EXIT;
+    }
+    rc = read_text(handle, source);
+    fclose(handle);
     goto EXIT;
   }
- 
-  printf("rsp: ");
-  for (i = 0; i < rsplen; i++)
+
+  /* checked as off_t, a length beyond int range would wrap */
+  if (st.st_size > MAX_TEXT_FILE)
+  {
+    close(fd);
+    rc = TEXT_TOO_LONG;
+    goto EXIT;
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
   {
-    printf("%02X ", *(response + i));
+    rc = RET_COMMAND_ERR_READ;
+    goto EXIT;
   }
-  printf("\n");
+  source->text = (unsigned char *) map;
+  source->size = st.st_size;
+  source->textlen = st.st_size;
 
   rc = RET_COMMAND_OK;
 
 EXIT:
+  /* the line end of the last line is not part of the text */
+  while ((source->textlen > 0) &&
+         ((source->text[source->textlen - 1] == '\n') ||
+          (source->text[source->textlen - 1] == '\r')))
+  {
+    source->textlen--;
+  }
   return rc;
 }
 
 
+static void close_text(TEXT_SOURCE *source)
+{
+  if (source->size > 0)
+  {
+    munmap(source->text, source->size);
+  }
+  else
+  {
+    free(source->text);
+  }
+}
+
+#endif
+
+
+#if WIN
+
+static int open_text(char *path, TEXT_SOURCE *source)
+{
+  int rc;
+  FILE *handle;
+
+  memset(source, 0, sizeof(TEXT_SOURCE));
+  if (strcmp(path, "-") == 0)
+  {
+    rc = read_text(stdin, source);
+  }
+  else if ((handle = fopen(path, "rb")) == NULL)
+  {
+    rc = RET_COMMAND_ERR_READ;
+  }
+  else
+  {
+    rc = read_text(handle, source);
+    fclose(handle);
+  }
+
+  while ((source->textlen > 0) &&
+         ((source->text[source->textlen - 1] == '\n') ||
+          (source->text[source->textlen - 1] == '\r')))
+  {
+    source->textlen--;
+  }
+  return rc;
+}
+
+
+static void close_text(TEXT_SOURCE *source)
+{
+  free(source->text);
+}
+
+#endif
+
+
+/* reads up to one byte more than a text file may have, enough to reject it */
+static int read_text(FILE *handle, TEXT_SOURCE *source)
+{
+  size_t n;
+
+  if ((source->text = malloc(MAX_TEXT_FILE + 1)) == NULL)
+  {
+    return RET_COMMAND_ERR_READ;
+  }
+
+  n = fread(source->text, 1, MAX_TEXT_FILE + 1, handle);
+  if (ferror(handle) || (n > MAX_TEXT_FILE))
+  {
+    free(source->text);
+    source->text = NULL;
+    return ferror(handle) ? RET_COMMAND_ERR_READ : TEXT_TOO_LONG;
+  }
+  source->textlen = n;
+
+  return RET_COMMAND_OK;
+}
 
-static int read_one_pattern(FILE *patternfile, unsigned char *pattern)
+
+/*
+ * Sets up the checkpoint of a storepattern upload, <patternfile>.ckpt or
+ * --checkpoint=<path>. With --resume, first is the pattern after the last
+ * one acked in a checkpoint of the same animation, 0 otherwise. A dry run
+ * only reads the checkpoint and returns without one.
+ */
+static int start_checkpoint(char *patternfile, CHECKPOINT *checkpoint,
+                            int *first)
 {
   int rc;
-  int lines;
-  int columns;
-  unsigned char linepattern;
+  char *path;
+  unsigned long long hash;
+  int acked;
+
+  *first = 0;
 
-  for (lines = 0; lines  < LINES_PER_PATTERN; lines++)
+  if ((path = get_option("checkpoint")) != NULL)
   {
-    pattern[lines] = 0;
+    path = strdup(path);
+  }
+  else if ((path = malloc(strlen(patternfile) +
+                          strlen(CHECKPOINT_SUFFIX) + 1)) != NULL)
+  {
+    strcpy(path, patternfile);
+    strcat(path, CHECKPOINT_SUFFIX);
+  }
+  if (path == NULL)
+  {
+    rc = RET_CHECKPOINT_ERR_OPEN;
+    goto EXIT;
   }
 
-  for (lines = 0; lines < LINES_PER_PATTERN; lines++)
+  if ((rc = hash_file(patternfile, &hash)) != RET_CHECKPOINT_OK)
   {
-    if ((rc = read_patternfile(patternfile, &linepattern)) != RET_PATTERN_OK)
+    goto FREE_EXIT;
+  }
+
+  if (get_option("resume") != NULL)
+  {
+    if (read_checkpoint(path, hash, &acked) == RET_CHECKPOINT_OK)
     {
-      rc = RET_COMMAND_ERR_READ;
-      goto EXIT;
+      *first = acked + 1;
+      printf("resuming upload at pattern %d\n", *first);
+    }
+    else
+    {
+      fprintf(stderr, "no checkpoint of this animation in %s, "
+                      "uploading all patterns.\n", path);
     }
+  }
 
-    for (columns = 0; columns < COLUMNS_PER_PATTERN; columns++)
+  /* a dry run prices the resume but leaves the checkpoint as it is */
+  if (dry_run)
+  {
+    rc = RET_CHECKPOINT_ERR_OPEN;
+    goto FREE_EXIT;
+  }
+
+  /* the progress so far has to survive a failure before the next ack */
+  if (((rc = open_checkpoint(path, hash, checkpoint)) != RET_CHECKPOINT_OK) ||
+      ((rc = update_checkpoint(checkpoint, *first - 1)) != RET_CHECKPOINT_OK))
+  {
+    fprintf(stderr, "write of checkpoint %s has failed, "
+                    "continuing without.\n", path);
+    if (rc != RET_CHECKPOINT_ERR_OPEN)
     {
-      if (linepattern & (1 << (COLUMNS_PER_PATTERN - columns - 1))) 
-      {
-        pattern[columns] = pattern[columns] | (1 << lines);
-      }
+      close_checkpoint(checkpoint, 0);
     }
+    goto FREE_EXIT;
   }
-  
-  rc = RET_COMMAND_OK;
+
+  rc = RET_CHECKPOINT_OK;
+  goto EXIT;
+
+FREE_EXIT:
+  free(path);
 
 EXIT:
   return rc;
 }
+
+
+/* from now on nothing is written to or read from the port */
+void start_dry_run(void)
+{
+  memset(&wire_cost, 0, sizeof(wire_cost));
+  dry_run = 1;
+}
+
+
+/*
+ * The wire time is what the counted bytes take at 38400 8N1, without the
+ * turnaround of adapter and module, see linkbench for that.
+ */
+void print_dry_run(void)
+{
+  int i;
+
+  printf("dry run: %ld frame%s, %ld bytes (%ld for escapes), "
+         "%ld response bytes\n", wire_cost.frames,
+         (wire_cost.frames == 1) ? "" : "s", wire_cost.bytes,
+         wire_cost.escapes, wire_cost.rspbytes);
+  for (i = 0; i < 128; i++)
+  {
+    if (wire_cost.letters[i] > 0)
+    {
+      printf("  '%c' %8ld frame%s\n", i, wire_cost.letters[i],
+             (wire_cost.letters[i] == 1) ? "" : "s");
+    }
+  }
+  printf("wire time at 38400 8N1: %.1f ms\n",
+         (wire_cost.bytes + wire_cost.rspbytes) * 1000.0 / LINE_BYTES_PER_S);
+  printf("device memory: %ld pattern%s, %ld text bytes\n",
+         wire_cost.patterns, (wire_cost.patterns == 1) ? "" : "s",
+         wire_cost.textbytes);
+}
+
+
+/*
+ * Unescapes the start of a frame far enough to know its command and size.
+ * Long frames come in several writes, only the first has start set.
+ */
+static void count_frame(unsigned char *bytes, int len, int start)
+{
+  unsigned char raw[4];
+  int nraw;
+  int i;
+
+  nraw = 0;
+  for (i = 0; i < len; i++)
+  {
+    if (bytes[i] == ESC)
+    {
+      wire_cost.escapes++;
+      continue;
+    }
+    if (nraw < sizeof(raw))
+    {
+      raw[nraw] = (i > 0) && (bytes[i - 1] == ESC) ? bytes[i] & ~FLAG :
+                                                     bytes[i];
+    }
+    nraw++;
+  }
+
+  wire_cost.bytes += len;
+  if (response_trace)
+  {
+    printf(start ? "frm: " : "     ");
+    for (i = 0; i < len; i++)
+    {
+      printf("%02X ", bytes[i]);
+    }
+    printf("\n");
+  }
+
+  if (!start)
+  {
+    return;
+  }
+  wire_cost.frames++;
+  if (nraw < sizeof(raw))
+  {
+    return;
+  }
+  wire_cost.letters[raw[3] & 0x7f]++;
+
+  switch (raw[3])
+  {
+    case CMD_LETTER(CMD_STOREFIRSTPATTERN):
+      wire_cost.patterns = 1;
+      break;
+    case CMD_LETTER(CMD_STORENEXTPATTERN):
+      wire_cost.patterns++;
+      break;
+    case CMD_LETTER(CMD_STORETEXT):
+      wire_cost.textbytes = raw[1] * 256 + raw[2] - 1;
+      break;
+    case CMD_LETTER(CMD_FACTORYRESET):
+      wire_cost.patterns = 0;
+      wire_cost.textbytes = 0;
+      break;
+  }
+}
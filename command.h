@@ -5,6 +5,7 @@
 #define RET_COMMAND_ERR_READ  (1)
 #define RET_COMMAND_ERR_WRITE (2)
 #define RET_COMMAND_ERR_NAK   (3)
+#define RET_COMMAND_ERR_THREAD (4)
 
 #if COMMAND_SRC
 # define EXTERN 
@@ -14,8 +15,11 @@
 
 
 EXTERN int get_firmwareversion(SERHDL hdl, int myargc, char **myargv);
+EXTERN int probe_firmwareversion(SERHDL hdl, int timeout_ms, int *version);
 EXTERN int display_text(SERHDL hdl, int myargc, char **myargv);
 EXTERN int store_text(SERHDL hdl, int myargc, char **myargv);
+EXTERN int display_textfile(SERHDL hdl, int myargc, char **myargv);
+EXTERN int store_textfile(SERHDL hdl, int myargc, char **myargv);
 EXTERN int set_textspeed(SERHDL hdl, int myargc, char **myargv);
 EXTERN int display_pattern(SERHDL hdl, int myargc, char **myargv);
 EXTERN int store_pattern(SERHDL hdl, int myargc, char **myargv);
@@ -24,6 +28,14 @@ EXTERN int set_textmode(SERHDL hdl, int myargc, char **myargv);
 EXTERN int set_patternmode(SERHDL hdl, int myargc, char **myargv);
 EXTERN int exe_factoryreset(SERHDL hdl, int myargc, char **myargv);
 
+EXTERN int send_command(SERHDL hdl, char command, int nparam,
+                        unsigned char *params);
+EXTERN int send_frame(SERHDL hdl, unsigned char *frame, int framelen);
+EXTERN int receive_response(SERHDL hdl, unsigned char *response, int rsplen);
+EXTERN void trace_responses(int on);
+EXTERN void start_dry_run(void);
+EXTERN void print_dry_run(void);
+
 #undef EXTERN
 
 #endif
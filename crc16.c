@@ -4,7 +4,6 @@
 
 unsigned short calc_crc16(unsigned short initial, unsigned char value)
 {
-#define POLYNOM (0x8005)
   int i;
   unsigned short result;
 
@@ -13,7 +12,7 @@ unsigned short calc_crc16(unsigned short initial, unsigned char value)
   {
     if (((result & 0x8000) ^ (unsigned long) ((value & 0x80) << 8)) == 0x8000)
     {
-      result = (result << 1) ^ POLYNOM;
+      result = (result << 1) ^ CRC16_POLYNOM;
     }
     else
     {
@@ -2,6 +2,7 @@
 #define CRC16_H
 
 #define INITIAL_VALUE 0xffff
+#define CRC16_POLYNOM (0x8005)
 
 #if CRC16_SRC
 # define EXTERN 
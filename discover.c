@@ -0,0 +1,474 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if LINUX
+#  include <glob.h>
+#  include <dirent.h>
+#  include <limits.h>
+#endif
+
+#include <serial.h>
+#include <command.h>
+#include <pool.h>
+#include <options.h>
+#include <timing.h>
+
+#define DISCOVER_SRC 1
+#include <discover.h>
+#undef DISCOVER_SRC
+
+#define MAX_PROBES      (256)
+#define PROBE_NAME_LEN  (256)
+#define MAX_LINE        (1024)
+
+#define DEFAULT_TIMEOUT (50)          /* ms to wait for the version */
+#define DEFAULT_MAXAGE  (24 * 3600)   /* s a cached probe stays valid */
+
+#if LINUX
+#  define DEFAULT_PORTS   "/dev/ttyUSB* /dev/ttyACM*"
+#  define SERIAL_BY_ID    "/dev/serial/by-id"
+#  define CACHE_NAME      ".mmm8x8-probe"
+#else
+#  define MAX_COM_PORT    (32)
+#  define CACHE_NAME      "mmm8x8-probe.txt"
+#endif
+
+typedef struct {
+  char      path[PROBE_NAME_LEN];
+  char      key[PROBE_NAME_LEN];  /* USB serial if known, else the path */
+  int       found;                /* answered like an MMM8x8 */
+  int       version[3];
+  long      rtt_us;
+  long long probed;               /* time() of the probe */
+  int       cached;               /* taken from the cache, not probed */
+} PROBE;
+
+typedef struct {
+  PROBE *probes;
+  int   *jobs;                    /* indices of the probes to run */
+  int    timeout_ms;
+} DISCOVERY;
+
+static int run_discovery(PROBE *probes, int *nprobes);
+static int list_candidates(PROBE *probes, int *nprobes);
+static void find_keys(PROBE *probes, int nprobes);
+static char *cache_path(void);
+static void read_cache(char *path, PROBE *probes, int nprobes);
+static void write_cache(char *path, PROBE *probes, int nprobes);
+static int probe_job(void *ctx, int job);
+
+
+/*
+ * Lists the serial ports that have an MMM8x8 attached. Ports not in the
+ * probe cache, or with an entry older than --maxage seconds, are probed
+ * in parallel by sending 'v' with a short timeout.
+ */
+int discover_devices(int myargc, char **myargv)
+{
+  int rc;
+  PROBE *probes;
+  int nprobes;
+  int nfound;
+  int i;
+
+  if ((probes = calloc(MAX_PROBES, sizeof(PROBE))) == NULL)
+  {
+    rc = RET_DISCOVER_ERR_MEMORY;
+    goto EXIT;
+  }
+
+  if ((rc = run_discovery(probes, &nprobes)) != RET_DISCOVER_OK)
+  {
+    goto FREE_EXIT;
+  }
+
+  nfound = 0;
+  for (i = 0; i < nprobes; i++)
+  {
+    if (!probes[i].found)
+    {
+      continue;
+    }
+    printf("%-16s %3d.%d.%d %8.1f ms  %-6s  %s\n", probes[i].path,
+           probes[i].version[0], probes[i].version[1], probes[i].version[2],
+           probes[i].rtt_us / 1000.0, probes[i].cached ? "cached" : "probed",
+           probes[i].key);
+    nfound++;
+  }
+
+  rc = (nfound > 0) ? RET_DISCOVER_OK : RET_DISCOVER_ERR_NONE;
+
+FREE_EXIT:
+  free(probes);
+
+EXIT:
+  return rc;
+}
+
+
+/* path of the first port with an MMM8x8, for the device name "auto" */
+int find_device(char *path, int size)
+{
+  int rc;
+  PROBE *probes;
+  int nprobes;
+  int i;
+
+  if ((probes = calloc(MAX_PROBES, sizeof(PROBE))) == NULL)
+  {
+    rc = RET_DISCOVER_ERR_MEMORY;
+    goto EXIT;
+  }
+
+  if ((rc = run_discovery(probes, &nprobes)) != RET_DISCOVER_OK)
+  {
+    goto FREE_EXIT;
+  }
+
+  rc = RET_DISCOVER_ERR_NONE;
+  for (i = 0; i < nprobes; i++)
+  {
+    if (probes[i].found)
+    {
+      snprintf(path, size, "%s", probes[i].path);
+      rc = RET_DISCOVER_OK;
+      break;
+    }
+  }
+
+FREE_EXIT:
+  free(probes);
+
+EXIT:
+  return rc;
+}
+
+
+static int run_discovery(PROBE *probes, int *nprobes)
+{
+  int rc;
+  int i;
+  int njobs;
+  char *cache;
+  DISCOVERY discovery;
+
+  if ((rc = list_candidates(probes, nprobes)) != RET_DISCOVER_OK)
+  {
+    goto EXIT;
+  }
+  find_keys(probes, *nprobes);
+
+  cache = cache_path();
+  if ((cache != NULL) && (get_option("refresh") == NULL))
+  {
+    read_cache(cache, probes, *nprobes);
+  }
+
+  /* probe what the cache does not know, all ports at once */
+  discovery.probes = probes;
+  discovery.timeout_ms = get_int_option("timeout", DEFAULT_TIMEOUT);
+  if ((discovery.jobs = malloc((*nprobes + 1) * sizeof(int))) == NULL)
+  {
+    rc = RET_DISCOVER_ERR_MEMORY;
+    goto FREE_EXIT;
+  }
+  njobs = 0;
+  for (i = 0; i < *nprobes; i++)
+  {
+    if (!probes[i].cached)
+    {
+      discovery.jobs[njobs++] = i;
+    }
+  }
+
+  if (njobs > 0)
+  {
+    if (run_pool(njobs, njobs, probe_job, &discovery) != RET_POOL_OK)
+    {
+      rc = RET_DISCOVER_ERR_MEMORY;
+      goto FREE_EXIT;
+    }
+    if (cache != NULL)
+    {
+      write_cache(cache, probes, *nprobes);
+    }
+  }
+
+  rc = RET_DISCOVER_OK;
+
+FREE_EXIT:
+  free(discovery.jobs);
+  free(cache);
+
+EXIT:
+  return rc;
+}
+
+
+#if LINUX
+
+static int list_candidates(PROBE *probes, int *nprobes)
+{
+  int rc;
+  char *patterns;
+  char *pattern;
+  glob_t globbuf;
+  int flags;
+  size_t i;
+
+  if ((patterns = get_option("ports")) == NULL)
+  {
+    patterns = DEFAULT_PORTS;
+  }
+  if ((patterns = strdup(patterns)) == NULL)
+  {
+    rc = RET_DISCOVER_ERR_MEMORY;
+    goto EXIT;
+  }
+
+  flags = 0;
+  for (pattern = strtok(patterns, " "); pattern != NULL;
+       pattern = strtok(NULL, " "))
+  {
+    glob(pattern, flags, NULL, &globbuf);
+    flags = GLOB_APPEND;
+  }
+
+  *nprobes = 0;
+  for (i = 0; (flags != 0) && (i < globbuf.gl_pathc) &&
+              (*nprobes < MAX_PROBES); i++)
+  {
+    snprintf(probes[*nprobes].path, PROBE_NAME_LEN, "%s",
+             globbuf.gl_pathv[i]);
+    (*nprobes)++;
+  }
+  if (flags != 0)
+  {
+    globfree(&globbuf);
+  }
+  free(patterns);
+
+  rc = RET_DISCOVER_OK;
+
+EXIT:
+  return rc;
+}
+
+
+/*
+ * The links in /dev/serial/by-id carry the USB serial number, which stays
+ * with the adapter when it comes back under another ttyUSB name. Ports
+ * without one are known by their path.
+ */
+void get_port_key(char *path, char *key, int size)
+{
+  DIR *dir;
+  struct dirent *entry;
+  char link[PATH_MAX];
+  char target[PATH_MAX];
+  char device[PATH_MAX];
+
+  snprintf(key, size, "%s", path);
+
+  if ((realpath(path, device) == NULL) ||
+      ((dir = opendir(SERIAL_BY_ID)) == NULL))
+  {
+    return;
+  }
+
+  while ((entry = readdir(dir)) != NULL)
+  {
+    if (entry->d_name[0] == '.')
+    {
+      continue;
+    }
+    snprintf(link, sizeof(link), "%s/%s", SERIAL_BY_ID, entry->d_name);
+    if ((realpath(link, target) != NULL) && (strcmp(device, target) == 0))
+    {
+      snprintf(key, size, "%s", entry->d_name);
+      break;
+    }
+  }
+
+  closedir(dir);
+}
+
+#endif /* LINUX */
+
+#if WIN
+
+static int list_candidates(PROBE *probes, int *nprobes)
+{
+  int i;
+
+  if (get_option("ports") != NULL)
+  {
+    snprintf(probes[0].path, PROBE_NAME_LEN, "%s", get_option("ports"));
+    *nprobes = 1;
+    return RET_DISCOVER_OK;
+  }
+
+  for (i = 0; i < MAX_COM_PORT; i++)
+  {
+    snprintf(probes[i].path, PROBE_NAME_LEN, "COM%d", i + 1);
+  }
+  *nprobes = MAX_COM_PORT;
+
+  return RET_DISCOVER_OK;
+}
+
+
+void get_port_key(char *path, char *key, int size)
+{
+  snprintf(key, size, "%s", path);
+}
+
+#endif /* WIN */
+
+
+static void find_keys(PROBE *probes, int nprobes)
+{
+  int i;
+
+  for (i = 0; i < nprobes; i++)
+  {
+    get_port_key(probes[i].path, probes[i].key, PROBE_NAME_LEN);
+  }
+}
+
+
+/* --cache=<path>, or a file in the home directory */
+static char *cache_path(void)
+{
+  char *home;
+  char *path;
+
+  if (get_option("cache") != NULL)
+  {
+    return strdup(get_option("cache"));
+  }
+
+  if ((home = getenv("HOME")) == NULL)
+  {
+    return NULL;
+  }
+  if ((path = malloc(strlen(home) + strlen(CACHE_NAME) + 2)) != NULL)
+  {
+    sprintf(path, "%s/%s", home, CACHE_NAME);
+  }
+
+  return path;
+}
+
+
+/*
+ * Cache lines: <key> <path> <found> <major> <minor> <patch> <rtt us> <time>
+ * An entry applies if the key is still at the same path and it is recent.
+ * Only found modules are cached, a port without one is probed every time,
+ * it may be a panel that was switched off.
+ */
+static void read_cache(char *path, PROBE *probes, int nprobes)
+{
+  FILE *handle;
+  char line[MAX_LINE];
+  PROBE entry;
+  long long maxage;
+  long long now;
+  int i;
+
+  if ((handle = fopen(path, "r")) == NULL)
+  {
+    return;
+  }
+
+  maxage = get_int_option("maxage", DEFAULT_MAXAGE);
+  now = time(NULL);
+  while (fgets(line, MAX_LINE, handle) != NULL)
+  {
+    if (sscanf(line, "%255s %255s %d %d %d %d %ld %lld", entry.key,
+               entry.path, &entry.found, &entry.version[0],
+               &entry.version[1], &entry.version[2], &entry.rtt_us,
+               &entry.probed) != 8)
+    {
+      continue;
+    }
+    if (!entry.found || (entry.probed > now) || (now - entry.probed > maxage))
+    {
+      continue;
+    }
+
+    for (i = 0; i < nprobes; i++)
+    {
+      if ((strcmp(probes[i].key, entry.key) == 0) &&
+          (strcmp(probes[i].path, entry.path) == 0))
+      {
+        probes[i] = entry;
+        probes[i].cached = 1;
+      }
+    }
+  }
+
+  fclose(handle);
+}
+
+
+static void write_cache(char *path, PROBE *probes, int nprobes)
+{
+  FILE *handle;
+  int i;
+
+  if ((handle = fopen(path, "w")) == NULL)
+  {
+    fprintf(stderr, "write of probe cache %s has failed.\n", path);
+    return;
+  }
+
+  for (i = 0; i < nprobes; i++)
+  {
+    if (!probes[i].found)
+    {
+      continue;
+    }
+    fprintf(handle, "%s %s %d %d %d %d %ld %lld\n", probes[i].key,
+            probes[i].path, probes[i].found, probes[i].version[0],
+            probes[i].version[1], probes[i].version[2], probes[i].rtt_us,
+            probes[i].probed);
+  }
+
+  fclose(handle);
+}
+
+
+/* pool job: open one port and ask for the firmware version */
+static int probe_job(void *ctx, int job)
+{
+  DISCOVERY *discovery;
+  PROBE *probe;
+  SERHDL hdl;
+  unsigned long long start;
+
+  discovery = (DISCOVERY *) ctx;
+  probe = &discovery->probes[discovery->jobs[job]];
+
+  probe->found = 0;
+  probe->rtt_us = 0;
+  probe->probed = time(NULL);
+  if (open_serial(probe->path, &hdl) != RET_SERIAL_OK)
+  {
+    return POOL_JOB_DONE;
+  }
+
+  start = get_time_us();
+  if (probe_firmwareversion(hdl, discovery->timeout_ms, probe->version)
+      == RET_COMMAND_OK)
+  {
+    probe->found = 1;
+    probe->rtt_us = get_time_us() - start;
+  }
+
+  close_serial(hdl);
+
+  return POOL_JOB_DONE;
+}
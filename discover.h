@@ -0,0 +1,22 @@
+#ifndef DISCOVER_H
+#define DISCOVER_H
+
+#define RET_DISCOVER_OK         (0)
+#define RET_DISCOVER_ERR_NONE   (1)
+#define RET_DISCOVER_ERR_MEMORY (2)
+
+#define AUTO_DEVICE "auto"      /* serial device name meaning "discover" */
+
+#if DISCOVER_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int discover_devices(int myargc, char **myargv);
+EXTERN int find_device(char *path, int size);
+EXTERN void get_port_key(char *path, char *key, int size);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,118 @@
+#include <crc16.h>
+#include <profile.h>
+
+#define FRAME_SRC 1
+#include <frame.h>
+#undef FRAME_SRC
+
+static int put_escaped_byte(unsigned char *frame, int pos, unsigned char byte,
+                            unsigned short *crc16);
+static int put_and_crc_byte(unsigned char *frame, int pos, unsigned char byte,
+                            unsigned short *crc16);
+
+
+/* 
+ * Encodes a complete command frame into the buffer frame, which must hold
+ * at least FRAME_ENCODED_LEN(nparam) bytes. Returns the number of bytes
+ * that have to go on the wire.
+ */
+int encode_frame(char command, int nparam, unsigned char *params,
+                 unsigned char *frame)
+{
+  FRAME_ENCODER encoder;
+  int pos;
+  unsigned long long start;
+
+  start = begin_phase();
+  pos = begin_frame(&encoder, command, nparam, frame);
+  pos += encode_params(&encoder, nparam, params, frame + pos);
+  pos += end_frame(&encoder, frame + pos);
+  end_phase(PHASE_ENCODE, start);
+
+  return pos;
+}
+
+
+/*
+ * begin_frame(), encode_params() and end_frame() encode a frame piece by
+ * piece, for parameters too long to be held encoded as a whole. Each
+ * returns the number of bytes it wrote to out: at most FRAME_HEAD_LEN,
+ * twice nparam and FRAME_TAIL_LEN.
+ */
+int begin_frame(FRAME_ENCODER *encoder, char command, int nparam,
+                unsigned char *out)
+{
+  int pos;
+
+  /* set initial value for crc16 computation */
+  encoder->crc16 = INITIAL_VALUE;
+
+  /* start frame character */
+  pos = put_and_crc_byte(out, 0, STX, &encoder->crc16);
+
+  /* two byte length, command + params */
+  pos = put_escaped_byte(out, pos, ((1 + nparam) >> 8) & 0xff,
+                         &encoder->crc16);
+  pos = put_escaped_byte(out, pos, (1 + nparam) & 0xff, &encoder->crc16);
+
+  /* command */
+  return put_escaped_byte(out, pos, command, &encoder->crc16);
+}
+
+
+int encode_params(FRAME_ENCODER *encoder, int nparam, unsigned char *params,
+                  unsigned char *out)
+{
+  int pos;
+  int i;
+
+  pos = 0;
+  for (i = 0; i < nparam; i++)
+  {
+    pos = put_escaped_byte(out, pos, params[i], &encoder->crc16);
+  }
+
+  return pos;
+}
+
+
+/* checksum CRC16, escaped but not part of the checksum itself */
+int end_frame(FRAME_ENCODER *encoder, unsigned char *out)
+{
+  unsigned short dummy;
+  int pos;
+
+  dummy = INITIAL_VALUE;
+  pos = put_escaped_byte(out, 0, (encoder->crc16 >> 8) & 0xff, &dummy);
+  return put_escaped_byte(out, pos, encoder->crc16 & 0xff, &dummy);
+}
+
+
+static int put_escaped_byte(unsigned char *frame, int pos, unsigned char byte,
+                            unsigned short *crc16)
+{
+  switch (byte)
+  {
+    case STX:
+    case ESC:
+      pos = put_and_crc_byte(frame, pos, ESC, crc16);
+      pos = put_and_crc_byte(frame, pos, byte | FLAG, crc16);
+      break;
+
+    default:
+      pos = put_and_crc_byte(frame, pos, byte, crc16);
+      break;
+  }
+
+  return pos;
+}
+
+
+static int put_and_crc_byte(unsigned char *frame, int pos, unsigned char byte,
+                            unsigned short *crc16)
+{
+  frame[pos] = byte;
+  *crc16 = calc_crc16(*crc16, byte);
+
+  return pos + 1;
+}
@@ -0,0 +1,42 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#define STX  0x02
+#define ESC  0x10
+#define FLAG 0x80
+#define NAK  0x15
+
+/* the 16-bit length counts the command letter too */
+#define MAX_FRAME_PARAM (0xffff - 1)
+
+/* size of a frame none of whose bytes needs escaping */
+#define FRAME_PLAIN_LEN(nparam) (1 + 2 + 1 + (nparam) + 2)
+
+/* worst case size of an encoded frame: STX plus every byte escaped */
+#define FRAME_ENCODED_LEN(nparam) (1 + 2 * (2 + 1 + (nparam) + 2))
+
+/* worst case output of begin_frame() and end_frame() */
+#define FRAME_HEAD_LEN (1 + 2 * (2 + 1))
+#define FRAME_TAIL_LEN (2 * 2)
+
+typedef struct {
+  unsigned short crc16;         /* of the bytes encoded so far */
+} FRAME_ENCODER;
+
+#if FRAME_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int encode_frame(char command, int nparam, unsigned char *params,
+                        unsigned char *frame);
+EXTERN int begin_frame(FRAME_ENCODER *encoder, char command, int nparam,
+                       unsigned char *out);
+EXTERN int encode_params(FRAME_ENCODER *encoder, int nparam,
+                         unsigned char *params, unsigned char *out);
+EXTERN int end_frame(FRAME_ENCODER *encoder, unsigned char *out);
+
+#undef EXTERN
+
+#endif
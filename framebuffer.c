@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#if LINUX
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+
+#include <serial.h>
+#include <command.h>
+#include <pattern.h>
+#include <frame.h>
+#include <options.h>
+#include <timing.h>
+#include <bitboard.h>
+#include <generate.h>
+#include <async.h>
+#include <framecache.h>
+
+#define FRAMEBUFFER_SRC 1
+#include <framebuffer.h>
+#undef FRAMEBUFFER_SRC
+
+#define DEFAULT_POLL_MS    (10)
+#define DEFAULT_TIMEOUT_MS (1000)
+#define RETRY_DELAY_US     (1000000ULL)
+#define MAX_NAME_LEN       (256)
+#define MAX_PORTS_LEN      (4096)
+
+typedef struct {
+  ASYNC_DEVICE       dev;
+  char              *port;
+  int                slot;
+  unsigned long long sent;      /* seq of the frame on the panel */
+  unsigned long long sending;   /* seq of the frame on the way */
+  unsigned long long not_before;/* retry time after a failure */
+  unsigned char      pattern[LINES_PER_PATTERN];
+  long               pushed;
+  long               failed;
+} FB_PORT;
+
+typedef struct {
+  FRAMEBUFFER *fb;
+  ASYNC_LOOP  *loop;
+  FB_PORT     *ports;
+  int          nports;
+  int          poll_ms;
+} FB_PUSHER;
+
+static volatile sig_atomic_t stop_pushing;
+
+static void scan_framebuffer(void *ctx, int rc);
+static void port_done(void *ctx, int rc);
+static void stop_handler(int sig);
+static int parse_op(char *op);
+
+
+#if LINUX
+
+/* maps /dev/shm/<name>, creating it on first use */
+int open_framebuffer(char *name, FRAMEBUFFER **fb)
+{
+  int rc;
+  int fd;
+  char path[MAX_NAME_LEN];
+  struct stat st;
+  void *map;
+
+  snprintf(path, sizeof(path), "%s%s", (name[0] == '/') ? "" : "/", name);
+  if ((fd = shm_open(path, O_RDWR | O_CREAT, 0666)) == -1)
+  {
+    rc = RET_FB_ERR_OPEN;
+    goto EXIT;
+  }
+
+  /* a new object reads as zeroes, which is a valid empty framebuffer */
+  if ((fstat(fd, &st) == -1) ||
+      ((st.st_size < sizeof(FRAMEBUFFER)) &&
+       (ftruncate(fd, sizeof(FRAMEBUFFER)) == -1)))
+  {
+    close(fd);
+    rc = RET_FB_ERR_OPEN;
+    goto EXIT;
+  }
+
+  map = mmap(NULL, sizeof(FRAMEBUFFER), PROT_READ | PROT_WRITE, MAP_SHARED,
+             fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    rc = RET_FB_ERR_MAP;
+    goto EXIT;
+  }
+
+  *fb = (FRAMEBUFFER *) map;
+  if ((*fb)->magic == 0)
+  {
+    (*fb)->nslots = FB_SLOTS;
+    (*fb)->magic = FB_MAGIC;
+  }
+  if (((*fb)->magic != FB_MAGIC) || ((*fb)->nslots != FB_SLOTS))
+  {
+    munmap(map, sizeof(FRAMEBUFFER));
+    rc = RET_FB_ERR_FORMAT;
+    goto EXIT;
+  }
+
+  rc = RET_FB_OK;
+
+EXIT:
+  return rc;
+}
+
+
+void close_framebuffer(FRAMEBUFFER *fb)
+{
+  munmap(fb, sizeof(FRAMEBUFFER));
+}
+
+#endif
+
+
+#if WIN
+
+int open_framebuffer(char *name, FRAMEBUFFER **fb)
+{
+  fprintf(stderr, "shared memory framebuffers need /dev/shm.\n");
+  return RET_FB_ERR_OPEN;
+}
+
+
+void close_framebuffer(FRAMEBUFFER *fb)
+{
+}
+
+#endif
+
+
+/* the frame is stored before seq moves, so a reader never misses it */
+void update_fb_frame(FRAMEBUFFER *fb, int slot, int op, BITBOARD board)
+{
+  FB_SLOT *s;
+
+  s = &fb->slot[slot];
+  switch (op)
+  {
+    case FB_OP_OR:
+      atomic_fetch_or_explicit(&s->frame, board, memory_order_relaxed);
+      break;
+    case FB_OP_XOR:
+      atomic_fetch_xor_explicit(&s->frame, board, memory_order_relaxed);
+      break;
+    case FB_OP_CLEAR:
+      atomic_fetch_and_explicit(&s->frame, ~board, memory_order_relaxed);
+      break;
+    default:
+      atomic_store_explicit(&s->frame, board, memory_order_relaxed);
+      break;
+  }
+  atomic_fetch_add_explicit(&s->seq, 1, memory_order_release);
+}
+
+
+/*
+ * Publishes the framebuffer <name> and keeps the panels in step with it:
+ * the n-th port of the comma separated list shows slot n. Every --poll ms
+ * the slots whose seq has moved are sent as 'D', at most one frame in
+ * flight per port, so writers never wait for the serial link and a frame
+ * overwritten before it could be sent is skipped. Runs until SIGINT/SIGTERM.
+ */
+int push_framebuffer(int myargc, char **myargv)
+{
+  int rc;
+  FB_PUSHER pusher;
+  ASYNC_LOOP loop;
+  char ports[MAX_PORTS_LEN];
+  char *port;
+  FB_PORT *p;
+  int timeout_ms;
+  int i;
+
+  if ((rc = open_framebuffer(myargv[0], &pusher.fb)) != RET_FB_OK)
+  {
+    fprintf(stderr, "open of framebuffer %s has failed.\n", myargv[0]);
+    goto EXIT;
+  }
+
+  if ((pusher.ports = calloc(FB_SLOTS, sizeof(FB_PORT))) == NULL)
+  {
+    rc = RET_FB_ERR_OPEN;
+    goto CLOSE_EXIT;
+  }
+  pusher.loop = &loop;
+  pusher.nports = 0;
+  pusher.poll_ms = get_int_option("poll", DEFAULT_POLL_MS);
+  timeout_ms = get_int_option("timeout", DEFAULT_TIMEOUT_MS);
+
+  init_loop(&loop);
+  snprintf(ports, sizeof(ports), "%s", myargv[1]);
+  for (port = strtok(ports, ","); port != NULL; port = strtok(NULL, ","))
+  {
+    if (pusher.nports == FB_SLOTS)
+    {
+      fprintf(stderr, "more than %d ports, ignoring %s.\n", FB_SLOTS, port);
+      break;
+    }
+    p = &pusher.ports[pusher.nports];
+    if (open_serial(port, &p->dev.hdl) != RET_SERIAL_OK)
+    {
+      fprintf(stderr, "open of device %s has failed.\n", port);
+      rc = RET_FB_ERR_DEVICE;
+      goto CLOSE_PORTS_EXIT;
+    }
+    add_device(&loop, &p->dev, p->dev.hdl, timeout_ms);
+    p->port = port;
+    p->slot = pusher.nports;
+    pusher.nports++;
+  }
+
+  stop_pushing = 0;
+  signal(SIGINT, stop_handler);
+  signal(SIGTERM, stop_handler);
+
+  scan_framebuffer(&pusher, RET_COMMAND_OK);
+  run_loop(&loop);
+
+  for (i = 0; i < pusher.nports; i++)
+  {
+    printf("%-16s slot %2d %8ld frames pushed %6ld failed\n",
+           pusher.ports[i].port, pusher.ports[i].slot,
+           pusher.ports[i].pushed, pusher.ports[i].failed);
+  }
+  print_frame_cache_stats(stdout);
+
+  rc = RET_FB_OK;
+
+CLOSE_PORTS_EXIT:
+  for (i = 0; i < pusher.nports; i++)
+  {
+    close_serial(pusher.ports[i].dev.hdl);
+  }
+  free(pusher.ports);
+
+CLOSE_EXIT:
+  close_framebuffer(pusher.fb);
+
+EXIT:
+  return rc;
+}
+
+
+/*
+ * Stores a frame into slot <slot> of framebuffer <name>, e.g. from a cron
+ * job. The frame is the start frame of a generator expression (0x<hex>,
+ * file:<path>, glider, ...); --op=or|xor|clear combines it with the
+ * pixels already there instead of replacing them.
+ */
+int write_framebuffer(int myargc, char **myargv)
+{
+  int rc;
+  FRAMEBUFFER *fb;
+  GENERATOR gen;
+  int slot;
+  int op;
+
+  slot = atoi(myargv[1]);
+  if ((slot < 0) || (slot >= FB_SLOTS))
+  {
+    fprintf(stderr, "slot must be 0 to %d.\n", FB_SLOTS - 1);
+    rc = RET_FB_ERR_SLOT;
+    goto EXIT;
+  }
+
+  if ((op = parse_op(get_option("op"))) == -1)
+  {
+    fprintf(stderr, "--op must be set, or, xor or clear.\n");
+    rc = RET_FB_ERR_SLOT;
+    goto EXIT;
+  }
+
+  if ((rc = parse_generator(myargv[2], 1, &gen)) != RET_GENERATE_OK)
+  {
+    goto EXIT;
+  }
+
+  if ((rc = open_framebuffer(myargv[0], &fb)) != RET_FB_OK)
+  {
+    fprintf(stderr, "open of framebuffer %s has failed.\n", myargv[0]);
+    goto EXIT;
+  }
+
+  update_fb_frame(fb, slot, op, gen.board);
+  close_framebuffer(fb);
+
+  rc = RET_FB_OK;
+
+EXIT:
+  return rc;
+}
+
+
+/* timer callback, sends the changed slots of idle ports */
+static void scan_framebuffer(void *ctx, int rc)
+{
+  FB_PUSHER *pusher;
+  FB_PORT *p;
+  FB_SLOT *s;
+  unsigned long long seq;
+  unsigned long long now;
+  int i;
+
+  pusher = (FB_PUSHER *) ctx;
+  if (stop_pushing)
+  {
+    return;
+  }
+
+  now = get_time_us();
+  for (i = 0; i < pusher->nports; i++)
+  {
+    p = &pusher->ports[i];
+    if ((p->dev.queued > 0) || (now < p->not_before))
+    {
+      continue;
+    }
+    s = &pusher->fb->slot[p->slot];
+    seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+    if (seq == p->sent)
+    {
+      continue;
+    }
+    bitboard_to_pattern(atomic_load_explicit(&s->frame, memory_order_relaxed),
+                        p->pattern);
+    p->sending = seq;
+    async_display(&p->dev, p->pattern, port_done, p);
+  }
+
+  async_timer(pusher->loop, pusher->poll_ms, scan_framebuffer, pusher);
+}
+
+
+static void port_done(void *ctx, int rc)
+{
+  FB_PORT *p;
+
+  p = (FB_PORT *) ctx;
+  if (rc == RET_COMMAND_OK)
+  {
+    p->sent = p->sending;
+    p->pushed++;
+    return;
+  }
+
+  /* leave sent alone, the frame goes out again after the delay */
+  if (p->failed++ == 0)
+  {
+    fprintf(stderr, "push to device %s has failed.\n", p->port);
+  }
+  p->not_before = get_time_us() + RETRY_DELAY_US;
+}
+
+
+static void stop_handler(int sig)
+{
+  stop_pushing = 1;
+}
+
+
+static int parse_op(char *op)
+{
+  if ((op == NULL) || (strcmp(op, "set") == 0))
+  {
+    return FB_OP_SET;
+  }
+  if (strcmp(op, "or") == 0)
+  {
+    return FB_OP_OR;
+  }
+  if (strcmp(op, "xor") == 0)
+  {
+    return FB_OP_XOR;
+  }
+  if (strcmp(op, "clear") == 0)
+  {
+    return FB_OP_CLEAR;
+  }
+
+  return -1;
+}
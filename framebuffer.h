@@ -0,0 +1,54 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <stdatomic.h>
+
+/*
+ * Shared memory framebuffer, /dev/shm/<name>, one slot per device.
+ * A writer stores the BITBOARD of a slot and then increments its seq;
+ * the pusher sends a slot whenever its seq has moved since the last send.
+ * Any process may write, nobody takes a lock.
+ */
+#define FB_MAGIC      (0x38784d4dU)     /* "MMx8" */
+#define FB_SLOTS      (64)
+#define FB_CACHE_LINE (64)
+
+#define RET_FB_OK         (0)
+#define RET_FB_ERR_OPEN   (1)
+#define RET_FB_ERR_MAP    (2)
+#define RET_FB_ERR_FORMAT (3)
+#define RET_FB_ERR_SLOT   (4)
+#define RET_FB_ERR_DEVICE (5)
+
+#define FB_OP_SET     (0)
+#define FB_OP_OR      (1)
+#define FB_OP_XOR     (2)
+#define FB_OP_CLEAR   (3)               /* clears the pixels given */
+
+typedef struct {
+  _Alignas(FB_CACHE_LINE) atomic_ullong frame;  /* BITBOARD */
+  atomic_ullong seq;                            /* no of writes so far */
+} FB_SLOT;
+
+typedef struct {
+  unsigned int magic;
+  unsigned int nslots;
+  FB_SLOT      slot[FB_SLOTS];
+} FRAMEBUFFER;
+
+#if FRAMEBUFFER_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int open_framebuffer(char *name, FRAMEBUFFER **fb);
+EXTERN void close_framebuffer(FRAMEBUFFER *fb);
+EXTERN void update_fb_frame(FRAMEBUFFER *fb, int slot, int op,
+                            BITBOARD board);
+EXTERN int push_framebuffer(int myargc, char **myargv);
+EXTERN int write_framebuffer(int myargc, char **myargv);
+
+#undef EXTERN
+
+#endif
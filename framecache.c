@@ -0,0 +1,384 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <crc16.h>
+#include <frame.h>
+#include <pattern.h>
+#include <options.h>
+
+#define FRAMECACHE_SRC 1
+#include <framecache.h>
+#undef FRAMECACHE_SRC
+
+#include <cmddesc.h>
+
+#define DISPLAY_FRAME_LEN FRAME_ENCODED_LEN(CMD_NPARAM(CMD_DISPLAYPATTERN))
+#define NO_ENTRY          (-1)
+#define TMP_SUFFIX        ".tmp"
+#define MAX_PATH_LEN      (1024)
+
+typedef struct {
+  unsigned long long key;
+  int                prev;        /* used more recently */
+  int                next;        /* used less recently */
+  int                chain;       /* next entry in the same bucket */
+  int                framelen;
+  unsigned char      frame[DISPLAY_FRAME_LEN];
+} CACHE_ENTRY;
+
+/* --framecache: magic, int no of records, records least recent first */
+typedef struct {
+  unsigned long long key;
+  int                framelen;
+  unsigned char      frame[DISPLAY_FRAME_LEN];
+} CACHE_RECORD;
+
+typedef struct {
+  CACHE_ENTRY *entries;
+  int         *buckets;
+  int          nbuckets;          /* a power of two */
+  int          capacity;
+  int          nentries;
+  int          head;              /* most recently used */
+  int          tail;              /* least recently used, evicted next */
+  long         hits;
+  long         misses;
+  long         evictions;
+  long         loaded;
+} FRAME_CACHE;
+
+/* display updates come from the scheduler and async threads too */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int initialized;
+static FRAME_CACHE cache;
+
+static void init_cache(void);
+static void load_cache(char *path);
+static void save_cache(char *path);
+static int find_entry(unsigned long long key);
+static void insert_entry(unsigned long long key, unsigned char *frame,
+                         int framelen);
+static void unlink_entry(int i);
+static void push_entry(int i);
+static unsigned int bucket_of(unsigned long long key);
+
+
+/*
+ * Encodes the 'D' frame of pattern into frame, which must hold
+ * FRAME_ENCODED_LEN(8) bytes, like ENCODE_CMD() does, but a pattern shown
+ * before is only copied. Returns the number of bytes of the frame.
+ */
+int cached_display_frame(unsigned char *pattern, unsigned char *frame)
+{
+  unsigned char params[CMD_NPARAM(CMD_DISPLAYPATTERN)];
+  unsigned long long key;
+  int framelen;
+  int i;
+
+  key = 0;
+  for (i = 0; i < LINES_PER_PATTERN; i++)
+  {
+    key |= (unsigned long long) pattern[i] << (8 * i);
+  }
+
+  pthread_mutex_lock(&lock);
+  if (!initialized)
+  {
+    init_cache();
+    initialized = 1;
+  }
+  if ((cache.capacity > 0) && ((i = find_entry(key)) != NO_ENTRY))
+  {
+    unlink_entry(i);
+    push_entry(i);
+    framelen = cache.entries[i].framelen;
+    memcpy(frame, cache.entries[i].frame, framelen);
+    cache.hits++;
+    pthread_mutex_unlock(&lock);
+    return framelen;
+  }
+  cache.misses++;
+  pthread_mutex_unlock(&lock);
+
+  /* encoded outside the lock, another thread may insert it meanwhile */
+  memcpy(params, pattern, sizeof(params));
+  framelen = ENCODE_CMD(CMD_DISPLAYPATTERN, params, frame);
+
+  pthread_mutex_lock(&lock);
+  if ((cache.capacity > 0) && (find_entry(key) == NO_ENTRY))
+  {
+    insert_entry(key, frame, framelen);
+  }
+  pthread_mutex_unlock(&lock);
+
+  return framelen;
+}
+
+
+void print_frame_cache_stats(FILE *out)
+{
+  long lookups;
+
+  pthread_mutex_lock(&lock);
+  lookups = cache.hits + cache.misses;
+  fprintf(out, "frame cache: %d of %d entries, %ld lookups, %ld hits "
+          "(%.1f%%), %ld evictions, %ld loaded\n", cache.nentries,
+          cache.capacity, lookups, cache.hits,
+          (lookups > 0) ? 100.0 * cache.hits / lookups : 0.0,
+          cache.evictions, cache.loaded);
+  pthread_mutex_unlock(&lock);
+}
+
+
+/* writes the cache to --framecache if there is one and frees it */
+void close_frame_cache(void)
+{
+  pthread_mutex_lock(&lock);
+  if (initialized && (cache.capacity > 0) &&
+      (get_option("framecache") != NULL))
+  {
+    save_cache(get_option("framecache"));
+  }
+  free(cache.entries);
+  free(cache.buckets);
+  memset(&cache, 0, sizeof(cache));
+  initialized = 0;
+  pthread_mutex_unlock(&lock);
+}
+
+
+static void init_cache(void)
+{
+  int i;
+
+  memset(&cache, 0, sizeof(cache));
+  cache.head = NO_ENTRY;
+  cache.tail = NO_ENTRY;
+
+  cache.capacity = get_int_option("framecachesize", DEFAULT_FRAME_CACHE_SIZE);
+  if (cache.capacity <= 0)
+  {
+    cache.capacity = 0;
+    return;
+  }
+
+  /* at most half the buckets in use keeps the chains short */
+  for (cache.nbuckets = 1; cache.nbuckets < 2 * cache.capacity;
+       cache.nbuckets *= 2)
+  {
+  }
+
+  cache.entries = malloc(cache.capacity * sizeof(CACHE_ENTRY));
+  cache.buckets = malloc(cache.nbuckets * sizeof(int));
+  if ((cache.entries == NULL) || (cache.buckets == NULL))
+  {
+    free(cache.entries);
+    free(cache.buckets);
+    cache.entries = NULL;
+    cache.buckets = NULL;
+    cache.capacity = 0;
+    return;
+  }
+  for (i = 0; i < cache.nbuckets; i++)
+  {
+    cache.buckets[i] = NO_ENTRY;
+  }
+
+  if (get_option("framecache") != NULL)
+  {
+    load_cache(get_option("framecache"));
+  }
+}
+
+
+/*
+ * A missing or foreign file leaves the cache empty, a truncated one gives
+ * the records before the cut. Every frame is encoded again from its key
+ * and a record that does not match is dropped, so a stale or damaged file
+ * never puts wrong pixels on the panel.
+ */
+static void load_cache(char *path)
+{
+  FILE *handle;
+  char magic[sizeof(FRAME_CACHE_MAGIC) - 1];
+  CACHE_RECORD record;
+  unsigned char params[CMD_NPARAM(CMD_DISPLAYPATTERN)];
+  unsigned char frame[DISPLAY_FRAME_LEN];
+  int nrecords;
+  int i;
+  int j;
+
+  if ((handle = fopen(path, "rb")) == NULL)
+  {
+    return;
+  }
+
+  if ((fread(magic, sizeof(magic), 1, handle) != 1) ||
+      (memcmp(magic, FRAME_CACHE_MAGIC, sizeof(magic)) != 0) ||
+      (fread(&nrecords, sizeof(nrecords), 1, handle) != 1))
+  {
+    fclose(handle);
+    return;
+  }
+
+  for (i = 0; i < nrecords; i++)
+  {
+    if (fread(&record, sizeof(record), 1, handle) != 1)
+    {
+      break;
+    }
+    for (j = 0; j < LINES_PER_PATTERN; j++)
+    {
+      params[j] = (unsigned char) (record.key >> (8 * j));
+    }
+    if ((ENCODE_CMD(CMD_DISPLAYPATTERN, params, frame) != record.framelen) ||
+        (memcmp(frame, record.frame, record.framelen) != 0))
+    {
+      continue;
+    }
+    if (find_entry(record.key) == NO_ENTRY)
+    {
+      insert_entry(record.key, record.frame, record.framelen);
+    }
+  }
+  cache.loaded = cache.nentries;
+  cache.evictions = 0;
+
+  fclose(handle);
+}
+
+
+/* writes <path>.tmp and renames it, like the libraries */
+static void save_cache(char *path)
+{
+  FILE *handle;
+  char tmppath[MAX_PATH_LEN];
+  CACHE_RECORD record;
+  int failed;
+  int i;
+
+  snprintf(tmppath, sizeof(tmppath), "%s%s", path, TMP_SUFFIX);
+  if ((handle = fopen(tmppath, "wb")) == NULL)
+  {
+    fprintf(stderr, "write of frame cache %s has failed.\n", path);
+    return;
+  }
+
+  fwrite(FRAME_CACHE_MAGIC, sizeof(FRAME_CACHE_MAGIC) - 1, 1, handle);
+  fwrite(&cache.nentries, sizeof(cache.nentries), 1, handle);
+  for (i = cache.tail; i != NO_ENTRY; i = cache.entries[i].prev)
+  {
+    memset(&record, 0, sizeof(record));
+    record.key = cache.entries[i].key;
+    record.framelen = cache.entries[i].framelen;
+    memcpy(record.frame, cache.entries[i].frame, record.framelen);
+    fwrite(&record, sizeof(record), 1, handle);
+  }
+
+  failed = ferror(handle);
+  if ((fclose(handle) != 0) || failed || (rename(tmppath, path) != 0))
+  {
+    fprintf(stderr, "write of frame cache %s has failed.\n", path);
+    remove(tmppath);
+  }
+}
+
+
+static int find_entry(unsigned long long key)
+{
+  int i;
+
+  for (i = cache.buckets[bucket_of(key)]; i != NO_ENTRY;
+       i = cache.entries[i].chain)
+  {
+    if (cache.entries[i].key == key)
+    {
+      return i;
+    }
+  }
+
+  return NO_ENTRY;
+}
+
+
+/* takes a free entry while there is one, else the least recently used */
+static void insert_entry(unsigned long long key, unsigned char *frame,
+                         int framelen)
+{
+  int i;
+  int *link;
+
+  if (cache.nentries < cache.capacity)
+  {
+    i = cache.nentries++;
+  }
+  else
+  {
+    i = cache.tail;
+    unlink_entry(i);
+    for (link = &cache.buckets[bucket_of(cache.entries[i].key)];
+         *link != i; link = &cache.entries[*link].chain)
+    {
+    }
+    *link = cache.entries[i].chain;
+    cache.evictions++;
+  }
+
+  cache.entries[i].key = key;
+  cache.entries[i].framelen = framelen;
+  memcpy(cache.entries[i].frame, frame, framelen);
+  cache.entries[i].chain = cache.buckets[bucket_of(key)];
+  cache.buckets[bucket_of(key)] = i;
+  push_entry(i);
+}
+
+
+static void unlink_entry(int i)
+{
+  CACHE_ENTRY *entry;
+
+  entry = &cache.entries[i];
+  if (entry->prev != NO_ENTRY)
+  {
+    cache.entries[entry->prev].next = entry->next;
+  }
+  else
+  {
+    cache.head = entry->next;
+  }
+  if (entry->next != NO_ENTRY)
+  {
+    cache.entries[entry->next].prev = entry->prev;
+  }
+  else
+  {
+    cache.tail = entry->prev;
+  }
+}
+
+
+/* makes entry i the most recently used */
+static void push_entry(int i)
+{
+  cache.entries[i].prev = NO_ENTRY;
+  cache.entries[i].next = cache.head;
+  if (cache.head != NO_ENTRY)
+  {
+    cache.entries[cache.head].prev = i;
+  }
+  else
+  {
+    cache.tail = i;
+  }
+  cache.head = i;
+}
+
+
+/* Fibonacci hashing, the high bits of the product pick the bucket */
+static unsigned int bucket_of(unsigned long long key)
+{
+  return (unsigned int) ((key * 0x9e3779b97f4a7c15ULL) >> 32) &
+         (cache.nbuckets - 1);
+}
@@ -0,0 +1,25 @@
+#ifndef FRAMECACHE_H
+#define FRAMECACHE_H
+
+/*
+ * LRU cache of encoded 'D' frames shared by all threads of the process,
+ * keyed by the pattern as one 64-bit frame, byte i in bits 8*i to 8*i+7
+ * like the frames of a library. --framecachesize=<n> entries (0: no
+ * cache), kept in --framecache=<path> across runs if given.
+ */
+#define DEFAULT_FRAME_CACHE_SIZE (256)
+#define FRAME_CACHE_MAGIC        "MMM8FC01"
+
+#if FRAMECACHE_SRC
+# define EXTERN
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int cached_display_frame(unsigned char *pattern, unsigned char *frame);
+EXTERN void print_frame_cache_stats(FILE *out);
+EXTERN void close_frame_cache(void);
+
+#undef EXTERN
+
+#endif
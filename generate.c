@@ -0,0 +1,423 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <serial.h>
+#include <pattern.h>
+#include <command.h>
+#include <crc16.h>
+#include <frame.h>
+#include <checkpoint.h>
+#include <upload.h>
+#include <bitboard.h>
+#include <options.h>
+#include <timing.h>
+#include <framecache.h>
+
+#define GENERATE_SRC 1
+#include <generate.h>
+#undef GENERATE_SRC
+
+#include <cmddesc.h>
+
+#define OP_LEFT      (0)
+#define OP_RIGHT     (1)
+#define OP_UP        (2)
+#define OP_DOWN      (3)
+#define OP_MIRROR    (4)
+#define OP_FLIP      (5)
+#define OP_TRANSPOSE (6)
+#define OP_ROTATE    (7)
+#define OP_INVERT    (8)
+#define OP_LIFE      (9)
+#define OP_AND       (10)
+#define OP_OR        (11)
+#define OP_XOR       (12)
+
+#define DISPLAY_DURATION  (1)
+#define DEFAULT_INTERVAL  (100)   /* ms between streamed frames */
+#define DEFAULT_SEED      (0x9e3779b97f4a7c15ULL)
+
+#define GLIDER (0x0000000000e02040ULL)
+
+typedef struct {
+  char *op_name;
+  int   op;
+  int   op_operand;     /* op is followed by ":<board>" */
+} OP;
+
+static OP op_table[] =
+{
+  { "left",      OP_LEFT,      0 },
+  { "right",     OP_RIGHT,     0 },
+  { "up",        OP_UP,        0 },
+  { "down",      OP_DOWN,      0 },
+  { "mirror",    OP_MIRROR,    0 },
+  { "flip",      OP_FLIP,      0 },
+  { "transpose", OP_TRANSPOSE, 0 },
+  { "rotate",    OP_ROTATE,    0 },
+  { "invert",    OP_INVERT,    0 },
+  { "life",      OP_LIFE,      0 },
+  { "and",       OP_AND,       1 },
+  { "or",        OP_OR,        1 },
+  { "xor",       OP_XOR,       1 },
+};
+
+static char *next_token(char **pos);
+static int parse_nframes(char *arg, int *nframes);
+static int parse_board(char *token, BITBOARD *board);
+static BITBOARD apply_ops(GENERATOR *gen, BITBOARD board);
+
+
+/*
+ * An expression is a start frame followed by the operations that turn each
+ * frame into the next one, e.g. "glider life" or "0x8142241818244281 left".
+ *
+ *   start frames: blank, full, glider, random, 0x<64 bit hex>, file:<path>
+ *   operations:   left, right, up, down (all wrapping), mirror, flip,
+ *                 transpose, rotate, invert, life,
+ *                 and:<frame>, or:<frame>, xor:<frame>
+ */
+int parse_generator(char *expression, int nframes, GENERATOR *gen)
+{
+  int rc;
+  char *copy;
+  char *pos;
+  char *token;
+  char *operand;
+  int i;
+
+  memset(gen, 0, sizeof(GENERATOR));
+  gen->nframes = nframes;
+
+  if ((copy = strdup(expression)) == NULL)
+  {
+    rc = RET_GENERATE_ERR_PARSE;
+    goto EXIT;
+  }
+
+  pos = copy;
+  token = next_token(&pos);
+  if ((token == NULL) ||
+      ((rc = parse_board(token, &gen->board)) != RET_GENERATE_OK))
+  {
+    fprintf(stderr, "invalid start frame in expression \"%s\"\n",
+            expression);
+    rc = RET_GENERATE_ERR_PARSE;
+    goto FREE_EXIT;
+  }
+
+  while ((token = next_token(&pos)) != NULL)
+  {
+    if ((operand = strchr(token, ':')) != NULL)
+    {
+      *operand++ = '\0';
+    }
+
+    for (i = 0; i < (sizeof(op_table) / sizeof(OP)); i++)
+    {
+      if (strcmp(op_table[i].op_name, token) == 0)
+      {
+        break;
+      }
+    }
+
+    if ((i == (sizeof(op_table) / sizeof(OP))) ||
+        (gen->nops == MAX_GENERATOR_OPS) ||
+        (op_table[i].op_operand != (operand != NULL)) ||
+        ((operand != NULL) &&
+         (parse_board(operand, &gen->operand[gen->nops]) != RET_GENERATE_OK)))
+    {
+      fprintf(stderr, "invalid operation %s in expression \"%s\"\n",
+              token, expression);
+      rc = RET_GENERATE_ERR_PARSE;
+      goto FREE_EXIT;
+    }
+    gen->op[gen->nops++] = op_table[i].op;
+  }
+
+  rc = RET_GENERATE_OK;
+
+FREE_EXIT:
+  free(copy);
+
+EXIT:
+  return rc;
+}
+
+
+/* pattern source for upload_patterns() */
+int next_generated_pattern(void *ctx, unsigned char *pattern)
+{
+  GENERATOR *gen;
+
+  gen = (GENERATOR *) ctx;
+  if (gen->count == gen->nframes)
+  {
+    return RET_SOURCE_END;
+  }
+
+  bitboard_to_pattern(gen->board, pattern);
+  gen->board = apply_ops(gen, gen->board);
+  gen->count++;
+
+  return RET_SOURCE_OK;
+}
+
+
+int store_generated(SERHDL hdl, int myargc, char **myargv)
+{
+  int rc;
+  GENERATOR gen;
+  int nframes;
+
+  if (((rc = parse_nframes(myargv[1], &nframes)) != RET_GENERATE_OK) ||
+      ((rc = parse_generator(myargv[0], nframes, &gen)) != RET_GENERATE_OK))
+  {
+    goto EXIT;
+  }
+
+  /* set duration of display in multiples of 100 ms */
+  rc = upload_patterns(hdl, next_generated_pattern, &gen, DISPLAY_DURATION,
+                       0, NULL);
+
+EXIT:
+  return rc;
+}
+
+
+/* shows the generated frames one by one with 'D', every interval ms */
+int stream_generated(SERHDL hdl, int myargc, char **myargv)
+{
+  int rc;
+  GENERATOR gen;
+  int nframes;
+  unsigned char pattern[CMD_NPARAM(CMD_DISPLAYPATTERN)];
+  unsigned char frame[FRAME_ENCODED_LEN(CMD_NPARAM(CMD_DISPLAYPATTERN))];
+  int framelen;
+  unsigned char response[CMD_RSPLEN(CMD_DISPLAYPATTERN)];
+  unsigned long long interval;
+  unsigned long long next;
+  unsigned long long now;
+
+  if (((rc = parse_nframes(myargv[1], &nframes)) != RET_GENERATE_OK) ||
+      ((rc = parse_generator(myargv[0], nframes, &gen)) != RET_GENERATE_OK))
+  {
+    goto EXIT;
+  }
+
+  if (get_int_option("interval", DEFAULT_INTERVAL) < 1)
+  {
+    fprintf(stderr, "--interval must be 1 ms or more.\n");
+    rc = RET_GENERATE_ERR_PARSE;
+    goto EXIT;
+  }
+
+  trace_responses(0);
+  interval = get_int_option("interval", DEFAULT_INTERVAL) * 1000ULL;
+  next = get_time_us();
+
+  while (next_generated_pattern(&gen, pattern) == RET_SOURCE_OK)
+  {
+    framelen = cached_display_frame(pattern, frame);
+
+    now = get_time_us();
+    if (now < next)
+    {
+      usleep(next - now);
+    }
+    next += interval;
+
+    if ((rc = send_frame(hdl, frame, framelen)) != RET_COMMAND_OK)
+    {
+      fprintf(stderr, "sending command displaypattern has failed.\n");
+      goto EXIT;
+    }
+
+    rc = RECEIVE_RSP(hdl, CMD_DISPLAYPATTERN, response);
+    if (rc != RET_COMMAND_OK)
+    {
+      fprintf(stderr, "receiving response of command displaypattern "
+                      "has failed.\n");
+      goto EXIT;
+    }
+  }
+
+EXIT:
+  return rc;
+}
+
+
+/* writes the generated frames to stdout in the pattern file format */
+int print_generated(int myargc, char **myargv)
+{
+  int rc;
+  GENERATOR gen;
+  int nframes;
+  int line;
+  int column;
+
+  if (((rc = parse_nframes(myargv[1], &nframes)) != RET_GENERATE_OK) ||
+      ((rc = parse_generator(myargv[0], nframes, &gen)) != RET_GENERATE_OK))
+  {
+    goto EXIT;
+  }
+
+  for (gen.count = 0; gen.count < gen.nframes; gen.count++)
+  {
+    if (gen.count > 0)
+    {
+      putchar('\n');
+    }
+    for (line = 0; line < LINES_PER_PATTERN; line++)
+    {
+      for (column = 0; column < COLUMNS_PER_PATTERN; column++)
+      {
+        putchar((BITBOARD_LINE(gen.board, line) & (0x80 >> column)) ?
+                'x' : '-');
+      }
+      putchar('\n');
+    }
+    gen.board = apply_ops(&gen, gen.board);
+  }
+
+  if (fflush(stdout) != 0)
+  {
+    rc = RET_GENERATE_ERR_WRITE;
+  }
+
+EXIT:
+  return rc;
+}
+
+
+/* strtok() for blanks, without its static state */
+static char *next_token(char **pos)
+{
+  char *token;
+
+  *pos += strspn(*pos, " \t");
+  if (**pos == '\0')
+  {
+    return NULL;
+  }
+
+  token = *pos;
+  *pos += strcspn(*pos, " \t");
+  if (**pos != '\0')
+  {
+    *(*pos)++ = '\0';
+  }
+
+  return token;
+}
+
+
+/* the generator ends only when count reaches nframes, so it must be >= 1 */
+static int parse_nframes(char *arg, int *nframes)
+{
+  char *end;
+  long value;
+
+  value = strtol(arg, &end, 10);
+  if ((*arg == '\0') || (*end != '\0') || (value < 1) || (value > INT_MAX))
+  {
+    fprintf(stderr, "invalid number of frames %s, must be 1 or more.\n",
+            arg);
+    return RET_GENERATE_ERR_PARSE;
+  }
+  *nframes = (int) value;
+
+  return RET_GENERATE_OK;
+}
+
+
+static int parse_board(char *token, BITBOARD *board)
+{
+  int rc;
+  char *end;
+  FILE *patternfile;
+  unsigned char pattern[LINES_PER_PATTERN];
+  BITBOARD seed;
+
+  rc = RET_GENERATE_OK;
+  if (strcmp(token, "blank") == 0)
+  {
+    *board = 0;
+  }
+  else if (strcmp(token, "full") == 0)
+  {
+    *board = ~0ULL;
+  }
+  else if (strcmp(token, "glider") == 0)
+  {
+    *board = GLIDER;
+  }
+  else if (strcmp(token, "random") == 0)
+  {
+    /* xorshift64, reproducible only with --seed */
+    seed = DEFAULT_SEED ^ ((get_option("seed") != NULL) ?
+                           (BITBOARD) get_int_option("seed", 0) :
+                           (BITBOARD) get_time_us());
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    *board = seed;
+  }
+  else if (strncmp(token, "file:", strlen("file:")) == 0)
+  {
+    if (open_patternfile(token + strlen("file:"), &patternfile)
+        != RET_PATTERN_OK)
+    {
+      rc = RET_GENERATE_ERR_PARSE;
+      goto EXIT;
+    }
+    if (read_one_pattern(patternfile, pattern) != RET_PATTERN_OK)
+    {
+      rc = RET_GENERATE_ERR_PARSE;
+    }
+    close_patternfile(patternfile);
+    *board = pattern_to_bitboard(pattern);
+  }
+  else
+  {
+    *board = strtoull(token, &end, 16);
+    if ((*token == '\0') || (*end != '\0'))
+    {
+      rc = RET_GENERATE_ERR_PARSE;
+    }
+  }
+
+EXIT:
+  return rc;
+}
+
+
+static BITBOARD apply_ops(GENERATOR *gen, BITBOARD board)
+{
+  int i;
+
+  for (i = 0; i < gen->nops; i++)
+  {
+    switch (gen->op[i])
+    {
+      case OP_LEFT:      board = scroll_left(board);        break;
+      case OP_RIGHT:     board = scroll_right(board);       break;
+      case OP_UP:        board = scroll_up(board);          break;
+      case OP_DOWN:      board = scroll_down(board);        break;
+      case OP_MIRROR:    board = mirror_bitboard(board);    break;
+      case OP_FLIP:      board = flip_bitboard(board);      break;
+      case OP_TRANSPOSE: board = transpose_bitboard(board); break;
+      case OP_ROTATE:    board = rotate_bitboard(board);    break;
+      case OP_INVERT:    board = ~board;                    break;
+      case OP_LIFE:      board = step_life(board);          break;
+      case OP_AND:       board &= gen->operand[i];          break;
+      case OP_OR:        board |= gen->operand[i];          break;
+      case OP_XOR:       board ^= gen->operand[i];          break;
+    }
+  }
+
+  return board;
+}
@@ -0,0 +1,33 @@
+#ifndef GENERATE_H
+#define GENERATE_H
+
+#define RET_GENERATE_OK        (0)
+#define RET_GENERATE_ERR_PARSE (1)
+#define RET_GENERATE_ERR_WRITE (2)
+
+#define MAX_GENERATOR_OPS (32)
+
+typedef struct {
+  BITBOARD board;                        /* next frame to deliver */
+  int      op[MAX_GENERATOR_OPS];        /* applied in turn after each frame */
+  BITBOARD operand[MAX_GENERATOR_OPS];   /* for and/or/xor */
+  int      nops;
+  int      count;                        /* no of frames delivered */
+  int      nframes;                      /* no of frames to deliver */
+} GENERATOR;
+
+#if GENERATE_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int parse_generator(char *expression, int nframes, GENERATOR *gen);
+EXTERN int next_generated_pattern(void *ctx, unsigned char *pattern);
+EXTERN int store_generated(SERHDL hdl, int myargc, char **myargv);
+EXTERN int stream_generated(SERHDL hdl, int myargc, char **myargv);
+EXTERN int print_generated(int myargc, char **myargv);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <serial.h>
+#include <pattern.h>
+#include <command.h>
+#include <crc16.h>
+#include <frame.h>
+#include <options.h>
+#include <timing.h>
+
+#define GRAY_SRC 1
+#include <gray.h>
+#undef GRAY_SRC
+
+#include <cmddesc.h>
+
+#define PIXELS_PER_PATTERN (LINES_PER_PATTERN * COLUMNS_PER_PATTERN)
+#define DEFAULT_DURATION   (10)     /* seconds */
+
+/* 4x4 ordered dither, spreads the phases of pixels with the same level */
+static const unsigned char phase[4][4] =
+{
+  {  0,  8,  2, 10 },
+  { 12,  4, 14,  6 },
+  {  3, 11,  1,  9 },
+  { 15,  7, 13,  5 },
+};
+
+static int read_grayscale(FILE *handle, unsigned char *levels);
+
+
+/*
+ * Shows an 8x8 grayscale image on the monochrome display by streaming
+ * 'D' frames, each pixel being lit in level/15 of them. The dither cycle
+ * is encoded once up front, so the stream loop only writes and waits for
+ * the acks, which keeps it at the rate the link sustains.
+ */
+int display_grayscale(SERHDL hdl, int myargc, char **myargv)
+{
+  int rc;
+  FILE *grayfile;
+  unsigned char levels[PIXELS_PER_PATTERN];
+  unsigned char subframes[GRAY_SUBFRAMES][LINES_PER_PATTERN];
+  unsigned char frames[GRAY_SUBFRAMES][FRAME_ENCODED_LEN(CMD_NPARAM(CMD_DISPLAYPATTERN))];
+  int framelen[GRAY_SUBFRAMES];
+  unsigned char response[CMD_RSPLEN(CMD_DISPLAYPATTERN)];
+  unsigned long long start;
+  unsigned long long end;
+  unsigned long long now;
+  long nframes;
+  int i;
+
+  if ((rc = open_patternfile(myargv[0], &grayfile)) != RET_PATTERN_OK)
+  {
+    fprintf(stderr, "open of grayscale file %s has failed\n", myargv[0]);
+    goto EXIT;
+  }
+  rc = read_grayscale(grayfile, levels);
+  close_patternfile(grayfile);
+  if (rc != RET_PATTERN_OK)
+  {
+    fprintf(stderr, "read of grayscale file %s has failed\n", myargv[0]);
+    goto EXIT;
+  }
+
+  dither_grayscale(levels, subframes);
+  for (i = 0; i < GRAY_SUBFRAMES; i++)
+  {
+    framelen[i] = ENCODE_CMD(CMD_DISPLAYPATTERN, subframes[i], frames[i]);
+  }
+
+  trace_responses(0);
+
+  start = get_time_us();
+  end = start + (unsigned long long) get_int_option("duration",
+                                                    DEFAULT_DURATION) * 1000000;
+  nframes = 0;
+  do
+  {
+    i = nframes % GRAY_SUBFRAMES;
+    if ((rc = send_frame(hdl, frames[i], framelen[i])) != RET_COMMAND_OK)
+    {
+      fprintf(stderr, "sending command displaypattern has failed.\n");
+      goto EXIT;
+    }
+
+    rc = RECEIVE_RSP(hdl, CMD_DISPLAYPATTERN, response);
+    if (rc != RET_COMMAND_OK)
+    {
+      fprintf(stderr, "receiving response of command displaypattern "
+                      "has failed.\n");
+      goto EXIT;
+    }
+
+    nframes++;
+    now = get_time_us();
+  }
+  while ((end == start) || (now < end));
+
+  printf("%ld frames in %.1f s, %.1f frames/s, %.1f dither cycles/s\n",
+         nframes, (now - start) / 1e6, nframes * 1e6 / (now - start),
+         nframes * 1e6 / (now - start) / GRAY_SUBFRAMES);
+
+EXIT:
+  return rc;
+}
+
+
+/*
+ * Computes the GRAY_SUBFRAMES transposed patterns of one dither cycle by
+ * first order sigma-delta modulation over time: every pixel accumulates its
+ * level and is lit whenever the accumulator overflows. This spreads the on
+ * times of a pixel evenly over the cycle instead of lighting it in one
+ * block, which is what keeps the flicker down.
+ */
+void dither_grayscale(unsigned char *levels,
+                      unsigned char subframes[][LINES_PER_PATTERN])
+{
+  unsigned char acc[PIXELS_PER_PATTERN];
+  int pixel;
+  int line;
+  int column;
+  int sub;
+
+  for (pixel = 0; pixel < PIXELS_PER_PATTERN; pixel++)
+  {
+    line = pixel / COLUMNS_PER_PATTERN;
+    column = pixel % COLUMNS_PER_PATTERN;
+    acc[pixel] = phase[line % 4][column % 4] * GRAY_SUBFRAMES / GRAY_LEVELS;
+  }
+
+  memset(subframes, 0, GRAY_SUBFRAMES * LINES_PER_PATTERN);
+  for (sub = 0; sub < GRAY_SUBFRAMES; sub++)
+  {
+    for (pixel = 0; pixel < PIXELS_PER_PATTERN; pixel++)
+    {
+      acc[pixel] += levels[pixel];
+      if (acc[pixel] >= GRAY_SUBFRAMES)
+      {
+        acc[pixel] -= GRAY_SUBFRAMES;
+        line = pixel / COLUMNS_PER_PATTERN;
+        column = pixel % COLUMNS_PER_PATTERN;
+        subframes[sub][column] |= (1 << line);
+      }
+    }
+  }
+}
+
+
+/*
+ * Reads 8 lines of 8 levels each, '0'-'9' and 'a'-'f' for the levels 0-15.
+ * 'x' and '-' are accepted as full and off, so plain pattern files work.
+ */
+static int read_grayscale(FILE *handle, unsigned char *levels)
+{
+#define MAX_LINE (1024)
+  int rc;
+  int line;
+  int column;
+  char buf[MAX_LINE];
+  char c;
+
+  for (line = 0; line < LINES_PER_PATTERN; line++)
+  {
+    if (fgets(buf, MAX_LINE, handle) == NULL)
+    {
+      rc = RET_PATTERN_ERR_READ;
+      goto EXIT;
+    }
+
+    for (column = 0; column < COLUMNS_PER_PATTERN; column++)
+    {
+      c = buf[column];
+      if ((c >= '0') && (c <= '9'))
+      {
+        levels[line * COLUMNS_PER_PATTERN + column] = c - '0';
+      }
+      else if ((c >= 'a') && (c <= 'f'))
+      {
+        levels[line * COLUMNS_PER_PATTERN + column] = c - 'a' + 10;
+      }
+      else if (c == 'x')
+      {
+        levels[line * COLUMNS_PER_PATTERN + column] = GRAY_LEVELS - 1;
+      }
+      else if (c == '-')
+      {
+        levels[line * COLUMNS_PER_PATTERN + column] = 0;
+      }
+      else
+      {
+        rc = RET_PATTERN_ERR_READ;
+        goto EXIT;
+      }
+    }
+  }
+
+  rc = RET_PATTERN_OK;
+
+EXIT:
+  return rc;
+}
@@ -0,0 +1,19 @@
+#ifndef GRAY_H
+#define GRAY_H
+
+#define GRAY_LEVELS    (16)               /* 0 = off .. 15 = fully on */
+#define GRAY_SUBFRAMES (GRAY_LEVELS - 1)  /* period of the temporal dither */
+
+#if GRAY_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int display_grayscale(SERHDL hdl, int myargc, char **myargv);
+EXTERN void dither_grayscale(unsigned char *levels,
+                             unsigned char subframes[][LINES_PER_PATTERN]);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,594 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <pattern.h>
+#include <pool.h>
+#include <options.h>
+#include <bitboard.h>
+
+#define IMPORT_SRC 1
+#include <import.h>
+#undef IMPORT_SRC
+
+#define BATCH_IMAGES      (256)
+#define BATCH_BYTES       (64 * 1024 * 1024)  /* of gray pixels per batch */
+#define DEFAULT_THRESHOLD (128)
+#define MAX_DIMENSION     (65535)
+#define PIXELS_PER_FRAME  (LINES_PER_PATTERN * COLUMNS_PER_PATTERN)
+#define TMP_SUFFIX        ".tmp"
+
+#define IMAGE_END (-1)                  /* clean end of the input */
+
+typedef struct {
+  int            format;                /* '1', '2', '4' or '5' of P1..P5 */
+  int            width;
+  int            height;
+  int            maxval;
+  unsigned char *gray;                  /* 0 off .. 255 on, row by row */
+  size_t         graysize;              /* allocated */
+  BITBOARD      *frames;
+  int            nframes;               /* -1 if they did not fit in memory */
+  int            framesize;             /* allocated */
+} IMAGE;
+
+typedef struct {
+  IMAGE *images;
+  int    tile;                          /* all tiles, not one window */
+  int    at_x;                          /* window of crop, -1 to center */
+  int    at_y;
+  int    threshold;
+  int    dither;
+  int    invert;
+} IMPORT;
+
+static int read_image(FILE *in, IMAGE *img);
+static int read_number(FILE *in, int *value);
+static int read_raster(FILE *in, IMAGE *img);
+static int convert_job(void *ctx, int job);
+static BITBOARD convert_window(IMPORT *imp, IMAGE *img, int x0, int y0);
+static BITBOARD threshold_levels(unsigned char *levels, int threshold);
+static BITBOARD diffuse_levels(unsigned char *levels, int threshold);
+static int write_frames(FILE *out, IMAGE *img, long *written);
+
+
+/*
+ * import <images | -> <patternfile | ->: converts netpbm images (P1/P4
+ * bitmaps, P2/P5 graymaps) into a pattern file. The input may hold any
+ * number of images one after the other, as ffmpeg -f image2pipe writes
+ * them. Each image gives one frame, its 8x8 window at --at=<x>,<y>
+ * (centered by default), or with --tile all its 8x8 tiles, row by row,
+ * the last ones padded with dark pixels. A pixel is lit if its level is at
+ * least --threshold (0-255, default 128), or --dither diffuses the error
+ * of that decision over the frame (Floyd-Steinberg). Bitmap ink and
+ * graymap white are lit, --invert swaps that. The input is read in
+ * batches, which are converted on --jobs threads and written in order, so
+ * memory stays bounded however many images there are. A pattern file is
+ * written as <patternfile>.tmp and renamed once all images converted. It
+ * is text, not compiled frames: every command reads it, and library build
+ * compiles it.
+ */
+int import_images(int myargc, char **myargv)
+{
+  int rc;
+  FILE *in;
+  FILE *out;
+  FILE *report;
+  char *tmppath;
+  IMPORT imp;
+  int nimages;
+  long nread;
+  long written;
+  size_t bytes;
+  int end;
+  int jobs;
+  int i;
+
+  memset(&imp, 0, sizeof(imp));
+  imp.tile = (get_option("tile") != NULL);
+  imp.dither = (get_option("dither") != NULL);
+  imp.invert = (get_option("invert") != NULL);
+  imp.threshold = get_int_option("threshold", DEFAULT_THRESHOLD);
+  imp.at_x = -1;
+  imp.at_y = -1;
+  if ((get_option("at") != NULL) &&
+      (sscanf(get_option("at"), "%d,%d", &imp.at_x, &imp.at_y) != 2))
+  {
+    fprintf(stderr, "--at must be <x>,<y>.\n");
+    rc = RET_IMPORT_ERR_FORMAT;
+    goto EXIT;
+  }
+  jobs = get_int_option("jobs", get_cpu_count());
+
+  in = (strcmp(myargv[0], "-") == 0) ? stdin : fopen(myargv[0], "rb");
+  if (in == NULL)
+  {
+    fprintf(stderr, "open of image file %s has failed.\n", myargv[0]);
+    rc = RET_IMPORT_ERR_OPEN;
+    goto EXIT;
+  }
+  tmppath = NULL;
+  if (strcmp(myargv[1], "-") == 0)
+  {
+    out = stdout;
+  }
+  else if ((tmppath = malloc(strlen(myargv[1]) + strlen(TMP_SUFFIX) + 1))
+           != NULL)
+  {
+    sprintf(tmppath, "%s%s", myargv[1], TMP_SUFFIX);
+    out = fopen(tmppath, "w");
+  }
+  else
+  {
+    out = NULL;
+  }
+  if (out == NULL)
+  {
+    fprintf(stderr, "open of pattern file %s has failed.\n", myargv[1]);
+    rc = RET_IMPORT_ERR_OPEN;
+    goto CLOSE_IN_EXIT;
+  }
+  report = (out == stdout) ? stderr : stdout;
+
+  if ((imp.images = calloc(BATCH_IMAGES, sizeof(IMAGE))) == NULL)
+  {
+    rc = RET_IMPORT_ERR_MEMORY;
+    goto CLOSE_EXIT;
+  }
+
+  nread = 0;
+  written = 0;
+  rc = RET_IMPORT_OK;
+  for (end = 0; !end; )
+  {
+    bytes = 0;
+    for (nimages = 0; (nimages < BATCH_IMAGES) && (bytes < BATCH_BYTES);
+         nimages++)
+    {
+      rc = read_image(in, &imp.images[nimages]);
+      if (rc == IMAGE_END)
+      {
+        end = 1;
+        rc = RET_IMPORT_OK;
+        break;
+      }
+      if (rc == RET_IMPORT_ERR_FORMAT)
+      {
+        fprintf(stderr, "image %ld is not a valid P1, P2, P4 or P5 image.\n",
+                nread + nimages + 1);
+      }
+      if (rc != RET_IMPORT_OK)
+      {
+        goto FREE_EXIT;
+      }
+      bytes += (size_t) imp.images[nimages].width *
+               imp.images[nimages].height;
+    }
+
+    if ((nimages > 0) &&
+        (run_pool(jobs, nimages, convert_job, &imp) != RET_POOL_OK))
+    {
+      rc = RET_IMPORT_ERR_MEMORY;
+      goto FREE_EXIT;
+    }
+
+    for (i = 0; i < nimages; i++)
+    {
+      if (imp.images[i].nframes < 0)
+      {
+        rc = RET_IMPORT_ERR_MEMORY;
+        goto FREE_EXIT;
+      }
+      if ((rc = write_frames(out, &imp.images[i], &written))
+          != RET_IMPORT_OK)
+      {
+        fprintf(stderr, "write of pattern file %s has failed.\n",
+                myargv[1]);
+        goto FREE_EXIT;
+      }
+    }
+    nread += nimages;
+  }
+
+  if (fflush(out) != 0)
+  {
+    rc = RET_IMPORT_ERR_WRITE;
+    goto FREE_EXIT;
+  }
+  fprintf(report, "%ld images, %ld frames\n", nread, written);
+
+FREE_EXIT:
+  for (i = 0; i < BATCH_IMAGES; i++)
+  {
+    free(imp.images[i].gray);
+    free(imp.images[i].frames);
+  }
+  free(imp.images);
+
+CLOSE_EXIT:
+  if (out != stdout)
+  {
+    /* a failed import leaves an existing pattern file as it was */
+    if ((fclose(out) != 0) && (rc == RET_IMPORT_OK))
+    {
+      rc = RET_IMPORT_ERR_WRITE;
+    }
+    if ((rc == RET_IMPORT_OK) && (rename(tmppath, myargv[1]) != 0))
+    {
+      fprintf(stderr, "write of pattern file %s has failed.\n", myargv[1]);
+      rc = RET_IMPORT_ERR_WRITE;
+    }
+    if (rc != RET_IMPORT_OK)
+    {
+      remove(tmppath);
+    }
+  }
+
+CLOSE_IN_EXIT:
+  free(tmppath);
+  if (in != stdin)
+  {
+    fclose(in);
+  }
+
+EXIT:
+  return rc;
+}
+
+
+/* header and raster of the next image, IMAGE_END if there is none */
+static int read_image(FILE *in, IMAGE *img)
+{
+  int c;
+  size_t size;
+  unsigned char *grown;
+
+  do
+  {
+    c = getc(in);
+  } while ((c != EOF) && isspace(c));
+  if (c == EOF)
+  {
+    return IMAGE_END;
+  }
+
+  img->format = getc(in);
+  if ((c != 'P') ||
+      ((img->format != '1') && (img->format != '2') &&
+       (img->format != '4') && (img->format != '5')) ||
+      (read_number(in, &img->width) != 0) ||
+      (read_number(in, &img->height) != 0) ||
+      (img->width < 1) || (img->width > MAX_DIMENSION) ||
+      (img->height < 1) || (img->height > MAX_DIMENSION))
+  {
+    return RET_IMPORT_ERR_FORMAT;
+  }
+
+  img->maxval = 1;
+  if (((img->format == '2') || (img->format == '5')) &&
+      ((read_number(in, &img->maxval) != 0) ||
+       (img->maxval < 1) || (img->maxval > 65535)))
+  {
+    return RET_IMPORT_ERR_FORMAT;
+  }
+
+  /* the single whitespace between header and a binary raster */
+  if (((img->format == '4') || (img->format == '5')) &&
+      !isspace(getc(in)))
+  {
+    return RET_IMPORT_ERR_FORMAT;
+  }
+
+  size = (size_t) img->width * img->height;
+  if (size > img->graysize)
+  {
+    if ((grown = realloc(img->gray, size)) == NULL)
+    {
+      return RET_IMPORT_ERR_MEMORY;
+    }
+    img->gray = grown;
+    img->graysize = size;
+  }
+
+  return read_raster(in, img);
+}
+
+
+/* skips whitespace and # comments, then reads a decimal number */
+static int read_number(FILE *in, int *value)
+{
+  int c;
+
+  for (c = getc(in); (c != EOF) && !isdigit(c); c = getc(in))
+  {
+    if (c == '#')
+    {
+      while ((c != EOF) && (c != '\n'))
+      {
+        c = getc(in);
+      }
+    }
+    else if (!isspace(c))
+    {
+      return -1;
+    }
+  }
+  if (c == EOF)
+  {
+    return -1;
+  }
+
+  for (*value = 0; isdigit(c); c = getc(in))
+  {
+    if (*value > MAX_DIMENSION)
+    {
+      return -1;
+    }
+    *value = *value * 10 + (c - '0');
+  }
+  ungetc(c, in);
+
+  return 0;
+}
+
+
+/* into 0..255 levels, bitmap ink (1) as 255 */
+static int read_raster(FILE *in, IMAGE *img)
+{
+  unsigned char *p;
+  size_t size;
+  size_t i;
+  int x;
+  int y;
+  int c;
+  int v;
+
+  /* 8 bit graymaps, the bulk of video input, in one read */
+  if ((img->format == '5') && (img->maxval <= 255))
+  {
+    size = (size_t) img->width * img->height;
+    if (fread(img->gray, 1, size, in) != size)
+    {
+      return RET_IMPORT_ERR_FORMAT;
+    }
+    for (i = 0; (img->maxval < 255) && (i < size); i++)
+    {
+      img->gray[i] = (img->gray[i] > img->maxval) ? 255 :
+                     img->gray[i] * 255 / img->maxval;
+    }
+    return RET_IMPORT_OK;
+  }
+
+  p = img->gray;
+  for (y = 0; y < img->height; y++)
+  {
+    for (x = 0; x < img->width; x++)
+    {
+      switch (img->format)
+      {
+        case '1':
+          do
+          {
+            c = getc(in);
+          } while ((c != EOF) && (c != '0') && (c != '1'));
+          if (c == EOF)
+          {
+            return RET_IMPORT_ERR_FORMAT;
+          }
+          v = (c == '1') ? 255 : 0;
+          break;
+
+        case '4':
+          if ((x % 8 == 0) && ((c = getc(in)) == EOF))
+          {
+            return RET_IMPORT_ERR_FORMAT;
+          }
+          v = (c & (0x80 >> (x % 8))) ? 255 : 0;
+          break;
+
+        case '2':
+          if ((read_number(in, &v) != 0) || (v > img->maxval))
+          {
+            return RET_IMPORT_ERR_FORMAT;
+          }
+          v = v * 255 / img->maxval;
+          break;
+
+        default:
+          if ((c = getc(in)) == EOF)
+          {
+            return RET_IMPORT_ERR_FORMAT;
+          }
+          v = c;
+          if (img->maxval > 255)
+          {
+            if ((c = getc(in)) == EOF)
+            {
+              return RET_IMPORT_ERR_FORMAT;
+            }
+            v = v * 256 + c;
+          }
+          v = (v > img->maxval) ? 255 : v * 255 / img->maxval;
+          break;
+      }
+      *p++ = v;
+    }
+  }
+
+  return RET_IMPORT_OK;
+}
+
+
+/* pool job: all frames of one image */
+static int convert_job(void *ctx, int job)
+{
+  IMPORT *imp;
+  IMAGE *img;
+  BITBOARD *grown;
+  int ntiles_x;
+  int ntiles_y;
+  int n;
+  int i;
+
+  imp = (IMPORT *) ctx;
+  img = &imp->images[job];
+
+  ntiles_x = (img->width + COLUMNS_PER_PATTERN - 1) / COLUMNS_PER_PATTERN;
+  ntiles_y = (img->height + LINES_PER_PATTERN - 1) / LINES_PER_PATTERN;
+  n = imp->tile ? ntiles_x * ntiles_y : 1;
+  if (n > img->framesize)
+  {
+    if ((grown = realloc(img->frames, n * sizeof(BITBOARD))) == NULL)
+    {
+      img->nframes = -1;
+      return POOL_JOB_DONE;
+    }
+    img->frames = grown;
+    img->framesize = n;
+  }
+  img->nframes = n;
+
+  if (!imp->tile)
+  {
+    img->frames[0] = convert_window(imp, img,
+        (imp->at_x >= 0) ? imp->at_x : (img->width - COLUMNS_PER_PATTERN) / 2,
+        (imp->at_y >= 0) ? imp->at_y : (img->height - LINES_PER_PATTERN) / 2);
+    return POOL_JOB_DONE;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    img->frames[i] = convert_window(imp, img,
+                                    (i % ntiles_x) * COLUMNS_PER_PATTERN,
+                                    (i / ntiles_x) * LINES_PER_PATTERN);
+  }
+
+  return POOL_JOB_DONE;
+}
+
+
+/* the 8x8 pixels at x0, y0, dark outside the image */
+static BITBOARD convert_window(IMPORT *imp, IMAGE *img, int x0, int y0)
+{
+  unsigned char levels[PIXELS_PER_FRAME];
+  int line;
+  int column;
+  int x;
+  int y;
+
+  for (line = 0; line < LINES_PER_PATTERN; line++)
+  {
+    y = y0 + line;
+    for (column = 0; column < COLUMNS_PER_PATTERN; column++)
+    {
+      x = x0 + column;
+      levels[line * COLUMNS_PER_PATTERN + column] =
+        ((x < 0) || (x >= img->width) || (y < 0) || (y >= img->height)) ? 0 :
+        img->gray[(size_t) y * img->width + x] ^ (imp->invert ? 0xff : 0);
+    }
+  }
+
+  return imp->dither ? diffuse_levels(levels, imp->threshold) :
+                       threshold_levels(levels, imp->threshold);
+}
+
+
+/*
+ * Branch free compare of each line's 8 levels, which compilers turn into
+ * vector compares and a movemask where the target has them.
+ */
+static BITBOARD threshold_levels(unsigned char *levels, int threshold)
+{
+  BITBOARD board;
+  unsigned char bits;
+  int line;
+  int column;
+
+  board = 0;
+  for (line = 0; line < LINES_PER_PATTERN; line++)
+  {
+    bits = 0;
+    for (column = 0; column < COLUMNS_PER_PATTERN; column++)
+    {
+      bits |= (levels[line * COLUMNS_PER_PATTERN + column] >= threshold)
+              << (COLUMNS_PER_PATTERN - 1 - column);
+    }
+    board |= (BITBOARD) bits << (8 * line);
+  }
+
+  return board;
+}
+
+
+/* Floyd-Steinberg: the error of each pixel goes to the unvisited ones */
+static BITBOARD diffuse_levels(unsigned char *levels, int threshold)
+{
+  int error[LINES_PER_PATTERN + 1][COLUMNS_PER_PATTERN + 2];
+  BITBOARD board;
+  int line;
+  int column;
+  int level;
+  int lit;
+  int e;
+
+  memset(error, 0, sizeof(error));
+  board = 0;
+  for (line = 0; line < LINES_PER_PATTERN; line++)
+  {
+    for (column = 0; column < COLUMNS_PER_PATTERN; column++)
+    {
+      level = levels[line * COLUMNS_PER_PATTERN + column] +
+              error[line][column + 1] / 16;
+      lit = (level >= threshold);
+      if (lit)
+      {
+        board |= (BITBOARD) (0x80 >> column) << (8 * line);
+      }
+      e = level - (lit ? 255 : 0);
+      error[line][column + 2] += 7 * e;
+      error[line + 1][column] += 3 * e;
+      error[line + 1][column + 1] += 5 * e;
+      error[line + 1][column + 2] += e;
+    }
+  }
+
+  return board;
+}
+
+
+/* in the pattern file format, one blank line between frames */
+static int write_frames(FILE *out, IMAGE *img, long *written)
+{
+  char text[LINES_PER_PATTERN * (COLUMNS_PER_PATTERN + 1) + 2];
+  char *p;
+  int line;
+  int column;
+  int i;
+
+  for (i = 0; i < img->nframes; i++)
+  {
+    p = text;
+    if (*written > 0)
+    {
+      *p++ = '\n';
+    }
+    for (line = 0; line < LINES_PER_PATTERN; line++)
+    {
+      for (column = 0; column < COLUMNS_PER_PATTERN; column++)
+      {
+        *p++ = (BITBOARD_LINE(img->frames[i], line) & (0x80 >> column)) ?
+               'x' : '-';
+      }
+      *p++ = '\n';
+    }
+    *p = '\0';
+    if (fputs(text, out) == EOF)
+    {
+      return RET_IMPORT_ERR_WRITE;
+    }
+    (*written)++;
+  }
+
+  return RET_IMPORT_OK;
+}
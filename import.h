@@ -0,0 +1,20 @@
+#ifndef IMPORT_H
+#define IMPORT_H
+
+#define RET_IMPORT_OK           (0)
+#define RET_IMPORT_ERR_OPEN     (1)
+#define RET_IMPORT_ERR_FORMAT   (2)
+#define RET_IMPORT_ERR_MEMORY   (3)
+#define RET_IMPORT_ERR_WRITE    (4)
+
+#if IMPORT_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int import_images(int myargc, char **myargv);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,908 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#if LINUX
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#endif
+
+#include <serial.h>
+#include <command.h>
+#include <pattern.h>
+#include <crc16.h>
+#include <frame.h>
+#include <checkpoint.h>
+#include <pool.h>
+#include <options.h>
+
+#define LIBRARY_SRC 1
+#include <library.h>
+#undef LIBRARY_SRC
+
+#include <cmddesc.h>
+
+#define PATTERN_SUFFIX ".mmm"
+#define TMP_SUFFIX     ".tmp"
+#define MAX_DEPTH      (16)
+
+/*
+ * mtime in ns. With whole seconds only, a save in the second of the last
+ * build keeps mtime and mostly size, so there files are always hashed.
+ */
+#if LINUX
+#  define MTIME_NS(st)  ((st).st_mtim.tv_sec * 1000000000LL + \
+                         (st).st_mtim.tv_nsec)
+#  define MTIME_EXACT   1
+#else
+#  define MTIME_NS(st)  ((st).st_mtime * 1000000000LL)
+#  define MTIME_EXACT   0
+#endif
+#define DEFAULT_FRAME_MS (100)
+#define MAX_DURATION     (255)
+
+#define FILE_PARSED     (0)
+#define FILE_REUSED     (1)             /* taken over from the old library */
+#define FILE_MALFORMED  (2)
+#define FILE_UNREADABLE (3)
+
+typedef struct {
+  char               *path;
+  char               *name;             /* relative to the directory */
+  int                 state;
+  int                 badline;
+  long long           mtime;
+  unsigned long long  size;
+  unsigned long long  hash;
+  unsigned long long *frames;
+  int                 nframes;
+} LIB_FILE;
+
+typedef struct {
+  LIB_FILE *files;
+  int       nfiles;
+  int       allocated;
+  LIBRARY  *old;                        /* previous build, or NULL */
+} LIB_BUILD;
+
+typedef struct {
+  LIB_ANIM          *anim;
+  unsigned long long store_bytes;       /* 'G'/'I' frames and responses */
+  unsigned long long stream_bytes;      /* 'D' frames and responses */
+  unsigned long long escapes;           /* bytes added by escaping, both */
+} LIB_COST;
+
+typedef struct {
+  LIBRARY      *lib;
+  LIB_COST     *costs;
+  unsigned char duration;
+} LIB_COSTING;
+
+static int build_library(char *dir, char *path);
+static int scan_directory(LIB_BUILD *build, char *dir, char *prefix,
+                          int depth);
+static int build_job(void *ctx, int job);
+static void reuse_frames(LIBRARY *old, LIB_ANIM *anim, LIB_FILE *file);
+static void parse_file(LIB_FILE *file);
+static int write_library(LIB_BUILD *build, char *path,
+                         unsigned long long *size, int *nframes);
+static int check_library(LIBRARY *lib, unsigned long long size);
+static int cost_library(char *path);
+static int cost_job(void *ctx, int job);
+static int compare_files(const void *a, const void *b);
+static int compare_frames(const void *a, const void *b);
+static int compare_costs(const void *a, const void *b);
+
+
+#if LINUX
+
+int open_library(char *path, LIBRARY *lib)
+{
+  int rc;
+  int fd;
+  struct stat st;
+
+  if ((fd = open(path, O_RDONLY)) == -1)
+  {
+    rc = RET_LIBRARY_ERR_OPEN;
+    goto EXIT;
+  }
+  if ((fstat(fd, &st) == -1) || (st.st_size < sizeof(LIB_HEADER)))
+  {
+    close(fd);
+    rc = RET_LIBRARY_ERR_FORMAT;
+    goto EXIT;
+  }
+
+  lib->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (lib->map == MAP_FAILED)
+  {
+    rc = RET_LIBRARY_ERR_OPEN;
+    goto EXIT;
+  }
+
+  if ((rc = check_library(lib, st.st_size)) != RET_LIBRARY_OK)
+  {
+    munmap(lib->map, st.st_size);
+  }
+
+EXIT:
+  return rc;
+}
+
+
+void close_library(LIBRARY *lib)
+{
+  munmap(lib->map, lib->header->size);
+}
+
+#endif
+
+
+#if WIN
+
+/* no mmap, the library is read as a whole instead */
+int open_library(char *path, LIBRARY *lib)
+{
+  int rc;
+  FILE *handle;
+  long size;
+
+  if ((handle = fopen(path, "rb")) == NULL)
+  {
+    rc = RET_LIBRARY_ERR_OPEN;
+    goto EXIT;
+  }
+  if ((fseek(handle, 0, SEEK_END) != 0) || ((size = ftell(handle)) <
+      (long) sizeof(LIB_HEADER)) || (fseek(handle, 0, SEEK_SET) != 0))
+  {
+    rc = RET_LIBRARY_ERR_FORMAT;
+    goto CLOSE_EXIT;
+  }
+  if ((lib->map = malloc(size)) == NULL)
+  {
+    rc = RET_LIBRARY_ERR_MEMORY;
+    goto CLOSE_EXIT;
+  }
+  if (fread(lib->map, 1, size, handle) != size)
+  {
+    free(lib->map);
+    rc = RET_LIBRARY_ERR_OPEN;
+    goto CLOSE_EXIT;
+  }
+
+  if ((rc = check_library(lib, size)) != RET_LIBRARY_OK)
+  {
+    free(lib->map);
+  }
+
+CLOSE_EXIT:
+  fclose(handle);
+
+EXIT:
+  return rc;
+}
+
+
+void close_library(LIBRARY *lib)
+{
+  free(lib->map);
+}
+
+#endif
+
+
+/* binary search by name */
+LIB_ANIM *find_animation(LIBRARY *lib, char *name)
+{
+  int low;
+  int high;
+  int mid;
+  int cmp;
+
+  low = 0;
+  high = lib->header->nanims - 1;
+  while (low <= high)
+  {
+    mid = (low + high) / 2;
+    cmp = strcmp(name, lib->names + lib->anims[mid].name);
+    if (cmp == 0)
+    {
+      return &lib->anims[mid];
+    }
+    if (cmp < 0)
+    {
+      high = mid - 1;
+    }
+    else
+    {
+      low = mid + 1;
+    }
+  }
+
+  return NULL;
+}
+
+
+void get_lib_pattern(LIBRARY *lib, LIB_ANIM *anim, int index,
+                     unsigned char *pattern)
+{
+  unsigned long long frame;
+  int i;
+
+  frame = lib->frames[lib->refs[anim->first_ref + index]];
+  for (i = 0; i < LINES_PER_PATTERN; i++)
+  {
+    pattern[i] = (unsigned char) (frame >> (8 * i));
+  }
+}
+
+
+/*
+ * library build <dir> <library>: validates and parses every .mmm file
+ * below <dir> on --jobs threads (default: all cores) and writes them as
+ * one library, each distinct frame stored once. Files whose mtime and
+ * size, or else whose hash, match the previous library are taken over
+ * from it without parsing. Malformed files are reported and left out.
+ * library cost <library>: the ranked wire cost of every animation.
+ */
+int library_tool(int myargc, char **myargv)
+{
+  if ((myargc == 3) && (strcmp(myargv[0], "build") == 0))
+  {
+    return build_library(myargv[1], myargv[2]);
+  }
+  if ((myargc == 2) && (strcmp(myargv[0], "cost") == 0))
+  {
+    return cost_library(myargv[1]);
+  }
+
+  fprintf(stderr, "unknown library command %s.\n", myargv[0]);
+  return RET_LIBRARY_ERR_OPEN;
+}
+
+
+static int build_library(char *dir, char *path)
+{
+  int rc;
+  LIB_BUILD build;
+  LIBRARY old;
+  int counts[FILE_UNREADABLE + 1];
+  int npatterns;
+  int nframes;
+  unsigned long long size;
+  int i;
+
+  memset(&build, 0, sizeof(build));
+  if ((rc = scan_directory(&build, dir, "", 0)) != RET_LIBRARY_OK)
+  {
+    goto FREE_EXIT;
+  }
+  qsort(build.files, build.nfiles, sizeof(LIB_FILE), compare_files);
+
+  build.old = (open_library(path, &old) == RET_LIBRARY_OK) ? &old : NULL;
+
+  if ((build.nfiles > 0) &&
+      (run_pool(get_int_option("jobs", get_cpu_count()), build.nfiles,
+                build_job, &build) != RET_POOL_OK))
+  {
+    rc = RET_LIBRARY_ERR_MEMORY;
+    goto CLOSE_EXIT;
+  }
+
+  memset(counts, 0, sizeof(counts));
+  npatterns = 0;
+  for (i = 0; i < build.nfiles; i++)
+  {
+    counts[build.files[i].state]++;
+    if (build.files[i].state == FILE_MALFORMED)
+    {
+      fprintf(stderr, "%s:%d: malformed pattern file\n", build.files[i].path,
+              build.files[i].badline);
+    }
+    else if (build.files[i].state == FILE_UNREADABLE)
+    {
+      fprintf(stderr, "%s: read has failed\n", build.files[i].path);
+    }
+    else
+    {
+      npatterns += build.files[i].nframes;
+    }
+  }
+
+  if ((rc = write_library(&build, path, &size, &nframes)) != RET_LIBRARY_OK)
+  {
+    fprintf(stderr, "write of library %s has failed.\n", path);
+    goto CLOSE_EXIT;
+  }
+
+  printf("%d files: %d parsed, %d unchanged, %d malformed, %d unreadable\n",
+         build.nfiles, counts[FILE_PARSED], counts[FILE_REUSED],
+         counts[FILE_MALFORMED], counts[FILE_UNREADABLE]);
+  printf("%d patterns, %d distinct frames, %llu bytes\n", npatterns, nframes,
+         size);
+
+  if (counts[FILE_MALFORMED] + counts[FILE_UNREADABLE] > 0)
+  {
+    rc = RET_LIBRARY_ERR_FILES;
+  }
+
+CLOSE_EXIT:
+  if (build.old != NULL)
+  {
+    close_library(build.old);
+  }
+
+FREE_EXIT:
+  for (i = 0; i < build.nfiles; i++)
+  {
+    free(build.files[i].path);
+    free(build.files[i].name);
+    free(build.files[i].frames);
+  }
+  free(build.files);
+
+  return rc;
+}
+
+
+/* collects the .mmm files below dir/prefix */
+static int scan_directory(LIB_BUILD *build, char *dir, char *prefix,
+                          int depth)
+{
+  int rc;
+  DIR *handle;
+  struct dirent *entry;
+  struct stat st;
+  char *path;
+  char *name;
+  LIB_FILE *grown;
+  size_t len;
+
+  if ((path = malloc(strlen(dir) + strlen(prefix) + 2)) == NULL)
+  {
+    rc = RET_LIBRARY_ERR_MEMORY;
+    goto EXIT;
+  }
+  sprintf(path, "%s/%s", dir, prefix);
+  handle = opendir(path);
+  free(path);
+  if (handle == NULL)
+  {
+    fprintf(stderr, "open of directory %s/%s has failed.\n", dir, prefix);
+    rc = RET_LIBRARY_ERR_OPEN;
+    goto EXIT;
+  }
+
+  rc = RET_LIBRARY_OK;
+  while ((rc == RET_LIBRARY_OK) && ((entry = readdir(handle)) != NULL))
+  {
+    if (entry->d_name[0] == '.')
+    {
+      continue;
+    }
+
+    name = malloc(strlen(prefix) + strlen(entry->d_name) + 2);
+    path = malloc(strlen(dir) + strlen(prefix) + strlen(entry->d_name) + 3);
+    if ((name == NULL) || (path == NULL))
+    {
+      free(name);
+      free(path);
+      rc = RET_LIBRARY_ERR_MEMORY;
+      break;
+    }
+    sprintf(name, "%s%s", prefix, entry->d_name);
+    sprintf(path, "%s/%s", dir, name);
+
+    len = strlen(name);
+    if (stat(path, &st) == -1)
+    {
+      free(name);
+      free(path);
+      continue;
+    }
+    if (S_ISDIR(st.st_mode) && (depth < MAX_DEPTH))
+    {
+      strcat(name, "/");
+      rc = scan_directory(build, dir, name, depth + 1);
+      free(name);
+      free(path);
+      continue;
+    }
+    if (!S_ISREG(st.st_mode) || (len <= strlen(PATTERN_SUFFIX)) ||
+        (strcmp(name + len - strlen(PATTERN_SUFFIX), PATTERN_SUFFIX) != 0))
+    {
+      free(name);
+      free(path);
+      continue;
+    }
+
+    if (build->nfiles == build->allocated)
+    {
+      build->allocated = build->allocated ? 2 * build->allocated : 256;
+      grown = realloc(build->files, build->allocated * sizeof(LIB_FILE));
+      if (grown == NULL)
+      {
+        free(name);
+        free(path);
+        rc = RET_LIBRARY_ERR_MEMORY;
+        break;
+      }
+      build->files = grown;
+    }
+    memset(&build->files[build->nfiles], 0, sizeof(LIB_FILE));
+    build->files[build->nfiles].path = path;
+    build->files[build->nfiles].name = name;
+    build->nfiles++;
+  }
+
+  closedir(handle);
+
+EXIT:
+  return rc;
+}
+
+
+/*
+ * Encodes every animation as storepattern and as a stream of 'D' would
+ * send it, on --jobs threads, and ranks them by the wire time of storing,
+ * the dearest first. --frame=<ms> sets the stored duration, which is part
+ * of the encoded frames too. Escapes are the bytes the STX/ESC values in
+ * patterns and CRCs added: a high share marks an animation whose upload
+ * costs more than its pattern count suggests.
+ */
+static int cost_library(char *path)
+{
+  int rc;
+  LIBRARY lib;
+  LIB_COSTING costing;
+  LIB_COST *c;
+  unsigned long long store_total;
+  unsigned long long stream_total;
+  int duration;
+  int i;
+
+  if ((rc = open_library(path, &lib)) != RET_LIBRARY_OK)
+  {
+    fprintf(stderr, "open of library %s has failed.\n", path);
+    goto EXIT;
+  }
+
+  costing.lib = &lib;
+  duration = get_int_option("frame", DEFAULT_FRAME_MS) / 100;
+  costing.duration = (duration < 1) ? 1 :
+                     (duration > MAX_DURATION) ? MAX_DURATION : duration;
+  if ((costing.costs = calloc(lib.header->nanims + 1, sizeof(LIB_COST)))
+      == NULL)
+  {
+    rc = RET_LIBRARY_ERR_MEMORY;
+    goto CLOSE_EXIT;
+  }
+
+  if ((lib.header->nanims > 0) &&
+      (run_pool(get_int_option("jobs", get_cpu_count()), lib.header->nanims,
+                cost_job, &costing) != RET_POOL_OK))
+  {
+    rc = RET_LIBRARY_ERR_MEMORY;
+    goto FREE_EXIT;
+  }
+  qsort(costing.costs, lib.header->nanims, sizeof(LIB_COST), compare_costs);
+
+  printf("%5s %9s %10s %10s %8s %8s  %s\n", "rank", "patterns", "store ms",
+         "stream ms", "bytes", "escapes", "animation");
+  store_total = 0;
+  stream_total = 0;
+  for (i = 0; i < lib.header->nanims; i++)
+  {
+    c = &costing.costs[i];
+    printf("%5d %9u %10.1f %10.1f %8llu %7.1f%%  %s\n", i + 1,
+           c->anim->nrefs, c->store_bytes * 1000.0 / LINE_BYTES_PER_S,
+           c->stream_bytes * 1000.0 / LINE_BYTES_PER_S, c->store_bytes,
+           (c->store_bytes + c->stream_bytes > 0) ?
+           100.0 * c->escapes / (c->store_bytes + c->stream_bytes) : 0.0,
+           lib.names + c->anim->name);
+    store_total += c->store_bytes;
+    stream_total += c->stream_bytes;
+  }
+  printf("%u animations: %.1f s to store, %.1f s to stream once "
+         "at 38400 8N1\n", lib.header->nanims,
+         (double) store_total / LINE_BYTES_PER_S,
+         (double) stream_total / LINE_BYTES_PER_S);
+
+  rc = RET_LIBRARY_OK;
+
+FREE_EXIT:
+  free(costing.costs);
+
+CLOSE_EXIT:
+  close_library(&lib);
+
+EXIT:
+  return rc;
+}
+
+
+/* pool job: encode all patterns of one animation both ways */
+static int cost_job(void *ctx, int job)
+{
+  LIB_COSTING *costing;
+  LIB_COST *cost;
+  unsigned char pattern[CMD_NPARAM(CMD_DISPLAYPATTERN)];
+  unsigned char stored[CMD_NPARAM(CMD_STOREFIRSTPATTERN)];
+  unsigned char frame[FRAME_ENCODED_LEN(CMD_NPARAM(CMD_STOREFIRSTPATTERN))];
+  int framelen;
+  int i;
+
+  costing = (LIB_COSTING *) ctx;
+  cost = &costing->costs[job];
+  cost->anim = &costing->lib->anims[job];
+
+  for (i = 0; i < cost->anim->nrefs; i++)
+  {
+    get_lib_pattern(costing->lib, cost->anim, i, pattern);
+
+    memcpy(stored, pattern, sizeof(pattern));
+    stored[LINES_PER_PATTERN] = costing->duration;
+    framelen = (i == 0) ? ENCODE_CMD(CMD_STOREFIRSTPATTERN, stored, frame) :
+                          ENCODE_CMD(CMD_STORENEXTPATTERN, stored, frame);
+    cost->store_bytes += framelen + CMD_RSPLEN(CMD_STOREFIRSTPATTERN);
+    cost->escapes += framelen - FRAME_PLAIN_LEN(sizeof(stored));
+
+    framelen = ENCODE_CMD(CMD_DISPLAYPATTERN, pattern, frame);
+    cost->stream_bytes += framelen + CMD_RSPLEN(CMD_DISPLAYPATTERN);
+    cost->escapes += framelen - FRAME_PLAIN_LEN(sizeof(pattern));
+  }
+
+  return POOL_JOB_DONE;
+}
+
+
+static int build_job(void *ctx, int job)
+{
+  LIB_BUILD *build;
+  LIB_FILE *file;
+  LIB_ANIM *anim;
+  struct stat st;
+
+  build = (LIB_BUILD *) ctx;
+  file = &build->files[job];
+
+  if (stat(file->path, &st) == -1)
+  {
+    file->state = FILE_UNREADABLE;
+    return POOL_JOB_DONE;
+  }
+  file->mtime = MTIME_NS(st);
+  file->size = st.st_size;
+
+  anim = (build->old != NULL) ? find_animation(build->old, file->name) : NULL;
+  if (MTIME_EXACT && (anim != NULL) && (anim->mtime == file->mtime) &&
+      (anim->size == file->size))
+  {
+    file->hash = anim->hash;
+    reuse_frames(build->old, anim, file);
+    return POOL_JOB_DONE;
+  }
+
+  if (hash_file(file->path, &file->hash) != RET_CHECKPOINT_OK)
+  {
+    file->state = FILE_UNREADABLE;
+    return POOL_JOB_DONE;
+  }
+  if ((anim != NULL) && (anim->hash == file->hash) &&
+      (anim->size == file->size))
+  {
+    reuse_frames(build->old, anim, file);
+    return POOL_JOB_DONE;
+  }
+
+  parse_file(file);
+  return POOL_JOB_DONE;
+}
+
+
+static void reuse_frames(LIBRARY *old, LIB_ANIM *anim, LIB_FILE *file)
+{
+  int i;
+
+  if ((file->frames = malloc(anim->nrefs * sizeof(unsigned long long)))
+      == NULL)
+  {
+    file->state = FILE_UNREADABLE;
+    return;
+  }
+  for (i = 0; i < anim->nrefs; i++)
+  {
+    file->frames[i] = old->frames[old->refs[anim->first_ref + i]];
+  }
+  file->nframes = anim->nrefs;
+  file->state = FILE_REUSED;
+}
+
+
+static void parse_file(LIB_FILE *file)
+{
+  FILE *handle;
+  unsigned char pattern[LINES_PER_PATTERN];
+  unsigned char dummy;
+  int count;
+  int i;
+  int j;
+
+  if (open_patternfile(file->path, &handle) != RET_PATTERN_OK)
+  {
+    file->state = FILE_UNREADABLE;
+    return;
+  }
+
+  if (validate_patternfile(handle, &count, &file->badline) != RET_PATTERN_OK)
+  {
+    file->state = FILE_MALFORMED;
+    goto CLOSE_EXIT;
+  }
+
+  if ((file->frames = malloc(count * sizeof(unsigned long long))) == NULL)
+  {
+    file->state = FILE_UNREADABLE;
+    goto CLOSE_EXIT;
+  }
+
+  rewind(handle);
+  for (i = 0; i < count; i++)
+  {
+    /* patterns are separated by one line */
+    if (((i > 0) && (read_patternfile(handle, &dummy) != RET_PATTERN_OK)) ||
+        (read_one_pattern(handle, pattern) != RET_PATTERN_OK))
+    {
+      /* only parsed files have frames, write_library() goes by that */
+      free(file->frames);
+      file->frames = NULL;
+      file->state = FILE_UNREADABLE;
+      goto CLOSE_EXIT;
+    }
+    file->frames[i] = 0;
+    for (j = 0; j < LINES_PER_PATTERN; j++)
+    {
+      file->frames[i] |= (unsigned long long) pattern[j] << (8 * j);
+    }
+  }
+  file->nframes = count;
+  file->state = FILE_PARSED;
+
+CLOSE_EXIT:
+  close_patternfile(handle);
+}
+
+
+/* writes <path>.tmp and renames it, readers never see half a library */
+static int write_library(LIB_BUILD *build, char *path,
+                         unsigned long long *size, int *nframes)
+{
+  int rc;
+  LIB_HEADER header;
+  LIB_ANIM anim;
+  unsigned long long *frames;
+  unsigned long long *found;
+  unsigned int ref;
+  char *tmppath;
+  FILE *handle;
+  int nrefs;
+  int nanims;
+  unsigned int namelen;
+  int failed;
+  int i;
+  int j;
+
+  /* distinct frames, sorted so that refs can be found by bisection */
+  nrefs = 0;
+  nanims = 0;
+  namelen = 0;
+  for (i = 0; i < build->nfiles; i++)
+  {
+    if (build->files[i].frames != NULL)
+    {
+      nrefs += build->files[i].nframes;
+      namelen += strlen(build->files[i].name) + 1;
+      nanims++;
+    }
+  }
+
+  if ((frames = malloc((nrefs + 1) * sizeof(unsigned long long))) == NULL)
+  {
+    rc = RET_LIBRARY_ERR_MEMORY;
+    goto EXIT;
+  }
+  *nframes = 0;
+  for (i = 0; i < build->nfiles; i++)
+  {
+    if (build->files[i].frames != NULL)
+    {
+      memcpy(frames + *nframes, build->files[i].frames,
+             build->files[i].nframes * sizeof(unsigned long long));
+      *nframes += build->files[i].nframes;
+    }
+  }
+  qsort(frames, *nframes, sizeof(unsigned long long), compare_frames);
+  for (i = 0, j = 0; i < *nframes; i++)
+  {
+    if ((j == 0) || (frames[i] != frames[j - 1]))
+    {
+      frames[j++] = frames[i];
+    }
+  }
+  *nframes = j;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, LIB_MAGIC, sizeof(header.magic));
+  header.version = LIB_VERSION;
+  header.nframes = *nframes;
+  header.nanims = nanims;
+  header.nrefs = nrefs;
+  header.frames_offset = sizeof(LIB_HEADER);
+  header.anims_offset = header.frames_offset +
+                        *nframes * sizeof(unsigned long long);
+  header.refs_offset = header.anims_offset + nanims * sizeof(LIB_ANIM);
+  header.names_offset = header.refs_offset + nrefs * sizeof(unsigned int);
+  header.size = header.names_offset + namelen;
+  *size = header.size;
+
+  if ((tmppath = malloc(strlen(path) + strlen(TMP_SUFFIX) + 1)) == NULL)
+  {
+    rc = RET_LIBRARY_ERR_MEMORY;
+    goto FREE_EXIT;
+  }
+  sprintf(tmppath, "%s%s", path, TMP_SUFFIX);
+  if ((handle = fopen(tmppath, "wb")) == NULL)
+  {
+    rc = RET_LIBRARY_ERR_WRITE;
+    goto FREE_TMP_EXIT;
+  }
+
+  fwrite(&header, sizeof(header), 1, handle);
+  fwrite(frames, sizeof(unsigned long long), *nframes, handle);
+
+  memset(&anim, 0, sizeof(anim));
+  for (i = 0; i < build->nfiles; i++)
+  {
+    if (build->files[i].frames == NULL)
+    {
+      continue;
+    }
+    anim.nrefs = build->files[i].nframes;
+    anim.mtime = build->files[i].mtime;
+    anim.size = build->files[i].size;
+    anim.hash = build->files[i].hash;
+    fwrite(&anim, sizeof(anim), 1, handle);
+    anim.name += strlen(build->files[i].name) + 1;
+    anim.first_ref += anim.nrefs;
+  }
+
+  for (i = 0; i < build->nfiles; i++)
+  {
+    for (j = 0; (build->files[i].frames != NULL) &&
+                (j < build->files[i].nframes); j++)
+    {
+      found = bsearch(&build->files[i].frames[j], frames, *nframes,
+                      sizeof(unsigned long long), compare_frames);
+      ref = found - frames;
+      fwrite(&ref, sizeof(ref), 1, handle);
+    }
+  }
+
+  for (i = 0; i < build->nfiles; i++)
+  {
+    if (build->files[i].frames != NULL)
+    {
+      fwrite(build->files[i].name, strlen(build->files[i].name) + 1, 1,
+             handle);
+    }
+  }
+
+  /* a full disk shows in ferror(), fclose() only reports the last flush */
+  failed = ferror(handle);
+  if ((fclose(handle) != 0) || failed || (rename(tmppath, path) != 0))
+  {
+    remove(tmppath);
+    rc = RET_LIBRARY_ERR_WRITE;
+    goto FREE_TMP_EXIT;
+  }
+
+  rc = RET_LIBRARY_OK;
+
+FREE_TMP_EXIT:
+  free(tmppath);
+
+FREE_EXIT:
+  free(frames);
+
+EXIT:
+  return rc;
+}
+
+
+/* sets up the section pointers, after checking they are inside the file */
+static int check_library(LIBRARY *lib, unsigned long long size)
+{
+  LIB_HEADER *h;
+  int i;
+
+  h = (LIB_HEADER *) lib->map;
+  if ((memcmp(h->magic, LIB_MAGIC, sizeof(h->magic)) != 0) ||
+      (h->version != LIB_VERSION) || (h->size != size) ||
+      (h->frames_offset != sizeof(LIB_HEADER)) ||
+      (h->anims_offset != h->frames_offset +
+                          h->nframes * sizeof(unsigned long long)) ||
+      (h->refs_offset != h->anims_offset + h->nanims * sizeof(LIB_ANIM)) ||
+      (h->names_offset != h->refs_offset + h->nrefs * sizeof(unsigned int)) ||
+      (h->names_offset > size))
+  {
+    return RET_LIBRARY_ERR_FORMAT;
+  }
+
+  lib->header = h;
+  lib->frames = (unsigned long long *) ((char *) lib->map + h->frames_offset);
+  lib->anims = (LIB_ANIM *) ((char *) lib->map + h->anims_offset);
+  lib->refs = (unsigned int *) ((char *) lib->map + h->refs_offset);
+  lib->names = (char *) lib->map + h->names_offset;
+
+  for (i = 0; i < h->nanims; i++)
+  {
+    if ((lib->anims[i].name >= size - h->names_offset) ||
+        (lib->anims[i].first_ref + (unsigned long long) lib->anims[i].nrefs >
+         h->nrefs))
+    {
+      return RET_LIBRARY_ERR_FORMAT;
+    }
+  }
+  for (i = 0; i < h->nrefs; i++)
+  {
+    if (lib->refs[i] >= h->nframes)
+    {
+      return RET_LIBRARY_ERR_FORMAT;
+    }
+  }
+  if ((size > h->names_offset) && (lib->names[size - h->names_offset - 1]
+                                   != '\0'))
+  {
+    return RET_LIBRARY_ERR_FORMAT;
+  }
+
+  return RET_LIBRARY_OK;
+}
+
+
+static int compare_files(const void *a, const void *b)
+{
+  return strcmp(((LIB_FILE *) a)->name, ((LIB_FILE *) b)->name);
+}
+
+
+static int compare_frames(const void *a, const void *b)
+{
+  unsigned long long x;
+  unsigned long long y;
+
+  x = *(unsigned long long *) a;
+  y = *(unsigned long long *) b;
+  return (x > y) - (x < y);
+}
+
+
+/* dearest store first, by name (the order of anims) if equal */
+static int compare_costs(const void *a, const void *b)
+{
+  LIB_COST *x;
+  LIB_COST *y;
+
+  x = (LIB_COST *) a;
+  y = (LIB_COST *) b;
+  if (x->store_bytes != y->store_bytes)
+  {
+    return (x->store_bytes < y->store_bytes) ? 1 : -1;
+  }
+  return (x->anim > y->anim) - (x->anim < y->anim);
+}
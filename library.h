@@ -0,0 +1,73 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+/*
+ * A pattern library is one file, mapped read-only as a whole:
+ *
+ *   LIB_HEADER
+ *   frames  unsigned long long[nframes]  distinct frames, ascending
+ *   anims   LIB_ANIM[nanims]             by name, ascending
+ *   refs    unsigned int[nrefs]          frame indices of all animations
+ *   names   char[]                       NUL terminated
+ *
+ * A frame is the transposed pattern as read_one_pattern() returns it,
+ * byte i in bits 8*i to 8*i+7. Numbers are in host byte order.
+ */
+#define LIB_MAGIC   "MMM8LIB1"
+#define LIB_VERSION (1)
+
+#define RET_LIBRARY_OK         (0)
+#define RET_LIBRARY_ERR_OPEN   (1)
+#define RET_LIBRARY_ERR_FORMAT (2)
+#define RET_LIBRARY_ERR_MEMORY (3)
+#define RET_LIBRARY_ERR_WRITE  (4)
+#define RET_LIBRARY_ERR_FILES  (5)      /* malformed pattern files */
+
+typedef struct {
+  char               magic[8];
+  unsigned int       version;
+  unsigned int       nframes;
+  unsigned int       nanims;
+  unsigned int       nrefs;
+  unsigned long long frames_offset;
+  unsigned long long anims_offset;
+  unsigned long long refs_offset;
+  unsigned long long names_offset;
+  unsigned long long size;              /* of the whole file */
+} LIB_HEADER;
+
+typedef struct {
+  unsigned int       name;              /* offset into names */
+  unsigned int       first_ref;         /* index into refs */
+  unsigned int       nrefs;             /* no of patterns */
+  unsigned int       reserved;
+  long long          mtime;             /* of the source file, in ns */
+  unsigned long long size;
+  unsigned long long hash;              /* hash_file() of the source */
+} LIB_ANIM;
+
+typedef struct {
+  void               *map;
+  LIB_HEADER         *header;
+  unsigned long long *frames;
+  LIB_ANIM           *anims;
+  unsigned int       *refs;
+  char               *names;
+} LIBRARY;
+
+#if LIBRARY_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int open_library(char *path, LIBRARY *lib);
+EXTERN void close_library(LIBRARY *lib);
+EXTERN LIB_ANIM *find_animation(LIBRARY *lib, char *name);
+EXTERN void get_lib_pattern(LIBRARY *lib, LIB_ANIM *anim, int index,
+                            unsigned char *pattern);
+EXTERN int library_tool(int myargc, char **myargv);
+
+#undef EXTERN
+
+#endif
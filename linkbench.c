@@ -0,0 +1,371 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <serial.h>
+#include <command.h>
+#include <pattern.h>
+#include <crc16.h>
+#include <frame.h>
+#include <options.h>
+#include <timing.h>
+#include <discover.h>
+
+#define LINKBENCH_SRC 1
+#include <linkbench.h>
+#undef LINKBENCH_SRC
+
+#include <cmddesc.h>
+
+#define DEFAULT_FRAMES  (200)
+#define WARMUP_FRAMES   (5)           /* not counted, fill the pipes first */
+#define MAX_NAME_LEN    (256)
+#define MAX_LINE        (1024)
+#define MAX_RESULTS     (256)         /* lines kept from the results file */
+#define NTESTS          (3)
+
+#if LINUX
+#  define RESULTS_NAME  ".mmm8x8-link"
+#else
+#  define RESULTS_NAME  "mmm8x8-link.txt"
+#endif
+
+typedef struct {
+  char               *name;
+  unsigned char       frame[FRAME_ENCODED_LEN(LINES_PER_PATTERN)];
+  int                 framelen;
+  int                 rsplen;
+  unsigned long long *rtt;          /* sorted after the run */
+  int                 nrtt;
+  unsigned long long  elapsed;      /* wall time of all counted frames */
+} LINK_TEST;
+
+static void setup_tests(LINK_TEST *tests);
+static int run_test(SERHDL hdl, LINK_TEST *test, int nframes);
+static int exchange(SERHDL hdl, LINK_TEST *test);
+static void print_results(char *device, char *key, LINK_TEST *tests);
+static void store_results(char *key, LINK_TEST *tests);
+static unsigned long long percentile(LINK_TEST *test, int pct);
+static unsigned long long wire_time_us(LINK_TEST *test);
+static int compare_rtts(const void *a, const void *b);
+
+
+/*
+ * Measures what the link to one module really carries: back to back
+ * exchanges of a 'D' whose frame needs no escaping, of a 'D' whose
+ * parameters are all STX/ESC and so escaped, and of 'v' queries. For each
+ * the round trip distribution, the frame rate and the bytes per second
+ * against the 3840 of 38400 baud are printed and stored per port
+ * (by USB serial number if there is one) in ~/.mmm8x8-link or --results.
+ */
+int bench_link(int myargc, char **myargv)
+{
+  int rc;
+  char device[MAX_NAME_LEN];
+  char key[MAX_NAME_LEN];
+  SERHDL hdl;
+  LINK_TEST tests[NTESTS];
+  int nframes;
+  int i;
+
+  snprintf(device, sizeof(device), "%s", myargv[0]);
+  if ((strcmp(device, AUTO_DEVICE) == 0) &&
+      (find_device(device, sizeof(device)) != RET_DISCOVER_OK))
+  {
+    fprintf(stderr, "no MMM8x8 has been found.\n");
+    rc = RET_LINKBENCH_ERR_DEVICE;
+    goto EXIT;
+  }
+
+  if ((nframes = get_int_option("frames", DEFAULT_FRAMES)) < 1)
+  {
+    nframes = 1;
+  }
+
+  memset(tests, 0, sizeof(tests));
+  for (i = 0; i < NTESTS; i++)
+  {
+    if ((tests[i].rtt = malloc(nframes * sizeof(unsigned long long))) == NULL)
+    {
+      rc = RET_LINKBENCH_ERR_MEMORY;
+      goto FREE_EXIT;
+    }
+  }
+  setup_tests(tests);
+
+  if (open_serial(device, &hdl) != RET_SERIAL_OK)
+  {
+    fprintf(stderr, "open of device %s has failed.\n", device);
+    rc = RET_LINKBENCH_ERR_DEVICE;
+    goto FREE_EXIT;
+  }
+
+  trace_responses(0);
+  for (i = 0; i < NTESTS; i++)
+  {
+    if ((rc = run_test(hdl, &tests[i], nframes)) != RET_LINKBENCH_OK)
+    {
+      fprintf(stderr, "%s exchange %d with device %s has failed.\n",
+              tests[i].name, tests[i].nrtt + 1, device);
+      goto CLOSE_EXIT;
+    }
+  }
+
+  get_port_key(device, key, sizeof(key));
+  print_results(device, key, tests);
+  store_results(key, tests);
+
+  rc = RET_LINKBENCH_OK;
+
+CLOSE_EXIT:
+  close_serial(hdl);
+
+FREE_EXIT:
+  for (i = 0; i < NTESTS; i++)
+  {
+    free(tests[i].rtt);
+  }
+
+EXIT:
+  return rc;
+}
+
+
+/*
+ * The payloads are searched for instead of hard coded, so they stay the
+ * cheapest and the dearest frame whatever the CRC of them escapes.
+ */
+static void setup_tests(LINK_TEST *tests)
+{
+  unsigned char params[CMD_NPARAM(CMD_DISPLAYPATTERN)];
+  unsigned char frame[FRAME_ENCODED_LEN(LINES_PER_PATTERN)];
+  int framelen;
+  int value;
+  int bits;
+  int i;
+
+  /* every line the same, the shortest frame of those */
+  tests[0].name = "plain";
+  tests[0].rsplen = CMD_RSPLEN(CMD_DISPLAYPATTERN);
+  for (value = 0; value < 256; value++)
+  {
+    memset(params, value, sizeof(params));
+    framelen = ENCODE_CMD(CMD_DISPLAYPATTERN, params, frame);
+    if ((tests[0].framelen == 0) || (framelen < tests[0].framelen))
+    {
+      memcpy(tests[0].frame, frame, framelen);
+      tests[0].framelen = framelen;
+    }
+  }
+
+  /* every line STX or ESC, the longest frame of those */
+  tests[1].name = "escaped";
+  tests[1].rsplen = CMD_RSPLEN(CMD_DISPLAYPATTERN);
+  for (bits = 0; bits < (1 << LINES_PER_PATTERN); bits++)
+  {
+    for (i = 0; i < LINES_PER_PATTERN; i++)
+    {
+      params[i] = (bits & (1 << i)) ? STX : ESC;
+    }
+    framelen = ENCODE_CMD(CMD_DISPLAYPATTERN, params, frame);
+    if (framelen > tests[1].framelen)
+    {
+      memcpy(tests[1].frame, frame, framelen);
+      tests[1].framelen = framelen;
+    }
+  }
+
+  tests[2].name = "version";
+  tests[2].rsplen = CMD_RSPLEN(CMD_FIRMWAREVERSION);
+  tests[2].framelen = encode_frame(CMD_LETTER(CMD_FIRMWAREVERSION),
+                                   CMD_NPARAM(CMD_FIRMWAREVERSION), NULL,
+                                   tests[2].frame);
+}
+
+
+static int run_test(SERHDL hdl, LINK_TEST *test, int nframes)
+{
+  int rc;
+  unsigned long long start;
+  unsigned long long now;
+  int i;
+
+  for (i = 0; i < WARMUP_FRAMES; i++)
+  {
+    if ((rc = exchange(hdl, test)) != RET_LINKBENCH_OK)
+    {
+      goto EXIT;
+    }
+  }
+
+  start = get_time_us();
+  for (test->nrtt = 0; test->nrtt < nframes; test->nrtt++)
+  {
+    now = get_time_us();
+    if ((rc = exchange(hdl, test)) != RET_LINKBENCH_OK)
+    {
+      goto EXIT;
+    }
+    test->rtt[test->nrtt] = get_time_us() - now;
+  }
+  test->elapsed = get_time_us() - start;
+
+  qsort(test->rtt, test->nrtt, sizeof(unsigned long long), compare_rtts);
+
+  rc = RET_LINKBENCH_OK;
+
+EXIT:
+  return rc;
+}
+
+
+static int exchange(SERHDL hdl, LINK_TEST *test)
+{
+  unsigned char response[CMD_RSPLEN(CMD_FIRMWAREVERSION)];
+
+  if ((send_frame(hdl, test->frame, test->framelen) != RET_COMMAND_OK) ||
+      (receive_response(hdl, response, test->rsplen) != RET_COMMAND_OK))
+  {
+    return RET_LINKBENCH_ERR_LINK;
+  }
+
+  return RET_LINKBENCH_OK;
+}
+
+
+/*
+ * wire is what the bytes of one exchange take at 38400 baud, so rtt minus
+ * wire is the turnaround of adapter and module; load is the share of the
+ * line the exchanges kept busy.
+ */
+static void print_results(char *device, char *key, LINK_TEST *tests)
+{
+  LINK_TEST *t;
+  double fps;
+  double bytes;
+  int i;
+
+  printf("device %s (%s), %d exchanges per test\n", device, key,
+         tests[0].nrtt);
+  printf("%-8s %7s %8s %8s %8s %8s %8s %8s %7s %8s %5s\n", "test", "bytes",
+         "wire ms", "min ms", "p50 ms", "p90 ms", "p99 ms", "max ms", "fps",
+         "bytes/s", "load");
+
+  for (i = 0; i < NTESTS; i++)
+  {
+    t = &tests[i];
+    fps = (t->elapsed > 0) ? t->nrtt * 1000000.0 / t->elapsed : 0.0;
+    bytes = fps * (t->framelen + t->rsplen);
+    printf("%-8s %3d+%-3d %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %7.1f %8.0f "
+           "%4.0f%%\n", t->name, t->framelen, t->rsplen,
+           wire_time_us(t) / 1000.0, t->rtt[0] / 1000.0,
+           percentile(t, 50) / 1000.0, percentile(t, 90) / 1000.0,
+           percentile(t, 99) / 1000.0, t->rtt[t->nrtt - 1] / 1000.0, fps,
+           bytes, 100.0 * bytes / LINE_BYTES_PER_S);
+  }
+}
+
+
+/*
+ * Results lines: <key> <test> <frame bytes> <response bytes> <min us>
+ * <p50 us> <p90 us> <p99 us> <max us> <fps> <bytes/s> <time>
+ * The lines of this port are replaced, those of other ports kept.
+ */
+static void store_results(char *key, LINK_TEST *tests)
+{
+  FILE *handle;
+  char *home;
+  char path[MAX_NAME_LEN];
+  char (*lines)[MAX_LINE];
+  char lkey[MAX_NAME_LEN];
+  int nlines;
+  LINK_TEST *t;
+  double fps;
+  int i;
+
+  if (get_option("results") != NULL)
+  {
+    snprintf(path, sizeof(path), "%s", get_option("results"));
+  }
+  else if ((home = getenv("HOME")) != NULL)
+  {
+    snprintf(path, sizeof(path), "%s/%s", home, RESULTS_NAME);
+  }
+  else
+  {
+    return;
+  }
+
+  if ((lines = malloc(MAX_RESULTS * MAX_LINE)) == NULL)
+  {
+    return;
+  }
+
+  nlines = 0;
+  if ((handle = fopen(path, "r")) != NULL)
+  {
+    while ((nlines < MAX_RESULTS) &&
+           (fgets(lines[nlines], MAX_LINE, handle) != NULL))
+    {
+      if ((sscanf(lines[nlines], "%255s", lkey) == 1) &&
+          (strcmp(lkey, key) != 0))
+      {
+        nlines++;
+      }
+    }
+    fclose(handle);
+  }
+
+  if ((handle = fopen(path, "w")) == NULL)
+  {
+    fprintf(stderr, "write of link results %s has failed.\n", path);
+    free(lines);
+    return;
+  }
+
+  for (i = 0; i < nlines; i++)
+  {
+    fputs(lines[i], handle);
+  }
+  for (i = 0; i < NTESTS; i++)
+  {
+    t = &tests[i];
+    fps = (t->elapsed > 0) ? t->nrtt * 1000000.0 / t->elapsed : 0.0;
+    fprintf(handle, "%s %s %d %d %llu %llu %llu %llu %llu %.1f %.0f %lld\n",
+            key, t->name, t->framelen, t->rsplen, t->rtt[0],
+            percentile(t, 50), percentile(t, 90), percentile(t, 99),
+            t->rtt[t->nrtt - 1], fps, fps * (t->framelen + t->rsplen),
+            (long long) time(NULL));
+  }
+
+  fclose(handle);
+  free(lines);
+}
+
+
+/* nearest rank of the sorted round trips */
+static unsigned long long percentile(LINK_TEST *test, int pct)
+{
+  int rank;
+
+  rank = (test->nrtt * pct + 99) / 100;
+  return test->rtt[(rank > 0) ? rank - 1 : 0];
+}
+
+
+static unsigned long long wire_time_us(LINK_TEST *test)
+{
+  return (test->framelen + test->rsplen) * 1000000ULL / LINE_BYTES_PER_S;
+}
+
+
+static int compare_rtts(const void *a, const void *b)
+{
+  unsigned long long x;
+  unsigned long long y;
+
+  x = *(unsigned long long *) a;
+  y = *(unsigned long long *) b;
+  return (x > y) - (x < y);
+}
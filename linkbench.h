@@ -0,0 +1,19 @@
+#ifndef LINKBENCH_H
+#define LINKBENCH_H
+
+#define RET_LINKBENCH_OK         (0)
+#define RET_LINKBENCH_ERR_DEVICE (1)
+#define RET_LINKBENCH_ERR_MEMORY (2)
+#define RET_LINKBENCH_ERR_LINK   (3)
+
+#if LINKBENCH_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int bench_link(int myargc, char **myargv);
+
+#undef EXTERN
+
+#endif
@@ -5,6 +5,24 @@
 #include <command.h>
 #include <pattern.h>
 #include <crc16.h>
+#include <frame.h>
+#include <options.h>
+#include <sync.h>
+#include <gray.h>
+#include <bitboard.h>
+#include <generate.h>
+#include <discover.h>
+#include <serve.h>
+#include <async.h>
+#include <framebuffer.h>
+#include <watch.h>
+#include <library.h>
+#include <play.h>
+#include <linkbench.h>
+#include <import.h>
+#include <syncstart.h>
+#include <profile.h>
+#include <framecache.h>
 
 /* local constants */
 #define RET_OK                      (0)
@@ -19,8 +37,25 @@
 #define RET_ERR_SET_TEXTMODE        (9)
 #define RET_ERR_SET_PATTERNMODE     (10)
 #define RET_ERR_EXE_FACTORYRESET    (11)
+#define RET_ERR_SYNC                (12)
+#define RET_ERR_DISPLAY_GRAYSCALE   (13)
+#define RET_ERR_STORE_GENERATED     (14)
+#define RET_ERR_STREAM_GENERATED    (15)
+#define RET_ERR_GENERATE            (16)
+#define RET_ERR_DISCOVER            (17)
+#define RET_ERR_SERVE               (18)
+#define RET_ERR_FANOUT              (19)
+#define RET_ERR_FRAMEBUFFER         (20)
+#define RET_ERR_FBWRITE             (21)
+#define RET_ERR_WATCH               (22)
+#define RET_ERR_LIBRARY             (23)
+#define RET_ERR_PLAY                (24)
+#define RET_ERR_LINKBENCH           (25)
+#define RET_ERR_IMPORT              (26)
+#define RET_ERR_SYNCSTART           (27)
 
 #define CMD_NOMATCH (0)
+#define TOOL_NOMATCH (0)
 
 /* local types */
 typedef int (*CMD_FCT)(SERHDL hdl, int myargc, char **myargv);
@@ -32,8 +67,19 @@ typedef struct {
   int     cmd_rc;         /* process failed exit code for this command */
 } CMD;
 
+/* tools work without a serial device given on the command line */
+typedef int (*TOOL_FCT)(int myargc, char **myargv);
+
+typedef struct {
+  char    *tool_name;     /* name as typed on the command line */
+  int      tool_nargs;    /* no of arguments this tool needs */
+  TOOL_FCT tool_fct;      /* pointer to tool function */
+  int      tool_rc;       /* process failed exit code for this tool */
+} TOOL;
+
 
 static int find_command(int nargs, char *command);
+static int find_tool(int nargs, char *tool);
 static void print_usage(void);
 
 
@@ -45,6 +91,8 @@ static CMD cmd_table[] =
   { "firmwareversion", 0,   get_firmwareversion, RET_ERR_GET_FIRMWAREVERSION },
   { "displaytext",     1,   display_text,        RET_ERR_DISPLAY_TEXT },
   { "storetext",       1,   store_text,          RET_ERR_STORE_TEXT },
+  { "displaytextfile", 1,   display_textfile,    RET_ERR_DISPLAY_TEXT },
+  { "storetextfile",   1,   store_textfile,      RET_ERR_STORE_TEXT },
   { "settextspeed",    1,   set_textspeed,       RET_ERR_SET_TEXTSPEED },
   { "displaypattern",  1,   display_pattern,     RET_ERR_DISPLAY_PATTERN },
   { "storepattern",    1,   store_pattern,       RET_ERR_STORE_PATTERN },
@@ -52,6 +100,29 @@ static CMD cmd_table[] =
   { "settextmode",     0,   set_textmode,        RET_ERR_SET_TEXTMODE },
   { "setpatternmode",  0,   set_patternmode,     RET_ERR_SET_PATTERNMODE },
   { "factoryreset",    0,   exe_factoryreset,    RET_ERR_EXE_FACTORYRESET },
+  { "displaygrayscale",1,   display_grayscale,   RET_ERR_DISPLAY_GRAYSCALE },
+  { "storegenerated",  2,   store_generated,     RET_ERR_STORE_GENERATED },
+  { "streamgenerated", 2,   stream_generated,    RET_ERR_STREAM_GENERATED },
+  { "serve",           1,   serve_device,        RET_ERR_SERVE },
+  { "watch",           1,   watch_directory,     RET_ERR_WATCH },
+  { "play",            1,   play_animation,      RET_ERR_PLAY },
+};
+
+static TOOL tool_table[] =
+{
+/*  tool_name,         nargs, tool fct,          rc */
+  { "",                0,   NULL,                RET_ERR_USAGE },/* no match */
+  { "sync",            1,   sync_fleet,          RET_ERR_SYNC },
+  { "generate",        2,   print_generated,     RET_ERR_GENERATE },
+  { "discover",        0,   discover_devices,    RET_ERR_DISCOVER },
+  { "fanout",          3,   fanout_patterns,     RET_ERR_FANOUT },
+  { "framebuffer",     2,   push_framebuffer,    RET_ERR_FRAMEBUFFER },
+  { "fbwrite",         3,   write_framebuffer,   RET_ERR_FBWRITE },
+  { "library",         3,   library_tool,        RET_ERR_LIBRARY },
+  { "library",         2,   library_tool,        RET_ERR_LIBRARY },
+  { "linkbench",       1,   bench_link,          RET_ERR_LINKBENCH },
+  { "import",          2,   import_images,       RET_ERR_IMPORT },
+  { "syncstart",       1,   sync_start,          RET_ERR_SYNCSTART },
 };
 
 
@@ -60,7 +131,45 @@ int main(int argc, char **argv)
 {
   int rc;
   int cmd;
+  int tool;
   SERHDL hdl;
+  char device[256];
+
+  if (parse_options(&argc, argv) != RET_OPTIONS_OK)
+  {
+    print_usage();
+    rc = RET_ERR_USAGE; 
+    goto EXIT;
+  }
+
+  if (get_option("profile") != NULL)
+  {
+    start_profile();
+  }
+
+  if (argc >= 2)
+  {
+    tool = find_tool(argc - 2, argv[1]);
+    if (tool != TOOL_NOMATCH)
+    {
+      /* tools open their own ports, none of them can fake its I/O */
+      if (get_option("dry-run") != NULL)
+      {
+        fprintf(stderr, "--dry-run only works with device commands, "
+                        "not with %s.\n", argv[1]);
+        rc = RET_ERR_USAGE;
+        goto EXIT;
+      }
+      PROBE1(tool_entry, tool_table[tool].tool_name);
+      rc = tool_table[tool].tool_fct(argc - 2, &argv[2]);
+      PROBE2(tool_return, tool_table[tool].tool_name, rc);
+      if (rc != RET_OK)
+      {
+        rc = tool_table[tool].tool_rc;
+      }
+      goto EXIT;
+    }
+  }
 
   if (argc < 3)
   {
@@ -77,13 +186,41 @@ int main(int argc, char **argv)
     goto EXIT;
   }
 
-  if ((rc = open_serial(argv[1], &hdl)) != RET_SERIAL_OK)
+  /* --dry-run needs no port, the frames are only counted */
+  if (get_option("dry-run") != NULL)
+  {
+    start_dry_run();
+    hdl = 0;
+    PROBE1(command_entry, cmd_table[cmd].cmd_name);
+    rc = cmd_table[cmd].cmd_fct(hdl, argc - 3, &argv[3]);
+    PROBE2(command_return, cmd_table[cmd].cmd_name, rc);
+    if (rc != RET_OK)
+    {
+      rc = cmd_table[cmd].cmd_rc;
+    }
+    print_dry_run();
+    goto EXIT;
+  }
+
+  /* "auto" is the first port found by discover, usually from its cache */
+  snprintf(device, sizeof(device), "%s", argv[1]);
+  if ((strcmp(argv[1], AUTO_DEVICE) == 0) &&
+      (find_device(device, sizeof(device)) != RET_DISCOVER_OK))
+  {
+    fprintf(stderr, "no MMM8x8 has been found.\n");
+    rc = RET_ERR_DISCOVER;
+    goto EXIT;
+  }
+
+  if ((rc = open_serial(device, &hdl)) != RET_SERIAL_OK)
   {
-    fprintf(stderr, "open of device %s has failed.\n", argv[1]);
+    fprintf(stderr, "open of device %s has failed.\n", device);
     goto EXIT;
   }
  
+  PROBE1(command_entry, cmd_table[cmd].cmd_name);
   rc = cmd_table[cmd].cmd_fct(hdl, argc - 3, &argv[3]);
+  PROBE2(command_return, cmd_table[cmd].cmd_name, rc);
   if (rc != RET_OK)
   {
     rc = cmd_table[cmd].cmd_rc;
@@ -92,6 +229,12 @@ int main(int argc, char **argv)
   close_serial(hdl);
 
 EXIT:
+  print_profile();
+  if (get_option("profile") != NULL)
+  {
+    print_frame_cache_stats(stderr);
+  }
+  close_frame_cache();
   return rc;
 }
 
@@ -119,17 +262,85 @@ static int find_command(int nargs, char *command)
 }
 
 
+static int find_tool(int nargs, char *tool)
+{
+  int i;
+
+  for (i = 1; i < (sizeof(tool_table) / sizeof(TOOL)); i++)
+  {
+    if ((strcmp(tool_table[i].tool_name, tool) == 0) &&
+        (tool_table[i].tool_nargs == nargs))
+    {
+      return (i);
+    }
+  }
+
+  return (TOOL_NOMATCH);
+}
+
+
 static void print_usage(void)
 {
   fprintf(stderr, "Usage: mmm8x8 <serial device> firmwareversion\n");
   fprintf(stderr, "       mmm8x8 <serial device> displaytext <text>\n");
   fprintf(stderr, "       mmm8x8 <serial device> storetext <text>\n");
+  fprintf(stderr, "       mmm8x8 <serial device> displaytextfile "
+                  "<textfile | ->\n");
+  fprintf(stderr, "       mmm8x8 <serial device> storetextfile "
+                  "<textfile | ->\n");
   fprintf(stderr, "       mmm8x8 <serial device> settextspeed "
                   "<speed: 0-255>\n");
   fprintf(stderr, "       mmm8x8 <serial device> displaypattern <inputfile>\n");
-  fprintf(stderr, "       mmm8x8 <serial device> storepattern <inputfile>\n");
+  fprintf(stderr, "       mmm8x8 <serial device> storepattern <inputfile> "
+                  "[--resume] [--checkpoint=<path>]\n");
   fprintf(stderr, "       mmm8x8 <serial device> setnormalmode\n");
   fprintf(stderr, "       mmm8x8 <serial device> settextmode\n");
   fprintf(stderr, "       mmm8x8 <serial device> setpatternmode\n");
   fprintf(stderr, "       mmm8x8 <serial device> factoryreset\n");
+  fprintf(stderr, "       mmm8x8 <serial device> displaygrayscale "
+                  "<inputfile> [--duration=<s>]\n");
+  fprintf(stderr, "       mmm8x8 <serial device> storegenerated "
+                  "<expression> <frames>\n");
+  fprintf(stderr, "       mmm8x8 <serial device> streamgenerated "
+                  "<expression> <frames> [--interval=<ms>]\n");
+  fprintf(stderr, "       mmm8x8 <serial device> serve <fifo | ->\n");
+  fprintf(stderr, "       mmm8x8 <serial device> watch <directory> "
+                  "[--debounce=<ms>]\n");
+  fprintf(stderr, "       mmm8x8 <serial device> play <inputfile> "
+                  "[--frame=<ms>] [--mode=auto|store|stream|hybrid]\n"
+                  "              [--rate=<fps>] [--capacity=<n>] "
+                  "[--repeat=<n>] [--library=<library>]\n");
+  fprintf(stderr, "       mmm8x8 sync <manifest> [--jobs=<n>] "
+                  "[--hublimit=<n>] [--retries=<n>]\n");
+  fprintf(stderr, "       mmm8x8 fanout <display | store> <inputfile> "
+                  "<port,port,...> [--interval=<ms>] [--repeat=<n>] "
+                  "[--timeout=<ms>]\n");
+  fprintf(stderr, "       mmm8x8 syncstart <port,port,...> "
+                  "[--lead=<ms>] [--burst]\n");
+  fprintf(stderr, "       mmm8x8 framebuffer <name> <port,port,...> "
+                  "[--poll=<ms>] [--timeout=<ms>]\n");
+  fprintf(stderr, "       mmm8x8 fbwrite <name> <slot> <expression> "
+                  "[--op=set|or|xor|clear]\n");
+  fprintf(stderr, "       mmm8x8 library build <directory> <library> "
+                  "[--jobs=<n>]\n");
+  fprintf(stderr, "       mmm8x8 library cost <library> [--frame=<ms>] "
+                  "[--jobs=<n>]\n");
+  fprintf(stderr, "       mmm8x8 linkbench <serial device> [--frames=<n>] "
+                  "[--results=<path>]\n");
+  fprintf(stderr, "       mmm8x8 import <images | -> <outputfile | -> "
+                  "[--threshold=<0-255>] [--dither] [--invert]\n"
+                  "              [--tile | --at=<x>,<y>] [--jobs=<n>]\n");
+  fprintf(stderr, "       mmm8x8 generate <expression> <frames>\n");
+  fprintf(stderr, "       mmm8x8 discover [--refresh] [--maxage=<s>] "
+                  "[--timeout=<ms>] [--ports=<globs>] [--cache=<path>]\n");
+  fprintf(stderr, "       <serial device> may be \"auto\" for the first "
+                  "discovered MMM8x8\n");
+  fprintf(stderr, "       --dry-run with a device command counts the frames "
+                  "instead of sending them\n");
+  fprintf(stderr, "       --framecache=<path> keeps the encoded display "
+                  "frames, --framecachesize=<n> of them\n");
+  fprintf(stderr, "       --profile prints the time spent in port setup, "
+                  "parse, encode, write and wait-for-ack\n");
+  fprintf(stderr, "       -- ends the options, for arguments starting with "
+                  "\"--\" such as a text\n");
 }
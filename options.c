@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OPTIONS_SRC 1
+#include <options.h>
+#undef OPTIONS_SRC
+
+#define MAX_OPTIONS (16)
+#define OPTION_PREFIX "--"
+
+/* the options some command reads, any other one is most likely a typo */
+static char *known_options[] =
+{
+  "at", "batch", "burst", "cache", "capacity", "checkpoint", "debounce",
+  "dither", "dry-run", "duration", "frame", "framecache", "framecachesize",
+  "frames", "hublimit", "interval", "invert", "jobs", "lead", "library",
+  "maxage", "mode", "op", "poll", "ports", "profile", "rate", "refresh",
+  "repeat", "reps", "results", "resume", "retries", "seed", "threshold",
+  "tile", "timeout", "warmup",
+};
+
+static char *options[MAX_OPTIONS];
+static int noptions;
+
+static int is_known_option(char *option);
+
+
+/*
+ * Removes all "--name[=value]" arguments from argv and remembers them, so
+ * that commands only see their positional arguments. A bare "--" ends the
+ * option processing, e.g. for a text starting with "--". An unknown name
+ * is an error, a typo such as --dryrun must not let the command run.
+ */
+int parse_options(int *argc, char **argv)
+{
+  int rc;
+  int i;
+  int n;
+
+  n = 1;
+  for (i = 1; i < *argc; i++)
+  {
+    if (strcmp(argv[i], OPTION_PREFIX) == 0)
+    {
+      for (i++; i < *argc; i++)
+      {
+        argv[n++] = argv[i];
+      }
+      break;
+    }
+
+    if (strncmp(argv[i], OPTION_PREFIX, strlen(OPTION_PREFIX)) == 0)
+    {
+      if (noptions == MAX_OPTIONS)
+      {
+        rc = RET_OPTIONS_ERR_COUNT;
+        goto EXIT;
+      }
+      if (!is_known_option(argv[i] + strlen(OPTION_PREFIX)))
+      {
+        fprintf(stderr, "unknown option %s.\n", argv[i]);
+        rc = RET_OPTIONS_ERR_UNKNOWN;
+        goto EXIT;
+      }
+      options[noptions++] = argv[i] + strlen(OPTION_PREFIX);
+    }
+    else
+    {
+      argv[n++] = argv[i];
+    }
+  }
+  *argc = n;
+  argv[n] = NULL;
+
+  rc = RET_OPTIONS_OK;
+
+EXIT:
+  return rc;
+}
+
+
+/* returns the value of option name, "" if it has none, NULL if not given */
+char *get_option(char *name)
+{
+  int i;
+  int len;
+
+  len = strlen(name);
+  for (i = 0; i < noptions; i++)
+  {
+    if (strncmp(options[i], name, len) == 0)
+    {
+      if (options[i][len] == '\0')
+      {
+        return "";
+      }
+      if (options[i][len] == '=')
+      {
+        return options[i] + len + 1;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+
+int get_int_option(char *name, int defval)
+{
+  char *value;
+
+  value = get_option(name);
+  if ((value == NULL) || (*value == '\0'))
+  {
+    return defval;
+  }
+
+  return atoi(value);
+}
+
+
+static int is_known_option(char *option)
+{
+  int i;
+  int len;
+
+  len = strcspn(option, "=");
+  for (i = 0; i < (sizeof(known_options) / sizeof(char *)); i++)
+  {
+    if ((strncmp(known_options[i], option, len) == 0) &&
+        (known_options[i][len] == '\0'))
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
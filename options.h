@@ -0,0 +1,20 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#define RET_OPTIONS_OK          (0)
+#define RET_OPTIONS_ERR_COUNT   (1)
+#define RET_OPTIONS_ERR_UNKNOWN (2)
+
+#if OPTIONS_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int parse_options(int *argc, char **argv);
+EXTERN char *get_option(char *name);
+EXTERN int get_int_option(char *name, int defval);
+
+#undef EXTERN
+
+#endif
@@ -1,10 +1,17 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <profile.h>
 
 #define PATTERN_SRC 1
 #include <pattern.h>
 #undef PATTERN_SRC
 
+#define MAX_LINE      (1024)
+#define BITS_PER_LINE (8)
+#define BIT_SET_CHAR  'x'
+
 int open_patternfile(char *path, FILE **handle)
 {
   int rc;
@@ -24,14 +31,10 @@ EXIT:
 
 int read_patternfile(FILE *handle, unsigned char *linevalue)
 {
-#define MAX_LINE (1024)
   int rc;
   int i;
   char buf[MAX_LINE];
 
-#define BITS_PER_LINE (8)
-#define BIT_SET_CHAR 'x'
-
   if (fgets(buf, MAX_LINE, handle) == NULL)
   {
     rc = RET_PATTERN_ERR_READ;
@@ -55,6 +58,47 @@ EXIT:
 }
 
 
+int read_one_pattern(FILE *handle, unsigned char *pattern)
+{
+  int rc;
+  int lines;
+  int columns;
+  unsigned char linepattern;
+  unsigned long long start;
+
+  PROBE(read_one_pattern_entry);
+  start = begin_phase();
+
+  for (lines = 0; lines  < LINES_PER_PATTERN; lines++)
+  {
+    pattern[lines] = 0;
+  }
+
+  for (lines = 0; lines < LINES_PER_PATTERN; lines++)
+  {
+    if ((rc = read_patternfile(handle, &linepattern)) != RET_PATTERN_OK)
+    {
+      goto EXIT;
+    }
+
+    for (columns = 0; columns < COLUMNS_PER_PATTERN; columns++)
+    {
+      if (linepattern & (1 << (COLUMNS_PER_PATTERN - columns - 1))) 
+      {
+        pattern[columns] = pattern[columns] | (1 << lines);
+      }
+    }
+  }
+  
+  rc = RET_PATTERN_OK;
+
+EXIT:
+  end_phase(PHASE_PARSE, start);
+  PROBE1(read_one_pattern_return, rc);
+  return rc;
+}
+
+
 int close_patternfile(FILE *handle)
 {
   int rc;
@@ -70,3 +114,79 @@ int close_patternfile(FILE *handle)
 EXIT:
   return rc;
 }
+
+
+/*
+ * Checks a pattern file strictly, unlike read_patternfile(): patterns of
+ * exactly LINES_PER_PATTERN lines of at most BITS_PER_LINE 'x' and '-'
+ * (missing ones are off), separated by one empty line, nothing else but
+ * empty lines at the end. On success count is the no of patterns,
+ * otherwise badline is the first offending line.
+ */
+int validate_patternfile(FILE *handle, int *count, int *badline)
+{
+  int rc;
+  char buf[MAX_LINE];
+  int lineno;
+  int line;                     /* lines of the current pattern, -1 if none */
+  int blank;                    /* empty lines since the last pattern */
+  size_t len;
+
+  *count = 0;
+  *badline = 0;
+  lineno = 0;
+  line = -1;
+  blank = 0;
+  while (fgets(buf, MAX_LINE, handle) != NULL)
+  {
+    lineno++;
+    len = strcspn(buf, "\r\n");
+    buf[len] = '\0';
+
+    if (len == 0)
+    {
+      if ((line != -1) && (line != LINES_PER_PATTERN))
+      {
+        goto FORMAT_EXIT;
+      }
+      line = -1;
+      blank++;
+      continue;
+    }
+
+    if ((len > BITS_PER_LINE) || (strspn(buf, "x-") != len) ||
+        (line == LINES_PER_PATTERN))
+    {
+      goto FORMAT_EXIT;
+    }
+
+    if (line == -1)
+    {
+      /* the first pattern starts the file, the others follow one space */
+      if (blank != ((*count == 0) ? 0 : 1))
+      {
+        goto FORMAT_EXIT;
+      }
+      (*count)++;
+      line = 0;
+      blank = 0;
+    }
+    line++;
+  }
+
+  if ((*count == 0) || ((line != -1) && (line != LINES_PER_PATTERN)))
+  {
+    lineno++;
+    goto FORMAT_EXIT;
+  }
+
+  rc = RET_PATTERN_OK;
+  goto EXIT;
+
+FORMAT_EXIT:
+  *badline = lineno;
+  rc = RET_PATTERN_ERR_FORMAT;
+
+EXIT:
+  return rc;
+}
@@ -5,6 +5,10 @@
 #define RET_PATTERN_ERR_OPEN    (1)
 #define RET_PATTERN_ERR_CLOSE   (2)
 #define RET_PATTERN_ERR_READ    (3)
+#define RET_PATTERN_ERR_FORMAT  (4)
+
+#define LINES_PER_PATTERN   (8)
+#define COLUMNS_PER_PATTERN (8)
 
 #if PATTERN_SRC
 # define EXTERN 
@@ -14,7 +18,9 @@
 
 EXTERN int open_patternfile(char *path, FILE **handle);
 EXTERN int read_patternfile(FILE *handle, unsigned char *linevalue);
+EXTERN int read_one_pattern(FILE *handle, unsigned char *pattern);
 EXTERN int close_patternfile(FILE *handle);
+EXTERN int validate_patternfile(FILE *handle, int *count, int *badline);
 
 #undef EXTERN
 
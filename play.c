@@ -0,0 +1,531 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <serial.h>
+#include <command.h>
+#include <pattern.h>
+#include <crc16.h>
+#include <frame.h>
+#include <checkpoint.h>
+#include <upload.h>
+#include <options.h>
+#include <timing.h>
+#include <library.h>
+
+#define PLAY_SRC 1
+#include <play.h>
+#undef PLAY_SRC
+
+#include <cmddesc.h>
+
+#define DEFAULT_FRAME_MS (100)
+#define PROBE_FRAMES     (5)
+
+/* a stream may use 80 % of the link, the rest absorbs jitter */
+#define STREAMABLE(rtt, period) ((rtt) * 5 <= (period) * 4)
+
+/* a store frame carries one byte more than a display frame */
+#define STORE_RTT(rtt) ((rtt) + (rtt) / 8)
+
+#define DISPLAY_FRAME_LEN FRAME_ENCODED_LEN(CMD_NPARAM(CMD_DISPLAYPATTERN))
+#define STORE_FRAME_LEN   FRAME_ENCODED_LEN(CMD_NPARAM(CMD_STORENEXTPATTERN))
+
+static char *mode_names[] = { "store", "stream", "hybrid" };
+
+static int load_animation(char *name, unsigned char **patterns, int *count);
+static int parse_mode(char *mode);
+static int measure_rtt(SERHDL hdl, unsigned char *pattern,
+                       unsigned long long *rtt);
+static int store_animation(SERHDL hdl, unsigned char *patterns, PLAN *plan);
+static int stream_animation(SERHDL hdl, unsigned char *patterns, PLAN *plan,
+                            int repeat);
+static int exchange(SERHDL hdl, unsigned char *frame, int framelen);
+
+
+/*
+ * Chooses how to play npatterns frames of period_us each:
+ *   store  if the period is on the 100 ms grid of the module and the
+ *          animation fits its capacity, the module then keeps the time,
+ *   stream if the link carries a 'D' per period, timing is the host's,
+ *   hybrid if it is on the grid but too long to store: the head is
+ *          streamed while as much of the tail as the link has time for
+ *          is stored, then pattern mode plays (and repeats) the tail.
+ * A stream the link cannot carry in time still plays, dropping frames.
+ * Returns RET_PLAY_ERR_PLAN if the requested mode is not possible.
+ */
+int plan_playback(int npatterns, unsigned long long period_us,
+                  unsigned long long rtt_us, int capacity, int mode,
+                  PLAN *plan)
+{
+  int grid;
+  int requested;
+  unsigned long long spare;
+  unsigned long long nstored;
+
+  memset(plan, 0, sizeof(PLAN));
+  plan->npatterns = npatterns;
+  plan->period_us = period_us;
+  plan->rtt_us = rtt_us;
+  plan->realtime = STREAMABLE(rtt_us, period_us);
+
+  grid = ((period_us % DEVICE_TICK_US) == 0) &&
+         (period_us / DEVICE_TICK_US >= 1) &&
+         (period_us / DEVICE_TICK_US <= MAX_DURATION);
+
+  requested = mode;
+  if (mode == PLAY_AUTO)
+  {
+    if (grid && (npatterns <= capacity))
+    {
+      mode = PLAY_STORE;
+    }
+    else if (grid && plan->realtime && (npatterns > 1))
+    {
+      mode = PLAY_HYBRID;
+    }
+    else
+    {
+      mode = PLAY_STREAM;
+    }
+  }
+
+  if ((mode != PLAY_STREAM) && !grid)
+  {
+    return RET_PLAY_ERR_PLAN;
+  }
+
+  plan->mode = mode;
+  plan->nstreamed = npatterns;
+  if (mode == PLAY_STORE)
+  {
+    plan->nstreamed = 0;
+    plan->nstored = npatterns;
+  }
+  else if (mode == PLAY_HYBRID)
+  {
+    /*
+     * the head of n - s frames leaves n - s gaps of period - rtt, which
+     * have to take the s store round trips of the tail
+     */
+    spare = (period_us > rtt_us) ? period_us - rtt_us : 0;
+    nstored = npatterns * spare / (STORE_RTT(rtt_us) + spare);
+    if (nstored > capacity)
+    {
+      nstored = capacity;
+    }
+    if (nstored >= npatterns)
+    {
+      nstored = npatterns - 1;
+    }
+    if (nstored > 0)
+    {
+      plan->nstored = nstored;
+      plan->nstreamed = npatterns - nstored;
+    }
+    else if (requested == PLAY_AUTO)
+    {
+      plan->mode = PLAY_STREAM;
+    }
+    else
+    {
+      return RET_PLAY_ERR_PLAN;
+    }
+  }
+
+  return RET_PLAY_OK;
+}
+
+
+/*
+ * play <inputfile>: plays an animation at --frame ms per pattern the way
+ * plan_playback() finds best, or as --mode says. The link is measured
+ * with a few 'D' unless --rate gives the 'D' per second it carries.
+ * With --library the input is the name of an animation in that library.
+ */
+int play_animation(SERHDL hdl, int myargc, char **myargv)
+{
+  int rc;
+  unsigned char *patterns;
+  int npatterns;
+  int mode;
+  int rate;
+  int repeat;
+  int capacity;
+  unsigned long long period;
+  unsigned long long rtt;
+  PLAN plan;
+
+  if ((mode = parse_mode(get_option("mode"))) == PLAY_INVALID)
+  {
+    fprintf(stderr, "--mode must be auto, store, stream or hybrid.\n");
+    rc = RET_PLAY_ERR_PLAN;
+    goto EXIT;
+  }
+  if (get_int_option("frame", DEFAULT_FRAME_MS) < 1)
+  {
+    fprintf(stderr, "--frame must be 1 ms or more.\n");
+    rc = RET_PLAY_ERR_PLAN;
+    goto EXIT;
+  }
+  period = get_int_option("frame", DEFAULT_FRAME_MS) * 1000ULL;
+  rate = get_int_option("rate", 0);
+  repeat = get_int_option("repeat", 1);
+
+  if ((rc = load_animation(myargv[0], &patterns, &npatterns)) != RET_PLAY_OK)
+  {
+    goto EXIT;
+  }
+
+  trace_responses(0);
+  if (rate > 0)
+  {
+    /* at least 1 us like a measured one, the plan divides by it */
+    rtt = (rate < 1000000) ? 1000000ULL / rate : 1;
+  }
+  else if ((rc = measure_rtt(hdl, patterns, &rtt)) != RET_COMMAND_OK)
+  {
+    fprintf(stderr, "measuring the link has failed.\n");
+    rc = RET_PLAY_ERR_DEVICE;
+    goto FREE_EXIT;
+  }
+
+  capacity = get_int_option("capacity", DEFAULT_CAPACITY);
+  if ((rc = plan_playback(npatterns, period, rtt, capacity, mode, &plan))
+      != RET_PLAY_OK)
+  {
+    fprintf(stderr, "%s playback needs a frame time of a multiple of 100 ms "
+                    "up to 25.5 s.\n", mode_names[mode]);
+    goto FREE_EXIT;
+  }
+
+  /* a hybrid ends in the stored tail, a repeated animation is streamed */
+  if ((plan.mode == PLAY_HYBRID) && (mode == PLAY_AUTO) && (repeat != 1))
+  {
+    plan_playback(npatterns, period, rtt, capacity, PLAY_STREAM, &plan);
+  }
+
+  printf("plan: %s, %d patterns of %.1f ms, link %.1f ms per 'D' "
+         "(%.0f fps)%s\n", mode_names[plan.mode], npatterns, period / 1000.0,
+         rtt / 1000.0, 1000000.0 / rtt,
+         (plan.nstreamed > 0) && !plan.realtime ?
+         ", too slow, frames will be dropped" : "");
+  if (plan.mode == PLAY_HYBRID)
+  {
+    printf("      %d streamed, last %d stored\n", plan.nstreamed,
+           plan.nstored);
+  }
+
+  if (plan.mode == PLAY_STORE)
+  {
+    rc = store_animation(hdl, patterns, &plan);
+  }
+  else
+  {
+    rc = stream_animation(hdl, patterns, &plan,
+                          (plan.mode == PLAY_HYBRID) ? 1 : repeat);
+  }
+  if (rc != RET_COMMAND_OK)
+  {
+    rc = RET_PLAY_ERR_DEVICE;
+  }
+
+FREE_EXIT:
+  free(patterns);
+
+EXIT:
+  return rc;
+}
+
+
+static int load_animation(char *name, unsigned char **patterns, int *count)
+{
+  int rc;
+  char *path;
+  LIBRARY lib;
+  LIB_ANIM *anim;
+  int i;
+
+  if ((path = get_option("library")) == NULL)
+  {
+    return (load_patternfile(name, patterns, count) == RET_SOURCE_OK) ?
+           RET_PLAY_OK : RET_PLAY_ERR_INPUT;
+  }
+
+  if (open_library(path, &lib) != RET_LIBRARY_OK)
+  {
+    fprintf(stderr, "open of library %s has failed.\n", path);
+    rc = RET_PLAY_ERR_INPUT;
+    goto EXIT;
+  }
+
+  if (((anim = find_animation(&lib, name)) == NULL) || (anim->nrefs == 0))
+  {
+    fprintf(stderr, "animation %s is not in library %s.\n", name, path);
+    rc = RET_PLAY_ERR_INPUT;
+    goto CLOSE_EXIT;
+  }
+
+  if ((*patterns = malloc(anim->nrefs * LINES_PER_PATTERN)) == NULL)
+  {
+    rc = RET_PLAY_ERR_INPUT;
+    goto CLOSE_EXIT;
+  }
+  for (i = 0; i < anim->nrefs; i++)
+  {
+    get_lib_pattern(&lib, anim, i, *patterns + i * LINES_PER_PATTERN);
+  }
+  *count = anim->nrefs;
+
+  rc = RET_PLAY_OK;
+
+CLOSE_EXIT:
+  close_library(&lib);
+
+EXIT:
+  return rc;
+}
+
+
+static int parse_mode(char *mode)
+{
+  int i;
+
+  if ((mode == NULL) || (strcmp(mode, "auto") == 0))
+  {
+    return PLAY_AUTO;
+  }
+  for (i = 0; i < sizeof(mode_names) / sizeof(mode_names[0]); i++)
+  {
+    if (strcmp(mode, mode_names[i]) == 0)
+    {
+      return i;
+    }
+  }
+
+  return PLAY_INVALID;
+}
+
+
+/* slowest of a few round trips of 'D' with the first pattern */
+static int measure_rtt(SERHDL hdl, unsigned char *pattern,
+                       unsigned long long *rtt)
+{
+  int rc;
+  unsigned char frame[DISPLAY_FRAME_LEN];
+  unsigned char params[CMD_NPARAM(CMD_DISPLAYPATTERN)];
+  int framelen;
+  unsigned long long start;
+  unsigned long long elapsed;
+  int i;
+
+  memcpy(params, pattern, sizeof(params));
+  framelen = ENCODE_CMD(CMD_DISPLAYPATTERN, params, frame);
+
+  *rtt = 0;
+  for (i = 0; i < PROBE_FRAMES; i++)
+  {
+    start = get_time_us();
+    if ((rc = exchange(hdl, frame, framelen)) != RET_COMMAND_OK)
+    {
+      goto EXIT;
+    }
+    elapsed = get_time_us() - start;
+    if (elapsed > *rtt)
+    {
+      *rtt = elapsed;
+    }
+  }
+
+  /* guards the divisions by it */
+  if (*rtt == 0)
+  {
+    *rtt = 1;
+  }
+
+  rc = RET_COMMAND_OK;
+
+EXIT:
+  return rc;
+}
+
+
+static int store_animation(SERHDL hdl, unsigned char *patterns, PLAN *plan)
+{
+  int rc;
+  MEMORY_SOURCE source;
+  unsigned long long start;
+
+  source.patterns = patterns;
+  source.count = plan->nstored;
+  source.next = 0;
+
+  start = get_time_us();
+  if ((rc = upload_patterns(hdl, next_memory_pattern, &source,
+                            plan->period_us / DEVICE_TICK_US, 0, NULL))
+      != RET_COMMAND_OK)
+  {
+    goto EXIT;
+  }
+
+  rc = set_patternmode(hdl, 0, NULL);
+  printf("stored %d patterns in %.1f ms\n", plan->nstored,
+         (get_time_us() - start) / 1000.0);
+
+EXIT:
+  return rc;
+}
+
+
+/*
+ * Sends the head with 'D' at start + i * period. All frames are encoded
+ * before the first one is due, and the deadlines are absolute, so neither
+ * encoding nor a late wake-up moves the frames after it. A frame whose
+ * successor is already due is dropped. A hybrid stores its tail in the
+ * gaps between the frames and switches to pattern mode at the end.
+ */
+static int stream_animation(SERHDL hdl, unsigned char *patterns, PLAN *plan,
+                            int repeat)
+{
+  int rc;
+  unsigned char *frames;
+  unsigned char *stored;
+  int *framelens;
+  int *storedlens;
+  unsigned char store[CMD_NPARAM(CMD_STORENEXTPATTERN)];
+  unsigned long long start;
+  unsigned long long due;
+  unsigned long long now;
+  unsigned long long late;
+  unsigned long long maxlate;
+  unsigned long long sumlate;
+  int total;
+  int sent;
+  int dropped;
+  int nextstore;
+  int i;
+
+  frames = malloc(plan->nstreamed * DISPLAY_FRAME_LEN + 1);
+  framelens = malloc((plan->nstreamed + 1) * sizeof(int));
+  stored = malloc(plan->nstored * STORE_FRAME_LEN + 1);
+  storedlens = malloc((plan->nstored + 1) * sizeof(int));
+  if ((frames == NULL) || (framelens == NULL) || (stored == NULL) ||
+      (storedlens == NULL))
+  {
+    rc = RET_COMMAND_ERR_WRITE;
+    goto FREE_EXIT;
+  }
+
+  /* encoded once for all repeats, through the cache it would evict it */
+  for (i = 0; i < plan->nstreamed; i++)
+  {
+    framelens[i] = ENCODE_CMD(CMD_DISPLAYPATTERN,
+                              patterns + i * LINES_PER_PATTERN,
+                              frames + i * DISPLAY_FRAME_LEN);
+  }
+  for (i = 0; i < plan->nstored; i++)
+  {
+    memcpy(store, patterns + (plan->nstreamed + i) * LINES_PER_PATTERN,
+           LINES_PER_PATTERN);
+    store[LINES_PER_PATTERN] = plan->period_us / DEVICE_TICK_US;
+    storedlens[i] = (i == 0) ?
+      ENCODE_CMD(CMD_STOREFIRSTPATTERN, store, stored) :
+      ENCODE_CMD(CMD_STORENEXTPATTERN, store, stored + i * STORE_FRAME_LEN);
+  }
+
+  rc = RET_COMMAND_OK;
+  total = plan->nstreamed * repeat;
+  sent = 0;
+  dropped = 0;
+  maxlate = 0;
+  sumlate = 0;
+  nextstore = 0;
+  start = get_time_us();
+  for (i = 0; i < total; i++)
+  {
+    due = start + i * plan->period_us;
+    if ((i + 1 < total) && (get_time_us() >= due + plan->period_us))
+    {
+      dropped++;
+      continue;
+    }
+
+    sleep_until_us(due);
+    now = get_time_us();
+    late = (now > due) ? now - due : 0;
+    sumlate += late;
+    if (late > maxlate)
+    {
+      maxlate = late;
+    }
+
+    if ((rc = exchange(hdl, frames + (i % plan->nstreamed) * DISPLAY_FRAME_LEN,
+                       framelens[i % plan->nstreamed])) != RET_COMMAND_OK)
+    {
+      fprintf(stderr, "displaying pattern %d has failed.\n", i);
+      goto FREE_EXIT;
+    }
+    sent++;
+
+    /* fill the gap up to the next frame with the tail */
+    while ((nextstore < plan->nstored) &&
+           (get_time_us() + STORE_RTT(plan->rtt_us) < due + plan->period_us))
+    {
+      if ((rc = exchange(hdl, stored + nextstore * STORE_FRAME_LEN,
+                         storedlens[nextstore])) != RET_COMMAND_OK)
+      {
+        fprintf(stderr, "storing pattern %d has failed.\n",
+                plan->nstreamed + nextstore);
+        goto FREE_EXIT;
+      }
+      nextstore++;
+    }
+  }
+
+  if (plan->nstored > 0)
+  {
+    /* a tail the gaps could not take, late but complete */
+    for (; nextstore < plan->nstored; nextstore++)
+    {
+      if ((rc = exchange(hdl, stored + nextstore * STORE_FRAME_LEN,
+                         storedlens[nextstore])) != RET_COMMAND_OK)
+      {
+        fprintf(stderr, "storing pattern %d has failed.\n",
+                plan->nstreamed + nextstore);
+        goto FREE_EXIT;
+      }
+    }
+    sleep_until_us(start + total * plan->period_us);
+    rc = set_patternmode(hdl, 0, NULL);
+  }
+
+  printf("streamed %d frames, %d dropped, late by %.2f ms mean, "
+         "%.2f ms max\n", sent, dropped,
+         sent ? sumlate / 1000.0 / sent : 0.0, maxlate / 1000.0);
+
+FREE_EXIT:
+  free(storedlens);
+  free(stored);
+  free(framelens);
+  free(frames);
+
+  return rc;
+}
+
+
+/* sends an encoded frame and waits for its 6 byte response */
+static int exchange(SERHDL hdl, unsigned char *frame, int framelen)
+{
+  int rc;
+  unsigned char response[CMD_RSPLEN(CMD_DISPLAYPATTERN)];
+
+  if ((rc = send_frame(hdl, frame, framelen)) != RET_COMMAND_OK)
+  {
+    goto EXIT;
+  }
+  rc = RECEIVE_RSP(hdl, CMD_DISPLAYPATTERN, response);
+
+EXIT:
+  return rc;
+}
+
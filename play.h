@@ -0,0 +1,42 @@
+#ifndef PLAY_H
+#define PLAY_H
+
+#define PLAY_AUTO    (-1)
+#define PLAY_STORE   (0)        /* device memory, device timing */
+#define PLAY_STREAM  (1)        /* one 'D' per frame, host timing */
+#define PLAY_HYBRID  (2)        /* head streamed, tail stored meanwhile */
+#define PLAY_INVALID (-2)       /* --mode is none of the above */
+
+#define DEVICE_TICK_US   (100000ULL)    /* duration unit of stored patterns */
+#define MAX_DURATION     (255)
+#define DEFAULT_CAPACITY (256)          /* patterns the module can store */
+
+#define RET_PLAY_OK         (0)
+#define RET_PLAY_ERR_INPUT  (1)
+#define RET_PLAY_ERR_PLAN   (2)
+#define RET_PLAY_ERR_DEVICE (3)
+
+typedef struct {
+  int                mode;
+  int                npatterns;
+  int                nstreamed;         /* head sent with 'D' */
+  int                nstored;           /* tail stored with 'G'/'I' */
+  unsigned long long period_us;
+  unsigned long long rtt_us;            /* of one 'D' round trip */
+  int                realtime;          /* all streamed frames in time */
+} PLAN;
+
+#if PLAY_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int plan_playback(int npatterns, unsigned long long period_us,
+                         unsigned long long rtt_us, int capacity, int mode,
+                         PLAN *plan);
+EXTERN int play_animation(SERHDL hdl, int myargc, char **myargv);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#if WIN
+#  include <windows.h>
+#endif
+
+#define POOL_SRC 1
+#include <pool.h>
+#undef POOL_SRC
+
+#define POOL_IDLE_US  (1000)    /* sleep when there is nothing to steal */
+#define POOL_AGAIN_US (10000)   /* sleep after a job asked to be requeued */
+
+/* double ended queue of job numbers, owner works at the bottom */
+typedef struct {
+  pthread_mutex_t lock;
+  int            *jobs;       /* circular, njobs entries */
+  int             top;        /* thieves take from here */
+  int             count;
+} DEQUE;
+
+typedef struct {
+  int         nworkers;
+  int         njobs;
+  POOL_FCT    fct;
+  void       *ctx;
+  DEQUE      *deques;
+  atomic_int  remaining;      /* jobs not yet done */
+} POOL;
+
+typedef struct {
+  POOL *pool;
+  int   id;
+} WORKER;
+
+static void *work(void *arg);
+static int pop_bottom(POOL *pool, DEQUE *deque, int *job);
+static int steal_top(POOL *pool, DEQUE *deque, int *job);
+static void push_top(POOL *pool, DEQUE *deque, int job);
+static void push_bottom(POOL *pool, DEQUE *deque, int job);
+
+
+/*
+ * Runs fct for the jobs 0 .. njobs-1 on nworkers threads. Every worker owns
+ * a deque of jobs, and a worker whose deque runs empty steals from the
+ * others, so slow jobs do not leave the remaining threads idle.
+ */
+int run_pool(int nworkers, int njobs, POOL_FCT fct, void *ctx)
+{
+  int rc;
+  int i;
+  int started;
+  POOL pool;
+  WORKER *workers;
+  pthread_t *threads;
+
+  if (nworkers > njobs)
+  {
+    nworkers = njobs;
+  }
+  if (nworkers < 1)
+  {
+    nworkers = 1;
+  }
+
+  pool.nworkers = nworkers;
+  pool.njobs = njobs;
+  pool.fct = fct;
+  pool.ctx = ctx;
+  atomic_init(&pool.remaining, njobs);
+
+  pool.deques = calloc(nworkers, sizeof(DEQUE));
+  workers = calloc(nworkers, sizeof(WORKER));
+  threads = calloc(nworkers, sizeof(pthread_t));
+  if ((pool.deques == NULL) || (workers == NULL) || (threads == NULL))
+  {
+    rc = RET_POOL_ERR_MEMORY;
+    goto FREE_EXIT;
+  }
+
+  for (i = 0; i < nworkers; i++)
+  {
+    pool.deques[i].jobs = malloc((njobs + 1) * sizeof(int));
+    if (pool.deques[i].jobs == NULL)
+    {
+      rc = RET_POOL_ERR_MEMORY;
+      goto FREE_EXIT;
+    }
+    pthread_mutex_init(&pool.deques[i].lock, NULL);
+  }
+
+  /* deal the jobs out round robin */
+  for (i = 0; i < njobs; i++)
+  {
+    push_bottom(&pool, &pool.deques[i % nworkers], i);
+  }
+
+  rc = RET_POOL_OK;
+  for (started = 0; started < nworkers; started++)
+  {
+    workers[started].pool = &pool;
+    workers[started].id = started;
+    if (pthread_create(&threads[started], NULL, work, &workers[started]) != 0)
+    {
+      rc = RET_POOL_ERR_THREAD;
+      break;
+    }
+  }
+
+  /* the started workers steal the jobs of the missing ones */
+  if (started == 0)
+  {
+    goto FREE_EXIT;
+  }
+  for (i = 0; i < started; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+  rc = RET_POOL_OK;
+
+FREE_EXIT:
+  if (pool.deques != NULL)
+  {
+    for (i = 0; i < nworkers; i++)
+    {
+      if (pool.deques[i].jobs != NULL)
+      {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+        free(pool.deques[i].jobs);
+      }
+    }
+  }
+  free(pool.deques);
+  free(workers);
+  free(threads);
+
+  return rc;
+}
+
+
+static void *work(void *arg)
+{
+  WORKER *worker;
+  POOL *pool;
+  DEQUE *own;
+  int job;
+  int found;
+  int i;
+
+  worker = (WORKER *) arg;
+  pool = worker->pool;
+  own = &pool->deques[worker->id];
+
+  while (atomic_load(&pool->remaining) > 0)
+  {
+    found = pop_bottom(pool, own, &job);
+    for (i = 1; !found && (i < pool->nworkers); i++)
+    {
+      found = steal_top(pool,
+                        &pool->deques[(worker->id + i) % pool->nworkers],
+                        &job);
+    }
+
+    if (!found)
+    {
+      /* remaining jobs are running elsewhere and may come back */
+      usleep(POOL_IDLE_US);
+      continue;
+    }
+
+    if (pool->fct(pool->ctx, job) == POOL_JOB_AGAIN)
+    {
+      /* to the far end, so other jobs get their turn first */
+      push_top(pool, own, job);
+      usleep(POOL_AGAIN_US);
+    }
+    else
+    {
+      atomic_fetch_sub(&pool->remaining, 1);
+    }
+  }
+
+  return NULL;
+}
+
+
+static int pop_bottom(POOL *pool, DEQUE *deque, int *job)
+{
+  int found;
+
+  pthread_mutex_lock(&deque->lock);
+  found = (deque->count > 0);
+  if (found)
+  {
+    deque->count--;
+    *job = deque->jobs[(deque->top + deque->count) % (pool->njobs + 1)];
+  }
+  pthread_mutex_unlock(&deque->lock);
+
+  return found;
+}
+
+
+static int steal_top(POOL *pool, DEQUE *deque, int *job)
+{
+  int found;
+
+  pthread_mutex_lock(&deque->lock);
+  found = (deque->count > 0);
+  if (found)
+  {
+    *job = deque->jobs[deque->top];
+    deque->top = (deque->top + 1) % (pool->njobs + 1);
+    deque->count--;
+  }
+  pthread_mutex_unlock(&deque->lock);
+
+  return found;
+}
+
+
+static void push_top(POOL *pool, DEQUE *deque, int job)
+{
+  pthread_mutex_lock(&deque->lock);
+  deque->top = (deque->top + pool->njobs) % (pool->njobs + 1);
+  deque->jobs[deque->top] = job;
+  deque->count++;
+  pthread_mutex_unlock(&deque->lock);
+}
+
+
+static void push_bottom(POOL *pool, DEQUE *deque, int job)
+{
+  pthread_mutex_lock(&deque->lock);
+  deque->jobs[(deque->top + deque->count) % (pool->njobs + 1)] = job;
+  deque->count++;
+  pthread_mutex_unlock(&deque->lock);
+}
+
+
+/* no of cores online, the natural no of workers for cpu bound jobs */
+int get_cpu_count(void)
+{
+  int count;
+
+#if LINUX
+  count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+#if WIN
+  SYSTEM_INFO info;
+
+  GetSystemInfo(&info);
+  count = info.dwNumberOfProcessors;
+#endif
+
+  return (count > 0) ? count : 1;
+}
@@ -0,0 +1,25 @@
+#ifndef POOL_H
+#define POOL_H
+
+#define RET_POOL_OK         (0)
+#define RET_POOL_ERR_MEMORY (1)
+#define RET_POOL_ERR_THREAD (2)
+
+/* return values of a job function */
+#define POOL_JOB_DONE  (0)      /* job is finished, successful or not */
+#define POOL_JOB_AGAIN (1)      /* requeue job, e.g. resource busy or retry */
+
+typedef int (*POOL_FCT)(void *ctx, int job);
+
+#if POOL_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int run_pool(int nworkers, int njobs, POOL_FCT fct, void *ctx);
+EXTERN int get_cpu_count(void);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <pthread.h>
+
+#if LINUX
+#  include <sys/resource.h>
+#endif
+
+#if WIN
+#  include <windows.h>
+#endif
+
+#include <timing.h>
+
+#define PROFILE_SRC 1
+#include <profile.h>
+#undef PROFILE_SRC
+
+typedef struct {
+  long               calls;
+  unsigned long long us;
+} PHASE;
+
+static char *phase_names[NPHASES] =
+{
+  "port setup", "parse", "encode", "write", "wait-for-ack"
+};
+
+/* the phases are ended by pool and port threads too */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static PHASE phases[NPHASES];
+static unsigned long long profile_start;
+
+static void get_cpu_us(unsigned long long *user, unsigned long long *sys);
+
+
+void start_profile(void)
+{
+  profile_start = get_time_us();
+}
+
+
+/* 0 while not profiling, so end_phase() knows to do nothing */
+unsigned long long begin_phase(void)
+{
+  return (profile_start != 0) ? get_time_us() : 0;
+}
+
+
+void end_phase(int phase, unsigned long long start)
+{
+  unsigned long long us;
+
+  if (start == 0)
+  {
+    return;
+  }
+
+  us = get_time_us() - start;
+  pthread_mutex_lock(&lock);
+  phases[phase].calls++;
+  phases[phase].us += us;
+  pthread_mutex_unlock(&lock);
+}
+
+
+/*
+ * Phases of several threads overlap, so their sum may exceed the wall
+ * time. user and sys are the CPU time of the whole process: a run mostly
+ * in wait-for-ack is link bound, one in write with much sys time syscall
+ * bound, one in parse and encode CPU bound.
+ */
+void print_profile(void)
+{
+  unsigned long long wall;
+  unsigned long long user;
+  unsigned long long sys;
+  unsigned long long other;
+  int i;
+
+  if (profile_start == 0)
+  {
+    return;
+  }
+
+  wall = get_time_us() - profile_start;
+  get_cpu_us(&user, &sys);
+  other = wall;
+
+  fprintf(stderr, "profile: %.2f ms wall, %.2f ms user, %.2f ms sys\n",
+          wall / 1000.0, user / 1000.0, sys / 1000.0);
+  fprintf(stderr, "%-14s %8s %10s %10s %6s\n", "phase", "calls", "total ms",
+          "mean us", "share");
+  for (i = 0; i < NPHASES; i++)
+  {
+    fprintf(stderr, "%-14s %8ld %10.2f %10.1f %5.1f%%\n", phase_names[i],
+            phases[i].calls, phases[i].us / 1000.0,
+            (phases[i].calls > 0) ? (double) phases[i].us / phases[i].calls :
+                                    0.0,
+            (wall > 0) ? 100.0 * phases[i].us / wall : 0.0);
+    other = (other > phases[i].us) ? other - phases[i].us : 0;
+  }
+  fprintf(stderr, "%-14s %8s %10.2f %10s %5.1f%%\n", "other", "",
+          other / 1000.0, "", (wall > 0) ? 100.0 * other / wall : 0.0);
+}
+
+
+#if LINUX
+
+static void get_cpu_us(unsigned long long *user, unsigned long long *sys)
+{
+  struct rusage usage;
+
+  if (getrusage(RUSAGE_SELF, &usage) == -1)
+  {
+    *user = 0;
+    *sys = 0;
+    return;
+  }
+
+  *user = usage.ru_utime.tv_sec * 1000000ULL + usage.ru_utime.tv_usec;
+  *sys = usage.ru_stime.tv_sec * 1000000ULL + usage.ru_stime.tv_usec;
+}
+
+#endif /* LINUX */
+
+#if WIN
+
+/* FILETIMEs count 100 ns */
+static void get_cpu_us(unsigned long long *user, unsigned long long *sys)
+{
+  FILETIME creation;
+  FILETIME exit;
+  FILETIME kernel;
+  FILETIME usertime;
+
+  if (GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel,
+                      &usertime) == 0)
+  {
+    *user = 0;
+    *sys = 0;
+    return;
+  }
+
+  *user = (((unsigned long long) usertime.dwHighDateTime << 32) |
+           usertime.dwLowDateTime) / 10;
+  *sys = (((unsigned long long) kernel.dwHighDateTime << 32) |
+          kernel.dwLowDateTime) / 10;
+}
+
+#endif /* WIN */
@@ -0,0 +1,50 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/*
+ * Static tracepoints and --profile phase timing.
+ * The PROBE macros become USDT probes of provider mmm8x8 when sys/sdt.h
+ * is there (systemtap-sdt-dev, headers only) and nothing otherwise. A probe
+ * nobody has attached to is a nop in the code, e.g.
+ *   bpftrace -e 'usdt:./mmm8x8:send_command_entry { @[arg0] = count(); }'
+ */
+
+#if LINUX && defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#    include <sys/sdt.h>
+#    define HAVE_SDT 1
+#  endif
+#endif
+
+#if HAVE_SDT
+#  define PROBE(name)             DTRACE_PROBE(mmm8x8, name)
+#  define PROBE1(name, a)         DTRACE_PROBE1(mmm8x8, name, a)
+#  define PROBE2(name, a, b)      DTRACE_PROBE2(mmm8x8, name, a, b)
+#else
+#  define PROBE(name)
+#  define PROBE1(name, a)
+#  define PROBE2(name, a, b)
+#endif
+
+/* phases --profile accounts the time of */
+#define PHASE_SETUP   (0)       /* opening and setting up ports */
+#define PHASE_PARSE   (1)       /* reading patterns from files */
+#define PHASE_ENCODE  (2)       /* building frames */
+#define PHASE_WRITE   (3)       /* write calls, until the driver has them */
+#define PHASE_ACK     (4)       /* waiting for and reading responses */
+#define NPHASES       (5)
+
+#if PROFILE_SRC
+# define EXTERN
+#else
+# define EXTERN extern
+#endif
+
+EXTERN void start_profile(void);
+EXTERN unsigned long long begin_phase(void);
+EXTERN void end_phase(int phase, unsigned long long start);
+EXTERN void print_profile(void);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <sched.h>
+#include <unistd.h>
+
+#define RING_SRC 1
+#include <ring.h>
+#undef RING_SRC
+
+#define RING_SPINS      (64)    /* yields before falling back to sleeping */
+#define RING_BACKOFF_US (100)
+
+static void backoff(int *spins);
+
+
+void init_ring(RING *ring)
+{
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->closed, 0);
+  atomic_init(&ring->cancelled, 0);
+}
+
+
+/*
+ * Producer side: waits until a slot is free (backpressure) and returns it.
+ * Returns NULL if the consumer has cancelled the transfer.
+ */
+RING_SLOT *reserve_ring_slot(RING *ring)
+{
+  unsigned int head;
+  int spins;
+
+  head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  spins = 0;
+  while (head - atomic_load_explicit(&ring->tail, memory_order_acquire)
+         >= RING_SLOTS)
+  {
+    if (atomic_load_explicit(&ring->cancelled, memory_order_relaxed))
+    {
+      return NULL;
+    }
+    backoff(&spins);
+  }
+
+  if (atomic_load_explicit(&ring->cancelled, memory_order_relaxed))
+  {
+    return NULL;
+  }
+
+  return &ring->slot[head & (RING_SLOTS - 1)];
+}
+
+
+void commit_ring_slot(RING *ring)
+{
+  atomic_fetch_add_explicit(&ring->head, 1, memory_order_release);
+}
+
+
+void close_ring(RING *ring)
+{
+  atomic_store_explicit(&ring->closed, 1, memory_order_release);
+}
+
+
+/*
+ * Consumer side: waits until a slot is filled and returns it.
+ * Returns NULL once the producer has closed the ring and all slots are
+ * consumed.
+ */
+RING_SLOT *peek_ring_slot(RING *ring)
+{
+  unsigned int tail;
+  int spins;
+
+  tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  spins = 0;
+  while (atomic_load_explicit(&ring->head, memory_order_acquire) == tail)
+  {
+    if (atomic_load_explicit(&ring->closed, memory_order_acquire))
+    {
+      /* head may have moved right before closing */
+      if (atomic_load_explicit(&ring->head, memory_order_acquire) == tail)
+      {
+        return NULL;
+      }
+      break;
+    }
+    backoff(&spins);
+  }
+
+  return &ring->slot[tail & (RING_SLOTS - 1)];
+}
+
+
+void release_ring_slot(RING *ring)
+{
+  atomic_fetch_add_explicit(&ring->tail, 1, memory_order_release);
+}
+
+
+void cancel_ring(RING *ring)
+{
+  atomic_store_explicit(&ring->cancelled, 1, memory_order_relaxed);
+}
+
+
+static void backoff(int *spins)
+{
+  if (*spins < RING_SPINS)
+  {
+    (*spins)++;
+    sched_yield();
+  }
+  else
+  {
+    usleep(RING_BACKOFF_US);
+  }
+}
@@ -0,0 +1,40 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+
+#define RING_SLOTS     (16)     /* must be a power of two */
+#define RING_SLOT_SIZE (32)     /* room for one encoded store frame */
+#define CACHE_LINE     (64)
+
+typedef struct {
+  int           len;                   /* no of valid bytes in data */
+  unsigned char data[RING_SLOT_SIZE];
+} RING_SLOT;
+
+/* bounded single-producer/single-consumer ring, lock-free */
+typedef struct {
+  RING_SLOT    slot[RING_SLOTS];
+  _Alignas(CACHE_LINE) atomic_uint head;   /* written by producer only */
+  _Alignas(CACHE_LINE) atomic_uint tail;   /* written by consumer only */
+  _Alignas(CACHE_LINE) atomic_int  closed; /* producer has no more slots */
+  atomic_int   cancelled;                  /* consumer gave up */
+} RING;
+
+#if RING_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN void init_ring(RING *ring);
+EXTERN RING_SLOT *reserve_ring_slot(RING *ring);
+EXTERN void commit_ring_slot(RING *ring);
+EXTERN void close_ring(RING *ring);
+EXTERN RING_SLOT *peek_ring_slot(RING *ring);
+EXTERN void release_ring_slot(RING *ring);
+EXTERN void cancel_ring(RING *ring);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <serial.h>
+#include <command.h>
+#include <crc16.h>
+#include <frame.h>
+#include <timing.h>
+#include <framecache.h>
+
+#define SCHEDULER_SRC 1
+#include <scheduler.h>
+#undef SCHEDULER_SRC
+
+#include <cmddesc.h>
+
+static char *class_name[SCHED_CLASSES] = { "interactive", "bulk" };
+
+static void *run_scheduler(void *arg);
+static SCHED_ENTRY *next_entry(SCHEDULER *sched, int *class);
+static void drop_group(SCHEDULER *sched, int group);
+static void record_latency(SCHED_STATS *stats, unsigned long long us);
+static unsigned long long percentile(SCHED_STATS *stats, int permille);
+
+
+/*
+ * Starts the thread that owns the device: it always sends the most urgent
+ * queued frame next, so an interactive 'D' waits at most for the one bulk
+ * frame that is on the wire, not for the rest of the upload.
+ */
+int start_scheduler(SCHEDULER *sched, SERHDL hdl)
+{
+  int rc;
+
+  memset(sched, 0, sizeof(SCHEDULER));
+  sched->hdl = hdl;
+  pthread_mutex_init(&sched->lock, NULL);
+  pthread_cond_init(&sched->cond, NULL);
+
+  if (pthread_create(&sched->thread, NULL, run_scheduler, sched) != 0)
+  {
+    rc = RET_SCHED_ERR_THREAD;
+    goto EXIT;
+  }
+
+  rc = RET_SCHED_OK;
+
+EXIT:
+  return rc;
+}
+
+
+/*
+ * Encodes a command and queues it in class, 'D' frames through the frame
+ * cache. A replaceable command takes over the frame of a queued one with
+ * the same letter, which keeps its place and its queueing time.
+ */
+int queue_command(SCHEDULER *sched, int class, char letter, int nparam,
+                  unsigned char *params, int rsplen, int group)
+{
+  int rc;
+  SCHED_ENTRY *entry;
+  SCHED_ENTRY *queued;
+
+  if ((entry = calloc(1, sizeof(SCHED_ENTRY))) == NULL)
+  {
+    rc = RET_SCHED_ERR_MEMORY;
+    goto EXIT;
+  }
+  if ((entry->frame = malloc(FRAME_ENCODED_LEN(nparam))) == NULL)
+  {
+    free(entry);
+    rc = RET_SCHED_ERR_MEMORY;
+    goto EXIT;
+  }
+  if ((letter == CMD_LETTER(CMD_DISPLAYPATTERN)) &&
+      (nparam == CMD_NPARAM(CMD_DISPLAYPATTERN)))
+  {
+    entry->framelen = cached_display_frame(params, entry->frame);
+  }
+  else
+  {
+    entry->framelen = encode_frame(letter, nparam, params, entry->frame);
+  }
+  entry->rsplen = rsplen;
+  entry->letter = letter;
+  entry->replaceable = (class == SCHED_INTERACTIVE);
+  entry->group = group;
+  entry->queued = get_time_us();
+
+  pthread_mutex_lock(&sched->lock);
+
+  if (entry->replaceable)
+  {
+    for (queued = sched->head[class]; queued != NULL; queued = queued->next)
+    {
+      if (queued->replaceable && (queued->letter == letter))
+      {
+        free(queued->frame);
+        queued->frame = entry->frame;
+        queued->framelen = entry->framelen;
+        sched->stats[class].replaced++;
+        free(entry);
+        entry = NULL;
+        break;
+      }
+    }
+  }
+
+  if (entry != NULL)
+  {
+    if (sched->tail[class] == NULL)
+    {
+      sched->head[class] = entry;
+    }
+    else
+    {
+      sched->tail[class]->next = entry;
+    }
+    sched->tail[class] = entry;
+    pthread_cond_signal(&sched->cond);
+  }
+
+  pthread_mutex_unlock(&sched->lock);
+
+  rc = RET_SCHED_OK;
+
+EXIT:
+  return rc;
+}
+
+
+/* sends what is still queued and ends the scheduler thread */
+void stop_scheduler(SCHEDULER *sched)
+{
+  pthread_mutex_lock(&sched->lock);
+  sched->stopping = 1;
+  pthread_cond_signal(&sched->cond);
+  pthread_mutex_unlock(&sched->lock);
+
+  pthread_join(sched->thread, NULL);
+}
+
+
+/* after stop_scheduler(), once the stats are no longer needed */
+void close_scheduler(SCHEDULER *sched)
+{
+  pthread_cond_destroy(&sched->cond);
+  pthread_mutex_destroy(&sched->lock);
+}
+
+
+void print_sched_stats(SCHEDULER *sched, FILE *out)
+{
+  int class;
+  SCHED_STATS *stats;
+
+  pthread_mutex_lock(&sched->lock);
+  fprintf(out, "%-12s %8s %8s %6s %9s %9s %9s %9s\n", "class", "sent",
+          "replaced", "failed", "mean ms", "p50 ms", "p99 ms", "max ms");
+  for (class = 0; class < SCHED_CLASSES; class++)
+  {
+    stats = &sched->stats[class];
+    fprintf(out, "%-12s %8ld %8ld %6ld %9.1f %9llu %9llu %9.1f\n",
+            class_name[class], stats->count, stats->replaced, stats->failed,
+            stats->count ? stats->sum_us / 1000.0 / stats->count : 0.0,
+            percentile(stats, 500), percentile(stats, 990),
+            stats->max_us / 1000.0);
+  }
+  fflush(out);
+  pthread_mutex_unlock(&sched->lock);
+}
+
+
+static void *run_scheduler(void *arg)
+{
+  SCHEDULER *sched;
+  SCHED_ENTRY *entry;
+  unsigned char *response;
+  int class;
+  int rc;
+
+  sched = (SCHEDULER *) arg;
+
+  pthread_mutex_lock(&sched->lock);
+  for (;;)
+  {
+    while (((entry = next_entry(sched, &class)) == NULL) && !sched->stopping)
+    {
+      pthread_cond_wait(&sched->cond, &sched->lock);
+    }
+    if (entry == NULL)
+    {
+      break;
+    }
+    record_latency(&sched->stats[class], get_time_us() - entry->queued);
+    pthread_mutex_unlock(&sched->lock);
+
+    rc = send_frame(sched->hdl, entry->frame, entry->framelen);
+    if ((rc == RET_COMMAND_OK) && (entry->rsplen > 0))
+    {
+      if ((response = malloc(entry->rsplen)) == NULL)
+      {
+        rc = RET_COMMAND_ERR_READ;
+      }
+      else
+      {
+        rc = receive_response(sched->hdl, response, entry->rsplen);
+        free(response);
+      }
+    }
+
+    pthread_mutex_lock(&sched->lock);
+    if (rc != RET_COMMAND_OK)
+    {
+      fprintf(stderr, "command '%c' has failed.\n", entry->letter);
+      sched->stats[class].failed++;
+      if (entry->group != 0)
+      {
+        /* the rest of an upload makes no sense without this frame */
+        drop_group(sched, entry->group);
+      }
+    }
+    free(entry->frame);
+    free(entry);
+  }
+  pthread_mutex_unlock(&sched->lock);
+
+  return NULL;
+}
+
+
+/* dequeues the head of the most urgent non-empty class, lock held */
+static SCHED_ENTRY *next_entry(SCHEDULER *sched, int *class)
+{
+  SCHED_ENTRY *entry;
+
+  for (*class = 0; *class < SCHED_CLASSES; (*class)++)
+  {
+    if ((entry = sched->head[*class]) != NULL)
+    {
+      sched->head[*class] = entry->next;
+      if (sched->head[*class] == NULL)
+      {
+        sched->tail[*class] = NULL;
+      }
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+
+/* removes the queued frames of a failed bulk transfer, lock held */
+static void drop_group(SCHEDULER *sched, int group)
+{
+  SCHED_ENTRY **link;
+  SCHED_ENTRY *entry;
+  int class;
+  int dropped;
+
+  dropped = 0;
+  for (class = 0; class < SCHED_CLASSES; class++)
+  {
+    sched->tail[class] = NULL;
+    link = &sched->head[class];
+    while ((entry = *link) != NULL)
+    {
+      if (entry->group == group)
+      {
+        *link = entry->next;
+        free(entry->frame);
+        free(entry);
+        dropped++;
+      }
+      else
+      {
+        sched->tail[class] = entry;
+        link = &entry->next;
+      }
+    }
+  }
+
+  if (dropped > 0)
+  {
+    fprintf(stderr, "dropped %d queued frames of the failed transfer.\n",
+            dropped);
+  }
+}
+
+
+static void record_latency(SCHED_STATS *stats, unsigned long long us)
+{
+  unsigned long long ms;
+
+  stats->count++;
+  stats->sum_us += us;
+  if (us > stats->max_us)
+  {
+    stats->max_us = us;
+  }
+
+  ms = us / 1000;
+  stats->hist[(ms < SCHED_HIST_MS) ? ms : SCHED_HIST_MS]++;
+}
+
+
+/* upper bound in ms of the permille-th latency */
+static unsigned long long percentile(SCHED_STATS *stats, int permille)
+{
+  long rank;
+  long seen;
+  int ms;
+
+  if (stats->count == 0)
+  {
+    return 0;
+  }
+
+  rank = (stats->count * permille + 999) / 1000;
+  seen = 0;
+  for (ms = 0; ms < SCHED_HIST_MS; ms++)
+  {
+    seen += stats->hist[ms];
+    if (seen >= rank)
+    {
+      break;
+    }
+  }
+
+  return ms + 1;
+}
@@ -0,0 +1,64 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <pthread.h>
+
+/* priority classes, lower is more urgent */
+#define SCHED_INTERACTIVE (0)   /* 'D', 'E': what the panel shows now */
+#define SCHED_BULK        (1)   /* everything else, uploads, kept in order */
+#define SCHED_CLASSES     (2)
+
+#define SCHED_HIST_MS     (10000) /* latency histogram, 1 ms buckets */
+
+#define RET_SCHED_OK         (0)
+#define RET_SCHED_ERR_MEMORY (1)
+#define RET_SCHED_ERR_THREAD (2)
+
+typedef struct SCHED_ENTRY {
+  struct SCHED_ENTRY *next;
+  unsigned char      *frame;      /* encoded, ready for the wire */
+  int                 framelen;
+  int                 rsplen;     /* 0 if the device does not answer */
+  char                letter;
+  int                 replaceable;/* a newer one replaces it while queued */
+  int                 group;      /* bulk transfer it belongs to, or 0 */
+  unsigned long long  queued;     /* get_time_us() when queued */
+} SCHED_ENTRY;
+
+typedef struct {
+  long               count;
+  long               replaced;    /* superseded while queued */
+  long               failed;
+  unsigned long long sum_us;
+  unsigned long long max_us;
+  long               hist[SCHED_HIST_MS + 1];
+} SCHED_STATS;
+
+typedef struct {
+  SERHDL          hdl;
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+  SCHED_ENTRY    *head[SCHED_CLASSES];
+  SCHED_ENTRY    *tail[SCHED_CLASSES];
+  int             stopping;
+  SCHED_STATS     stats[SCHED_CLASSES];
+} SCHEDULER;
+
+#if SCHEDULER_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int start_scheduler(SCHEDULER *sched, SERHDL hdl);
+EXTERN int queue_command(SCHEDULER *sched, int class, char letter,
+                         int nparam, unsigned char *params, int rsplen,
+                         int group);
+EXTERN void stop_scheduler(SCHEDULER *sched);
+EXTERN void close_scheduler(SCHEDULER *sched);
+EXTERN void print_sched_stats(SCHEDULER *sched, FILE *out);
+
+#undef EXTERN
+
+#endif
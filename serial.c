@@ -15,6 +15,8 @@
 #  include <malloc.h>
 #endif
 
+#include <profile.h>
+
 #define SERIAL_SRC 1
 #include <serial.h>
 #undef SERIAL_SRC
@@ -25,6 +27,10 @@ int open_serial(char *serialport, SERHDL *hdl)
 {
   int rc;
   struct termios options;
+  unsigned long long start;
+
+  PROBE1(open_serial_entry, serialport);
+  start = begin_phase();
 
   if ((*hdl = open(serialport, O_RDWR | O_NOCTTY | O_NDELAY)) == -1)
   {
@@ -70,6 +76,8 @@ int open_serial(char *serialport, SERHDL *hdl)
   rc = RET_SERIAL_OK;
 
 EXIT:
+  end_phase(PHASE_SETUP, start);
+  PROBE1(open_serial_return, rc);
   return rc;
 }
 
@@ -84,48 +92,72 @@ int close_serial(SERHDL hdl)
 
 
 int read_serial(SERHDL hdl, unsigned char *buf, int count)
+{
+  return read_serial_timeout(hdl, buf, count, READ_TIMEOUT_MS);
+}
+
+
+/*
+ * Reads count bytes, waiting at most timeout_ms for each chunk to arrive.
+ * Returns -1 if the device falls silent before all bytes are there.
+ */
+int read_serial_timeout(SERHDL hdl, unsigned char *buf, int count,
+                        int timeout_ms)
 {
   int rc;
   unsigned char *pos;
   int nread;
   fd_set readfds;
   struct timeval timeout;
+  unsigned long long start;
+
+  PROBE2(read_serial_entry, count, timeout_ms);
+  start = begin_phase();
 
-  /* check whether hdl is ready to read */
-  FD_ZERO(&readfds);
-  FD_SET(hdl, &readfds);
-  timeout.tv_sec = 0;
-  timeout.tv_usec = 100000;
-  rc = select(hdl + 1, &readfds, NULL, NULL, &timeout);
-  if (rc == 0)
-  {
-    rc = -1;
-    goto EXIT;
-  }
-  if (rc == -1)
-  {
-    goto EXIT;
-  }
-   
-  /* now actually read */
   pos = buf;
   nread = count;
-  do 
+  while (nread > 0)
   {
-    do
+    /* check whether hdl is ready to read */
+    FD_ZERO(&readfds);
+    FD_SET(hdl, &readfds);
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+    rc = select(hdl + 1, &readfds, NULL, NULL, &timeout);
+    if (rc == 0)
     {
-      rc = read(hdl, pos, nread);
-      if (rc != -1) 
+      rc = -1;
+      goto EXIT;
+    }
+    if (rc == -1)
+    {
+      goto EXIT;
+    }
+
+    /* now actually read */
+    rc = read(hdl, pos, nread);
+    if (rc == -1)
+    {
+      if (errno == EAGAIN)
       {
-        pos = pos + rc;
-        nread -= rc;
+        continue;
       }
+      goto EXIT;
     }
-    while ((rc != -1) && (nread > 0));
+    if (rc == 0)
+    {
+      rc = -1;
+      goto EXIT;
+    }
+    pos = pos + rc;
+    nread -= rc;
   }
-  while ((rc == -1) && (errno == EAGAIN));
+
+  rc = count;
 
 EXIT:
+  end_phase(PHASE_ACK, start);
+  PROBE1(read_serial_return, rc);
   return rc;
 }
 
@@ -133,8 +165,41 @@ EXIT:
 int write_serial(SERHDL hdl, unsigned char *buf, int count)
 {
   int rc;
+  int nwritten;
+  fd_set writefds;
+  unsigned long long start;
+
+  PROBE1(write_serial_entry, count);
+  start = begin_phase();
+
+  /* hdl is non-blocking, so wait for room whenever the driver is full */
+  nwritten = 0;
+  while (nwritten < count)
+  {
+    rc = write(hdl, buf + nwritten, count - nwritten);
+    if (rc == -1)
+    {
+      if (errno != EAGAIN)
+      {
+        goto EXIT;
+      }
+      FD_ZERO(&writefds);
+      FD_SET(hdl, &writefds);
+      if (select(hdl + 1, NULL, &writefds, NULL, NULL) == -1)
+      {
+        rc = -1;
+        goto EXIT;
+      }
+      continue;
+    }
+    nwritten += rc;
+  }
+
+  rc = count;
 
-  rc = write(hdl, buf, count);
+EXIT:
+  end_phase(PHASE_WRITE, start);
+  PROBE1(write_serial_return, rc);
   return rc;
 }
 
@@ -148,8 +213,12 @@ int open_serial(char *serialport, SERHDL *hdl)
   DCB dcb;
   COMMTIMEOUTS timeouts;
   unsigned char *windows_serialport;
+  unsigned long long start;
 #define DEVICE_PREFIX "\\\\.\\" 
 
+  PROBE1(open_serial_entry, serialport);
+  start = begin_phase();
+
   windows_serialport = calloc(strlen(serialport) + 
                               strlen(DEVICE_PREFIX) + 1, sizeof(unsigned char));
   if (windows_serialport == NULL)
@@ -209,6 +278,8 @@ FREE_EXIT:
   free(windows_serialport); 
 
 EXIT:
+  end_phase(PHASE_SETUP, start);
+  PROBE1(open_serial_return, rc);
   return rc;
 }
 
@@ -225,10 +296,43 @@ int close_serial(SERHDL hdl)
 
 
 int read_serial(SERHDL hdl, unsigned char *buf, int count)
+{
+  return read_serial_timeout(hdl, buf, count, READ_TIMEOUT_MS);
+}
+
+
+/*
+ * Like on Linux the device may take timeout_ms to start answering and
+ * between the bytes, the rest of the timeouts is set up by open_serial().
+ */
+int read_serial_timeout(SERHDL hdl, unsigned char *buf, int count,
+                        int timeout_ms)
 {
   int rc;
+  COMMTIMEOUTS timeouts;
   DWORD ntoread;
   DWORD nread;
+  unsigned long long start;
+
+  PROBE2(read_serial_entry, count, timeout_ms);
+  start = begin_phase();
+
+  if (GetCommTimeouts(hdl, &timeouts) == 0)
+  {
+    rc = -1;
+    goto EXIT;
+  }
+  if ((timeouts.ReadIntervalTimeout != (DWORD) timeout_ms) ||
+      (timeouts.ReadTotalTimeoutConstant != (DWORD) timeout_ms))
+  {
+    timeouts.ReadIntervalTimeout = timeout_ms;
+    timeouts.ReadTotalTimeoutConstant = timeout_ms;
+    if (SetCommTimeouts(hdl, &timeouts) == 0)
+    {
+      rc = -1;
+      goto EXIT;
+    }
+  }
 
   ntoread = count;
   nread = 0;
@@ -241,6 +345,8 @@ int read_serial(SERHDL hdl, unsigned char *buf, int count)
   rc = nread;
 
 EXIT:
+  end_phase(PHASE_ACK, start);
+  PROBE1(read_serial_return, rc);
   return rc;
 }
 
@@ -250,6 +356,10 @@ int write_serial(SERHDL hdl, unsigned char *buf, int count)
   int rc;
   DWORD ntowrite;
   DWORD nwritten;
+  unsigned long long start;
+
+  PROBE1(write_serial_entry, count);
+  start = begin_phase();
 
   ntowrite = count;
   nwritten = 0;
@@ -266,6 +376,8 @@ int write_serial(SERHDL hdl, unsigned char *buf, int count)
   rc = count;
 
 EXIT:
+  end_phase(PHASE_WRITE, start);
+  PROBE1(write_serial_return, rc);
   return rc;
 }
 
@@ -12,6 +12,9 @@ typedef HANDLE SERHDL;
 #define RET_SERIAL_ERR_OPEN    (1)
 #define RET_SERIAL_ERR_SETATTR (2)
 
+#define READ_TIMEOUT_MS        (100)
+#define LINE_BYTES_PER_S       (38400 / 10)  /* 8N1: start, 8 data, stop */
+
 #if SERIAL_SRC
 # define EXTERN 
 #else
@@ -21,6 +24,8 @@ typedef HANDLE SERHDL;
 EXTERN int open_serial(char *serialport, SERHDL *hdl);
 EXTERN int close_serial(SERHDL hdl);
 EXTERN int read_serial(SERHDL hdl, unsigned char *buf, int count);
+EXTERN int read_serial_timeout(SERHDL hdl, unsigned char *buf, int count,
+                               int timeout_ms);
 EXTERN int write_serial(SERHDL hdl, unsigned char *buf, int count);
 
 
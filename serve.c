@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if LINUX
+#  include <sys/types.h>
+#  include <sys/stat.h>
+#endif
+
+#include <serial.h>
+#include <command.h>
+#include <pattern.h>
+#include <crc16.h>
+#include <frame.h>
+#include <checkpoint.h>
+#include <upload.h>
+#include <scheduler.h>
+#include <framecache.h>
+
+#define SERVE_SRC 1
+#include <serve.h>
+#undef SERVE_SRC
+
+#include <cmddesc.h>
+
+#define MAX_LINE          (1024)
+#define STDIN_NAME        "-"
+#define DISPLAY_DURATION  (1)
+
+#define RET_SERVE_OK      (0)
+#define RET_SERVE_ERR     (1)
+#define RET_SERVE_QUIT    (2)
+
+static int serve_request(SCHEDULER *sched, char *line, int *group);
+static int queue_patternfile(SCHEDULER *sched, char *path, int group);
+
+
+/*
+ * Keeps the device open and executes the commands written to a FIFO (or
+ * stdin for "-"), one per line, in the syntax of the command line:
+ * displaypattern <file>, displaytext <text>, storepattern <file>, ...
+ * plus "stats" for the queueing latencies and "quit".
+ * Display commands jump ahead of running uploads, see scheduler.c.
+ */
+int serve_device(SERHDL hdl, int myargc, char **myargv)
+{
+  int rc;
+  SCHEDULER sched;
+  FILE *requests;
+  char line[MAX_LINE];
+  int group;
+  int stdin_requests;
+
+  stdin_requests = (strcmp(myargv[0], STDIN_NAME) == 0);
+#if LINUX
+  if (!stdin_requests && (mkfifo(myargv[0], 0666) == -1) && (errno != EEXIST))
+  {
+    fprintf(stderr, "creation of fifo %s has failed.\n", myargv[0]);
+    rc = RET_SERVE_ERR;
+    goto EXIT;
+  }
+#endif
+
+  trace_responses(0);
+  if (start_scheduler(&sched, hdl) != RET_SCHED_OK)
+  {
+    fprintf(stderr, "start of scheduler has failed.\n");
+    rc = RET_SERVE_ERR;
+    goto EXIT;
+  }
+
+  group = 0;
+  rc = RET_SERVE_OK;
+  while (rc != RET_SERVE_QUIT)
+  {
+    /* a fifo reaches EOF whenever the last writer goes, so reopen it */
+    requests = stdin_requests ? stdin : fopen(myargv[0], "r");
+    if (requests == NULL)
+    {
+      fprintf(stderr, "open of %s has failed.\n", myargv[0]);
+      rc = RET_SERVE_ERR;
+      break;
+    }
+
+    while ((rc != RET_SERVE_QUIT) && (fgets(line, MAX_LINE, requests) != NULL))
+    {
+      line[strcspn(line, "\r\n")] = '\0';
+      if (line[0] == '\0')
+      {
+        continue;
+      }
+      if (strcmp(line, "stats") == 0)
+      {
+        print_sched_stats(&sched, stdout);
+        print_frame_cache_stats(stdout);
+        continue;
+      }
+      if (strcmp(line, "quit") == 0)
+      {
+        rc = RET_SERVE_QUIT;
+        break;
+      }
+      if (serve_request(&sched, line, &group) != RET_SERVE_OK)
+      {
+        fprintf(stderr, "request \"%s\" has failed.\n", line);
+      }
+    }
+
+    if (stdin_requests)
+    {
+      break;
+    }
+    fclose(requests);
+  }
+
+  stop_scheduler(&sched);
+  print_sched_stats(&sched, stdout);
+  print_frame_cache_stats(stdout);
+  close_scheduler(&sched);
+
+  rc = (rc == RET_SERVE_ERR) ? RET_SERVE_ERR : RET_SERVE_OK;
+
+EXIT:
+  return rc;
+}
+
+
+static int serve_request(SCHEDULER *sched, char *line, int *group)
+{
+  int rc;
+  char *arg;
+  FILE *patternfile;
+  unsigned char pattern[CMD_NPARAM(CMD_DISPLAYPATTERN)];
+  unsigned char speed[CMD_NPARAM(CMD_SETTEXTSPEED)];
+
+  /* split the command name from the rest of the line */
+  arg = line + strcspn(line, " \t");
+  if (*arg != '\0')
+  {
+    *arg++ = '\0';
+    arg += strspn(arg, " \t");
+  }
+
+  if (strcmp(line, "displaypattern") == 0)
+  {
+    if (open_patternfile(arg, &patternfile) != RET_PATTERN_OK)
+    {
+      rc = RET_SERVE_ERR;
+      goto EXIT;
+    }
+    rc = read_one_pattern(patternfile, pattern);
+    close_patternfile(patternfile);
+    if (rc != RET_PATTERN_OK)
+    {
+      rc = RET_SERVE_ERR;
+      goto EXIT;
+    }
+    rc = queue_command(sched, SCHED_INTERACTIVE,
+                       CMD_LETTER(CMD_DISPLAYPATTERN), sizeof(pattern),
+                       pattern, CMD_RSPLEN(CMD_DISPLAYPATTERN), 0);
+  }
+  else if (strcmp(line, "displaytext") == 0)
+  {
+    rc = queue_command(sched, SCHED_INTERACTIVE, CMD_LETTER(CMD_DISPLAYTEXT),
+                       strlen(arg), (unsigned char *) arg,
+                       CMD_RSPLEN(CMD_DISPLAYTEXT), 0);
+  }
+  else if (strcmp(line, "storetext") == 0)
+  {
+    rc = queue_command(sched, SCHED_BULK, CMD_LETTER(CMD_STORETEXT),
+                       strlen(arg), (unsigned char *) arg,
+                       CMD_RSPLEN(CMD_STORETEXT), 0);
+  }
+  else if (strcmp(line, "settextspeed") == 0)
+  {
+    speed[0] = atoi(arg);
+    rc = queue_command(sched, SCHED_BULK, CMD_LETTER(CMD_SETTEXTSPEED),
+                       sizeof(speed), speed, CMD_RSPLEN(CMD_SETTEXTSPEED), 0);
+  }
+  else if (strcmp(line, "setnormalmode") == 0)
+  {
+    rc = queue_command(sched, SCHED_BULK, CMD_LETTER(CMD_SETNORMALMODE), 0,
+                       NULL, CMD_RSPLEN(CMD_SETNORMALMODE), 0);
+  }
+  else if (strcmp(line, "settextmode") == 0)
+  {
+    rc = queue_command(sched, SCHED_BULK, CMD_LETTER(CMD_SETTEXTMODE), 0,
+                       NULL, CMD_RSPLEN(CMD_SETTEXTMODE), 0);
+  }
+  else if (strcmp(line, "setpatternmode") == 0)
+  {
+    rc = queue_command(sched, SCHED_BULK, CMD_LETTER(CMD_SETPATTERNMODE), 0,
+                       NULL, CMD_RSPLEN(CMD_SETPATTERNMODE), 0);
+  }
+  else if (strcmp(line, "storepattern") == 0)
+  {
+    rc = queue_patternfile(sched, arg, ++(*group));
+  }
+  else
+  {
+    rc = RET_SERVE_ERR;
+  }
+
+  if (rc != RET_SCHED_OK)
+  {
+    rc = RET_SERVE_ERR;
+  }
+
+EXIT:
+  return rc;
+}
+
+
+/*
+ * Queues a whole animation as one bulk group, 'G' first, then 'I'. The
+ * file is parsed completely first, a malformed one queues nothing and
+ * leaves the stored animation alone.
+ */
+static int queue_patternfile(SCHEDULER *sched, char *path, int group)
+{
+  int rc;
+  unsigned char *patterns;
+  int count;
+  unsigned char pattern[CMD_NPARAM(CMD_STORENEXTPATTERN)];
+  int i;
+
+  if (load_patternfile(path, &patterns, &count) != RET_SOURCE_OK)
+  {
+    rc = RET_SERVE_ERR;
+    goto EXIT;
+  }
+
+  rc = RET_SERVE_OK;
+  for (i = 0; i < count; i++)
+  {
+    memcpy(pattern, patterns + i * LINES_PER_PATTERN, LINES_PER_PATTERN);
+    /* set duration of display in multiples of 100 ms */
+    pattern[LINES_PER_PATTERN] = DISPLAY_DURATION;
+    if (i == 0)
+    {
+      rc = queue_command(sched, SCHED_BULK,
+                         CMD_LETTER(CMD_STOREFIRSTPATTERN), sizeof(pattern),
+                         pattern, CMD_RSPLEN(CMD_STOREFIRSTPATTERN), group);
+    }
+    else
+    {
+      rc = queue_command(sched, SCHED_BULK, CMD_LETTER(CMD_STORENEXTPATTERN),
+                         sizeof(pattern), pattern,
+                         CMD_RSPLEN(CMD_STORENEXTPATTERN), group);
+    }
+    if (rc != RET_SCHED_OK)
+    {
+      rc = RET_SERVE_ERR;
+      break;
+    }
+  }
+
+  free(patterns);
+
+EXIT:
+  return rc;
+}
@@ -0,0 +1,14 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#if SERVE_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int serve_device(SERHDL hdl, int myargc, char **myargv);
+
+#undef EXTERN
+
+#endif
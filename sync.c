@@ -0,0 +1,409 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <serial.h>
+#include <command.h>
+#include <pattern.h>
+#include <checkpoint.h>
+#include <upload.h>
+#include <pool.h>
+#include <options.h>
+#include <timing.h>
+
+#define SYNC_SRC 1
+#include <sync.h>
+#undef SYNC_SRC
+
+#define DEFAULT_JOBS     (8)
+#define DEFAULT_HUBLIMIT (4)
+#define DEFAULT_RETRIES  (2)
+#define RETRY_DELAY_US   (2000000ULL)
+#define DISPLAY_DURATION (1)
+
+#define MAX_LINE  (1024)
+#define NO_ENTRY  "-"
+
+#define MODE_KEEP    (0)
+#define MODE_NORMAL  (1)
+#define MODE_TEXT    (2)
+#define MODE_PATTERN (3)
+
+typedef struct {
+  char *port;
+  int   hub;                    /* index into hubs */
+  int   mode;
+  char *patternfile;            /* NULL if none */
+  char *text;                   /* NULL if none */
+  int   attempts;
+  unsigned long long not_before;/* earliest time of the next attempt */
+  int   patterns;               /* no of patterns uploaded */
+} DEVICE;
+
+typedef struct {
+  char *name;
+  int   active;                 /* devices currently being synced */
+} HUB;
+
+typedef struct {
+  DEVICE *devices;
+  int     ndevices;
+  HUB    *hubs;
+  int     nhubs;
+  int     hublimit;
+  int     retries;
+  pthread_mutex_t lock;         /* protects hubs and the counters below */
+  int     done;
+  int     failed;
+  int     patterns;
+  unsigned long long start;
+} FLEET;
+
+static int read_manifest(char *path, FLEET *fleet);
+static int parse_mode(char *mode);
+static int find_hub(FLEET *fleet, char *name);
+static int sync_job(void *ctx, int job);
+static int sync_device(DEVICE *device);
+static void free_fleet(FLEET *fleet);
+
+
+/*
+ * Brings every device listed in the manifest to its text, animation and
+ * mode. Devices are synced in parallel, at most hublimit per USB hub, and
+ * failed devices are retried.
+ *
+ * Manifest lines: <port> <hub> <mode> <patternfile> [<text>]
+ * with mode one of normal, text, pattern and "-" for anything left alone.
+ */
+int sync_fleet(int myargc, char **myargv)
+{
+  int rc;
+  FLEET fleet;
+  double seconds;
+
+  memset(&fleet, 0, sizeof(fleet));
+  pthread_mutex_init(&fleet.lock, NULL);
+  if ((rc = read_manifest(myargv[0], &fleet)) != RET_SYNC_OK)
+  {
+    goto FREE_EXIT;
+  }
+
+  fleet.hublimit = get_int_option("hublimit", DEFAULT_HUBLIMIT);
+  fleet.retries = get_int_option("retries", DEFAULT_RETRIES);
+  if (fleet.hublimit < 1)
+  {
+    fleet.hublimit = 1;
+  }
+
+  /* devices are many, so keep their responses out of the progress */
+  trace_responses(0);
+
+  fleet.start = get_time_us();
+  if (run_pool(get_int_option("jobs", DEFAULT_JOBS), fleet.ndevices,
+               sync_job, &fleet) != RET_POOL_OK)
+  {
+    fprintf(stderr, "start of sync workers has failed.\n");
+    rc = RET_SYNC_ERR_MEMORY;
+    goto FREE_EXIT;
+  }
+  seconds = (get_time_us() - fleet.start) / 1e6;
+
+  printf("synced %d of %d devices in %.1f s, %d failed\n",
+         fleet.done - fleet.failed, fleet.ndevices, seconds, fleet.failed);
+  if (seconds > 0)
+  {
+    printf("throughput: %.1f devices/min, %.1f patterns/s\n",
+           fleet.done * 60 / seconds, fleet.patterns / seconds);
+  }
+
+  rc = (fleet.failed == 0) ? RET_SYNC_OK : RET_SYNC_ERR_DEVICE;
+
+FREE_EXIT:
+  pthread_mutex_destroy(&fleet.lock);
+  free_fleet(&fleet);
+
+  return rc;
+}
+
+
+static int read_manifest(char *path, FLEET *fleet)
+{
+  int rc;
+  FILE *manifest;
+  char line[MAX_LINE];
+  char port[MAX_LINE];
+  char hub[MAX_LINE];
+  char mode[MAX_LINE];
+  char patternfile[MAX_LINE];
+  char *text;
+  int textpos;
+  int lineno;
+  DEVICE *device;
+  DEVICE *devices;
+
+  if ((manifest = fopen(path, "r")) == NULL)
+  {
+    fprintf(stderr, "open of manifest %s has failed\n", path);
+    rc = RET_SYNC_ERR_MANIFEST;
+    goto EXIT;
+  }
+
+  lineno = 0;
+  while (fgets(line, MAX_LINE, manifest) != NULL)
+  {
+    lineno++;
+    line[strcspn(line, "\r\n")] = '\0';
+    if ((line[strspn(line, " \t")] == '\0') ||
+        (line[strspn(line, " \t")] == '#'))
+    {
+      continue;
+    }
+
+    textpos = 0;
+    if ((sscanf(line, "%s %s %s %s %n", port, hub, mode, patternfile,
+                &textpos) < 4) || (parse_mode(mode) == -1))
+    {
+      fprintf(stderr, "%s:%d: invalid manifest line\n", path, lineno);
+      rc = RET_SYNC_ERR_MANIFEST;
+      goto CLOSE_EXIT;
+    }
+    text = (textpos > 0) ? line + textpos : "";
+
+    devices = realloc(fleet->devices, (fleet->ndevices + 1) * sizeof(DEVICE));
+    if (devices == NULL)
+    {
+      rc = RET_SYNC_ERR_MEMORY;
+      goto CLOSE_EXIT;
+    }
+    fleet->devices = devices;
+    device = &fleet->devices[fleet->ndevices];
+    memset(device, 0, sizeof(DEVICE));
+
+    device->port = strdup(port);
+    device->mode = parse_mode(mode);
+    if (strcmp(patternfile, NO_ENTRY) != 0)
+    {
+      device->patternfile = strdup(patternfile);
+    }
+    if (*text != '\0')
+    {
+      device->text = strdup(text);
+    }
+    fleet->ndevices++;
+    if ((device->hub = find_hub(fleet, hub)) == -1)
+    {
+      rc = RET_SYNC_ERR_MEMORY;
+      goto CLOSE_EXIT;
+    }
+  }
+
+  rc = RET_SYNC_OK;
+
+CLOSE_EXIT:
+  fclose(manifest);
+
+EXIT:
+  return rc;
+}
+
+
+static int parse_mode(char *mode)
+{
+  if (strcmp(mode, NO_ENTRY) == 0)
+  {
+    return MODE_KEEP;
+  }
+  if (strcmp(mode, "normal") == 0)
+  {
+    return MODE_NORMAL;
+  }
+  if (strcmp(mode, "text") == 0)
+  {
+    return MODE_TEXT;
+  }
+  if (strcmp(mode, "pattern") == 0)
+  {
+    return MODE_PATTERN;
+  }
+
+  return -1;
+}
+
+
+static int find_hub(FLEET *fleet, char *name)
+{
+  int i;
+  HUB *hubs;
+
+  for (i = 0; i < fleet->nhubs; i++)
+  {
+    if (strcmp(fleet->hubs[i].name, name) == 0)
+    {
+      return i;
+    }
+  }
+
+  hubs = realloc(fleet->hubs, (fleet->nhubs + 1) * sizeof(HUB));
+  if (hubs == NULL)
+  {
+    return -1;
+  }
+  fleet->hubs = hubs;
+  fleet->hubs[fleet->nhubs].name = strdup(name);
+  fleet->hubs[fleet->nhubs].active = 0;
+
+  return fleet->nhubs++;
+}
+
+
+/* pool job: one attempt to sync one device */
+static int sync_job(void *ctx, int job)
+{
+  FLEET *fleet;
+  DEVICE *device;
+  HUB *hub;
+  int rc;
+  unsigned long long start;
+
+  fleet = (FLEET *) ctx;
+  device = &fleet->devices[job];
+  hub = &fleet->hubs[device->hub];
+
+  /* wait for the retry delay and a free slot on the hub */
+  start = get_time_us();
+  if (start < device->not_before)
+  {
+    return POOL_JOB_AGAIN;
+  }
+  pthread_mutex_lock(&fleet->lock);
+  if (hub->active >= fleet->hublimit)
+  {
+    pthread_mutex_unlock(&fleet->lock);
+    return POOL_JOB_AGAIN;
+  }
+  hub->active++;
+  pthread_mutex_unlock(&fleet->lock);
+
+  device->attempts++;
+  rc = sync_device(device);
+
+  pthread_mutex_lock(&fleet->lock);
+  hub->active--;
+  if ((rc != RET_COMMAND_OK) && (device->attempts <= fleet->retries))
+  {
+    pthread_mutex_unlock(&fleet->lock);
+    fprintf(stderr, "%s: sync has failed, retrying (attempt %d of %d)\n",
+            device->port, device->attempts, fleet->retries + 1);
+    device->not_before = get_time_us() + RETRY_DELAY_US;
+    return POOL_JOB_AGAIN;
+  }
+
+  fleet->done++;
+  if (rc == RET_COMMAND_OK)
+  {
+    fleet->patterns += device->patterns;
+    printf("[%d/%d] %s: ok, %d patterns in %.1f s\n", fleet->done,
+           fleet->ndevices, device->port, device->patterns,
+           (get_time_us() - start) / 1e6);
+  }
+  else
+  {
+    fleet->failed++;
+    printf("[%d/%d] %s: FAILED after %d attempts\n", fleet->done,
+           fleet->ndevices, device->port, device->attempts);
+  }
+  fflush(stdout);
+  pthread_mutex_unlock(&fleet->lock);
+
+  return POOL_JOB_DONE;
+}
+
+
+/* the per device upload sequence: text, animation, then the mode */
+static int sync_device(DEVICE *device)
+{
+  int rc;
+  SERHDL hdl;
+  PATTERNFILE_SOURCE source;
+
+  device->patterns = 0;
+  if ((rc = open_serial(device->port, &hdl)) != RET_SERIAL_OK)
+  {
+    fprintf(stderr, "open of device %s has failed.\n", device->port);
+    goto EXIT;
+  }
+
+  if (device->text != NULL)
+  {
+    if ((rc = store_text(hdl, 1, &device->text)) != RET_COMMAND_OK)
+    {
+      goto CLOSE_EXIT;
+    }
+  }
+
+  if (device->patternfile != NULL)
+  {
+    if ((rc = open_patternfile(device->patternfile, &source.patternfile))
+        != RET_PATTERN_OK)
+    {
+      fprintf(stderr, "open of patternfile %s has failed\n",
+              device->patternfile);
+      goto CLOSE_EXIT;
+    }
+    source.path = device->patternfile;
+    source.count = 0;
+    rc = upload_patterns(hdl, next_file_pattern, &source, DISPLAY_DURATION,
+                         0, NULL);
+    close_patternfile(source.patternfile);
+    if (rc != RET_COMMAND_OK)
+    {
+      goto CLOSE_EXIT;
+    }
+    device->patterns = source.count;
+  }
+
+  switch (device->mode)
+  {
+    case MODE_NORMAL:
+      rc = set_normalmode(hdl, 0, NULL);
+      break;
+
+    case MODE_TEXT:
+      rc = set_textmode(hdl, 0, NULL);
+      break;
+
+    case MODE_PATTERN:
+      rc = set_patternmode(hdl, 0, NULL);
+      break;
+
+    default:
+      rc = RET_COMMAND_OK;
+      break;
+  }
+
+CLOSE_EXIT:
+  close_serial(hdl);
+
+EXIT:
+  return rc;
+}
+
+
+static void free_fleet(FLEET *fleet)
+{
+  int i;
+
+  for (i = 0; i < fleet->ndevices; i++)
+  {
+    free(fleet->devices[i].port);
+    free(fleet->devices[i].patternfile);
+    free(fleet->devices[i].text);
+  }
+  for (i = 0; i < fleet->nhubs; i++)
+  {
+    free(fleet->hubs[i].name);
+  }
+  free(fleet->devices);
+  free(fleet->hubs);
+}
@@ -0,0 +1,19 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#define RET_SYNC_OK           (0)
+#define RET_SYNC_ERR_MANIFEST (1)
+#define RET_SYNC_ERR_MEMORY   (2)
+#define RET_SYNC_ERR_DEVICE   (3)
+
+#if SYNC_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int sync_fleet(int myargc, char **myargv);
+
+#undef EXTERN
+
+#endif
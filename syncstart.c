@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <serial.h>
+#include <command.h>
+#include <crc16.h>
+#include <frame.h>
+#include <pool.h>
+#include <options.h>
+#include <timing.h>
+
+#define SYNCSTART_SRC 1
+#include <syncstart.h>
+#undef SYNCSTART_SRC
+
+#include <cmddesc.h>
+
+#define DEFAULT_LEAD_MS (10)
+#define MAX_PORTS       (64)
+#define MAX_PORTS_LEN   (4096)
+
+/* holds the port threads until all are created and the release is set */
+typedef struct {
+  pthread_mutex_t    lock;
+  pthread_cond_t     cond;
+  int                open;
+  int                aborted;     /* not all threads could be created */
+  unsigned long long release;     /* get_time_us() of the burst */
+} GATE;
+
+typedef struct {
+  char              *port;
+  SERHDL             hdl;
+  pthread_t          thread;
+  GATE              *gate;
+  unsigned char     *frame;
+  int                framelen;
+  unsigned long long writing;     /* write() called */
+  unsigned long long written;     /* write() returned */
+  unsigned long long acked;       /* response received */
+  int                rc;
+} STARTER;
+
+static int start_threads(STARTER *starters, int nports,
+                         unsigned long long lead, unsigned long long *release);
+static void start_burst(STARTER *starters, int nports,
+                        unsigned long long lead, unsigned long long *release);
+static void *start_port(void *arg);
+static void wait_release(unsigned long long release);
+
+
+/*
+ * syncstart <port,port,...>: switches all panels to pattern mode at once,
+ * so that the stored animations run in phase. The ports are opened and
+ * the 'B' frame encoded beforehand; one thread per port waits at a gate
+ * until all are created, then spins to a common release time --lead ms
+ * (default 10) later and writes. With more ports than cores, or --burst,
+ * spinning threads would take turns on the cores, so one thread writes to
+ * all ports back to back instead. The skew is the spread of the write times
+ * over the ports; writes are timed when the kernel took the frame, the
+ * panel gets it one frame time (1.6 ms) later on every port alike.
+ */
+int sync_start(int myargc, char **myargv)
+{
+  int rc;
+  STARTER starters[MAX_PORTS];
+  unsigned char frame[FRAME_ENCODED_LEN(CMD_NPARAM(CMD_SETPATTERNMODE))];
+  char ports[MAX_PORTS_LEN];
+  char *port;
+  unsigned long long first;
+  unsigned long long last;
+  unsigned long long lead;
+  unsigned long long release;
+  int framelen;
+  int nports;
+  int i;
+
+  if (get_int_option("lead", DEFAULT_LEAD_MS) < 1)
+  {
+    fprintf(stderr, "--lead must be 1 ms or more.\n");
+    rc = RET_SYNCSTART_ERR_LEAD;
+    goto EXIT;
+  }
+
+  framelen = encode_frame(CMD_LETTER(CMD_SETPATTERNMODE),
+                          CMD_NPARAM(CMD_SETPATTERNMODE), NULL, frame);
+
+  nports = 0;
+  snprintf(ports, sizeof(ports), "%s", myargv[0]);
+  for (port = strtok(ports, ","); port != NULL; port = strtok(NULL, ","))
+  {
+    if (nports == MAX_PORTS)
+    {
+      fprintf(stderr, "more than %d ports, ignoring %s.\n", MAX_PORTS, port);
+      break;
+    }
+    if (open_serial(port, &starters[nports].hdl) != RET_SERIAL_OK)
+    {
+      fprintf(stderr, "open of device %s has failed.\n", port);
+      rc = RET_SYNCSTART_ERR_DEVICE;
+      goto CLOSE_EXIT;
+    }
+    starters[nports].port = port;
+    starters[nports].frame = frame;
+    starters[nports].framelen = framelen;
+    nports++;
+  }
+
+  trace_responses(0);
+  lead = get_int_option("lead", DEFAULT_LEAD_MS) * 1000ULL;
+  if ((get_option("burst") != NULL) || (nports > get_cpu_count()))
+  {
+    start_burst(starters, nports, lead, &release);
+  }
+  else if (start_threads(starters, nports, lead, &release)
+           != RET_SYNCSTART_OK)
+  {
+    fprintf(stderr, "start of the port threads has failed, "
+                    "writing from one thread.\n");
+    start_burst(starters, nports, lead, &release);
+  }
+
+  rc = RET_SYNCSTART_OK;
+  first = 0;
+  last = 0;
+  printf("%-24s %10s %10s %10s\n", "port", "start us", "written us",
+         "ack ms");
+  for (i = 0; i < nports; i++)
+  {
+    if (starters[i].rc != RET_COMMAND_OK)
+    {
+      printf("%-24s %10s\n", starters[i].port, "failed");
+      rc = RET_SYNCSTART_ERR_SEND;
+      continue;
+    }
+    printf("%-24s %10lld %10lld %10.2f\n", starters[i].port,
+           (long long) (starters[i].writing - release),
+           (long long) (starters[i].written - release),
+           (starters[i].acked - release) / 1000.0);
+    if ((first == 0) || (starters[i].written < first))
+    {
+      first = starters[i].written;
+    }
+    if (starters[i].written > last)
+    {
+      last = starters[i].written;
+    }
+  }
+  printf("skew %llu us over %d ports\n", last - first, nports);
+
+CLOSE_EXIT:
+  for (i = 0; i < nports; i++)
+  {
+    close_serial(starters[i].hdl);
+  }
+
+EXIT:
+  return rc;
+}
+
+
+/*
+ * The release is set only once every thread exists, creating them may
+ * take longer than the lead. If one cannot be created, the others are let
+ * go without writing and the caller falls back to start_burst().
+ */
+static int start_threads(STARTER *starters, int nports,
+                         unsigned long long lead, unsigned long long *release)
+{
+  GATE gate;
+  int started;
+  int i;
+
+  pthread_mutex_init(&gate.lock, NULL);
+  pthread_cond_init(&gate.cond, NULL);
+  gate.open = 0;
+  gate.aborted = 0;
+
+  for (started = 0; started < nports; started++)
+  {
+    starters[started].gate = &gate;
+    if (pthread_create(&starters[started].thread, NULL, start_port,
+                       &starters[started]) != 0)
+    {
+      break;
+    }
+  }
+
+  pthread_mutex_lock(&gate.lock);
+  gate.aborted = (started < nports);
+  gate.release = get_time_us() + lead;
+  gate.open = 1;
+  pthread_cond_broadcast(&gate.cond);
+  pthread_mutex_unlock(&gate.lock);
+
+  for (i = 0; i < started; i++)
+  {
+    pthread_join(starters[i].thread, NULL);
+  }
+  pthread_cond_destroy(&gate.cond);
+  pthread_mutex_destroy(&gate.lock);
+
+  if (started < nports)
+  {
+    return RET_SYNCSTART_ERR_THREAD;
+  }
+  *release = gate.release;
+
+  return RET_SYNCSTART_OK;
+}
+
+
+/* all writes first, then the acks, from this thread */
+static void start_burst(STARTER *starters, int nports,
+                        unsigned long long lead, unsigned long long *release)
+{
+  unsigned char response[CMD_RSPLEN(CMD_SETPATTERNMODE)];
+  int i;
+
+  *release = get_time_us() + lead;
+  wait_release(*release);
+  for (i = 0; i < nports; i++)
+  {
+    starters[i].writing = get_time_us();
+    starters[i].rc = send_frame(starters[i].hdl, starters[i].frame,
+                                starters[i].framelen);
+    starters[i].written = get_time_us();
+  }
+
+  for (i = 0; i < nports; i++)
+  {
+    if (starters[i].rc == RET_COMMAND_OK)
+    {
+      starters[i].rc = RECEIVE_RSP(starters[i].hdl, CMD_SETPATTERNMODE,
+                                   response);
+      starters[i].acked = get_time_us();
+    }
+  }
+}
+
+
+/* thread of one port: wait at the gate, spin to the release, write, ack */
+static void *start_port(void *arg)
+{
+  STARTER *starter;
+  unsigned char response[CMD_RSPLEN(CMD_SETPATTERNMODE)];
+  unsigned long long release;
+  int aborted;
+
+  starter = (STARTER *) arg;
+  pthread_mutex_lock(&starter->gate->lock);
+  while (!starter->gate->open)
+  {
+    pthread_cond_wait(&starter->gate->cond, &starter->gate->lock);
+  }
+  release = starter->gate->release;
+  aborted = starter->gate->aborted;
+  pthread_mutex_unlock(&starter->gate->lock);
+  if (aborted)
+  {
+    return NULL;
+  }
+  wait_release(release);
+
+  starter->writing = get_time_us();
+  starter->rc = send_frame(starter->hdl, starter->frame, starter->framelen);
+  starter->written = get_time_us();
+  if (starter->rc == RET_COMMAND_OK)
+  {
+    starter->rc = RECEIVE_RSP(starter->hdl, CMD_SETPATTERNMODE, response);
+    starter->acked = get_time_us();
+  }
+
+  return NULL;
+}
+
+
+/* spins, a sleep would wake up too late; yields to the other starters */
+static void wait_release(unsigned long long release)
+{
+  while (get_time_us() < release)
+  {
+    sched_yield();
+  }
+}
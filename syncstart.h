@@ -0,0 +1,20 @@
+#ifndef SYNCSTART_H
+#define SYNCSTART_H
+
+#define RET_SYNCSTART_OK         (0)
+#define RET_SYNCSTART_ERR_DEVICE (1)
+#define RET_SYNCSTART_ERR_THREAD (2)
+#define RET_SYNCSTART_ERR_SEND   (3)
+#define RET_SYNCSTART_ERR_LEAD   (4)
+
+#if SYNCSTART_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int sync_start(int myargc, char **myargv);
+
+#undef EXTERN
+
+#endif
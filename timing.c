@@ -0,0 +1,93 @@
+#if LINUX
+#  include <time.h>
+#  include <unistd.h>
+#  include <sys/timerfd.h>
+#endif
+
+#if WIN
+#  include <windows.h>
+#endif
+
+#define TIMING_SRC 1
+#include <timing.h>
+#undef TIMING_SRC
+
+#if LINUX
+
+/* monotonic time in microseconds, for measuring intervals only */
+unsigned long long get_time_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/*
+ * Sleeps until the get_time_us() time t. The timer is absolute, so a
+ * loop waiting for start + i * period does not drift however late the
+ * single wake-ups are.
+ */
+void sleep_until_us(unsigned long long t)
+{
+  static int timer = -1;
+  struct itimerspec spec;
+  unsigned long long expirations;
+
+  if (t <= get_time_us())
+  {
+    return;
+  }
+
+  if ((timer == -1) &&
+      ((timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) == -1))
+  {
+    usleep(t - get_time_us());
+    return;
+  }
+
+  spec.it_interval.tv_sec = 0;
+  spec.it_interval.tv_nsec = 0;
+  spec.it_value.tv_sec = t / 1000000;
+  spec.it_value.tv_nsec = (t % 1000000) * 1000;
+  if ((timerfd_settime(timer, TFD_TIMER_ABSTIME, &spec, NULL) == -1) ||
+      (read(timer, &expirations, sizeof(expirations)) == -1))
+  {
+    usleep((t > get_time_us()) ? t - get_time_us() : 0);
+  }
+}
+
+#endif /* LINUX */
+
+#if WIN
+
+unsigned long long get_time_us(void)
+{
+  LARGE_INTEGER count;
+  LARGE_INTEGER frequency;
+
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&count);
+
+  return (unsigned long long) (count.QuadPart / frequency.QuadPart) * 1000000 +
+         (count.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+}
+
+
+/* Sleep() only has ms resolution, the rest is spun off */
+void sleep_until_us(unsigned long long t)
+{
+  unsigned long long now;
+
+  while ((now = get_time_us()) < t)
+  {
+    if (t - now > 2000)
+    {
+      Sleep((DWORD) ((t - now) / 1000 - 1));
+    }
+  }
+}
+
+#endif /* WIN */
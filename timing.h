@@ -0,0 +1,15 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#if TIMING_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN unsigned long long get_time_us(void);
+EXTERN void sleep_until_us(unsigned long long t);
+
+#undef EXTERN
+
+#endif
@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <serial.h>
+#include <pattern.h>
+#include <command.h>
+#include <crc16.h>
+#include <frame.h>
+#include <ring.h>
+#include <checkpoint.h>
+
+#define UPLOAD_SRC 1
+#include <upload.h>
+#undef UPLOAD_SRC
+
+#include <cmddesc.h>
+
+#define STORE_PARAM_LEN (LINES_PER_PATTERN + 1)
+
+#if STORE_PARAM_LEN != CMD_STOREFIRSTPATTERN_NPARAM || \
+    STORE_PARAM_LEN != CMD_STORENEXTPATTERN_NPARAM
+#  error "store commands do not take a pattern and a duration"
+#endif
+
+#if FRAME_ENCODED_LEN(STORE_PARAM_LEN) > RING_SLOT_SIZE
+#  error "ring slots are too small for an encoded store frame"
+#endif
+
+typedef struct {
+  RING          *ring;
+  PATTERN_SOURCE source;
+  void          *ctx;
+  unsigned char  duration;
+  int            first;
+  int            rc;
+} PRODUCER;
+
+/* pattern source handing out the patterns of an array in turn */
+int next_memory_pattern(void *ctx, unsigned char *pattern)
+{
+  MEMORY_SOURCE *src;
+
+  src = (MEMORY_SOURCE *) ctx;
+  if (src->next == src->count)
+  {
+    return RET_SOURCE_END;
+  }
+
+  memcpy(pattern, src->patterns + src->next * LINES_PER_PATTERN,
+         LINES_PER_PATTERN);
+  src->next++;
+  return RET_SOURCE_OK;
+}
+
+
+/*
+ * Reads all patterns of a pattern file into one malloc()ed array of
+ * LINES_PER_PATTERN bytes each, to be free()d by the caller.
+ */
+int load_patternfile(char *path, unsigned char **patterns, int *count)
+{
+  int rc;
+  PATTERNFILE_SOURCE source;
+  unsigned char pattern[LINES_PER_PATTERN];
+  unsigned char *grown;
+  int allocated;
+
+  *patterns = NULL;
+  *count = 0;
+  if (open_patternfile(path, &source.patternfile) != RET_PATTERN_OK)
+  {
+    fprintf(stderr, "open of patternfile %s has failed.\n", path);
+    rc = RET_SOURCE_ERR;
+    goto EXIT;
+  }
+  source.path = path;
+  source.count = 0;
+
+  allocated = 0;
+  while ((rc = next_file_pattern(&source, pattern)) == RET_SOURCE_OK)
+  {
+    if (source.count > allocated)
+    {
+      allocated = allocated ? 2 * allocated : 64;
+      if ((grown = realloc(*patterns, allocated * LINES_PER_PATTERN)) == NULL)
+      {
+        rc = RET_SOURCE_ERR;
+        break;
+      }
+      *patterns = grown;
+    }
+    memcpy(*patterns + (source.count - 1) * LINES_PER_PATTERN, pattern,
+           LINES_PER_PATTERN);
+  }
+  close_patternfile(source.patternfile);
+
+  if ((rc != RET_SOURCE_END) || (source.count == 0))
+  {
+    free(*patterns);
+    *patterns = NULL;
+    rc = RET_SOURCE_ERR;
+    goto EXIT;
+  }
+
+  *count = source.count;
+  rc = RET_SOURCE_OK;
+
+EXIT:
+  return rc;
+}
+
+
+static void *produce_frames(void *arg);
+
+
+/*
+ * Stores all patterns of source on the device, 'G' for the first one and
+ * 'I' for the following ones. The patterns are fetched and encoded by a
+ * producer thread while this thread keeps the serial link busy, so a slow
+ * source does not add to the round trip of every frame.
+ * A non-zero first continues an interrupted upload with 'I' at that
+ * pattern. Every acked pattern is recorded in checkpoint, if given.
+ */
+int upload_patterns(SERHDL hdl, PATTERN_SOURCE source, void *ctx,
+                    unsigned char duration, int first, CHECKPOINT *checkpoint)
+{
+  int rc;
+  RING ring;
+  RING_SLOT *slot;
+  PRODUCER producer;
+  pthread_t thread;
+  unsigned char response[CMD_RSPLEN(CMD_STORENEXTPATTERN)];
+  int index;
+
+  init_ring(&ring);
+  producer.ring = &ring;
+  producer.source = source;
+  producer.ctx = ctx;
+  producer.duration = duration;
+  producer.first = first;
+  producer.rc = RET_COMMAND_OK;
+
+  if (pthread_create(&thread, NULL, produce_frames, &producer) != 0)
+  {
+    fprintf(stderr, "start of pattern producer has failed.\n");
+    rc = RET_COMMAND_ERR_THREAD;
+    goto EXIT;
+  }
+
+  rc = RET_COMMAND_OK;
+  index = first;
+  while ((slot = peek_ring_slot(&ring)) != NULL)
+  {
+    rc = send_frame(hdl, slot->data, slot->len);
+    release_ring_slot(&ring);
+    if (rc != RET_COMMAND_OK) 
+    {
+      fprintf(stderr, "sending command storepattern has failed.\n");
+      break;
+    }
+
+    rc = RECEIVE_RSP(hdl, CMD_STORENEXTPATTERN, response);
+    if (rc != RET_COMMAND_OK) 
+    {
+      if ((rc == RET_COMMAND_ERR_NAK) && (index > 0))
+      {
+        fprintf(stderr, "storage for patterns is exhausted.\n");
+      }
+      else
+      {
+        fprintf(stderr, "receiving response of command storepattern "
+                        "has failed.\n");
+      }
+      break;
+    }
+
+    if ((checkpoint != NULL) &&
+        (update_checkpoint(checkpoint, index) != RET_CHECKPOINT_OK))
+    {
+      fprintf(stderr, "write of checkpoint %s has failed, "
+                      "continuing without.\n", checkpoint->path);
+      checkpoint = NULL;
+    }
+    index++;
+  }
+
+  if (rc != RET_COMMAND_OK)
+  {
+    cancel_ring(&ring);
+  }
+  pthread_join(thread, NULL);
+
+  if (rc == RET_COMMAND_OK)
+  {
+    rc = producer.rc;
+  }
+
+EXIT:
+  return rc;
+}
+
+
+/* pattern source reading consecutive patterns from an open pattern file */
+int next_file_pattern(void *ctx, unsigned char *pattern)
+{
+  PATTERNFILE_SOURCE *src;
+  unsigned char dummy;
+
+  src = (PATTERNFILE_SOURCE *) ctx;
+
+  /* patterns are separated by one line */
+  if ((src->count > 0) &&
+      (read_patternfile(src->patternfile, &dummy) != RET_PATTERN_OK))
+  {
+    return RET_SOURCE_END;
+  }
+
+  if (read_one_pattern(src->patternfile, pattern) != RET_PATTERN_OK)
+  {
+    fprintf(stderr, "read of patternfile %s has failed\n", src->path);
+    return RET_SOURCE_ERR;
+  }
+
+  src->count++;
+  return RET_SOURCE_OK;
+}
+
+
+static void *produce_frames(void *arg)
+{
+  PRODUCER *producer;
+  RING_SLOT *slot;
+  unsigned char pattern[STORE_PARAM_LEN];
+  int first;
+  int rc;
+  int skip;
+
+  producer = (PRODUCER *) arg;
+  first = (producer->first == 0);
+
+  /* patterns already stored by an interrupted upload */
+  rc = RET_SOURCE_OK;
+  for (skip = 0; (skip < producer->first) && (rc == RET_SOURCE_OK); skip++)
+  {
+    rc = producer->source(producer->ctx, pattern);
+  }
+
+  while ((rc == RET_SOURCE_OK) &&
+         ((rc = producer->source(producer->ctx, pattern)) == RET_SOURCE_OK))
+  {
+    /* set duration of display in multiples of 100 ms */
+    pattern[LINES_PER_PATTERN] = producer->duration;
+
+    if ((slot = reserve_ring_slot(producer->ring)) == NULL)
+    {
+      /* consumer has given up, its rc is what counts */
+      rc = RET_SOURCE_END;
+      break;
+    }
+    if (first)
+    {
+      slot->len = ENCODE_CMD(CMD_STOREFIRSTPATTERN, pattern, slot->data);
+    }
+    else
+    {
+      slot->len = ENCODE_CMD(CMD_STORENEXTPATTERN, pattern, slot->data);
+    }
+    commit_ring_slot(producer->ring);
+
+    first = 0;
+  }
+
+  producer->rc = (rc == RET_SOURCE_END) ? RET_COMMAND_OK : RET_COMMAND_ERR_READ;
+  close_ring(producer->ring);
+
+  return NULL;
+}
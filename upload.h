@@ -0,0 +1,38 @@
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#define RET_SOURCE_OK   (0)
+#define RET_SOURCE_END  (1)
+#define RET_SOURCE_ERR  (2)
+
+/* delivers the next transposed pattern, RET_SOURCE_END when exhausted */
+typedef int (*PATTERN_SOURCE)(void *ctx, unsigned char *pattern);
+
+typedef struct {
+  FILE *patternfile;
+  char *path;             /* for error messages only */
+  int   count;            /* no of patterns delivered so far */
+} PATTERNFILE_SOURCE;
+
+typedef struct {
+  unsigned char *patterns;      /* LINES_PER_PATTERN bytes each */
+  int            count;
+  int            next;          /* index of the next pattern to deliver */
+} MEMORY_SOURCE;
+
+#if UPLOAD_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int upload_patterns(SERHDL hdl, PATTERN_SOURCE source, void *ctx,
+                           unsigned char duration, int first,
+                           CHECKPOINT *checkpoint);
+EXTERN int next_file_pattern(void *ctx, unsigned char *pattern);
+EXTERN int next_memory_pattern(void *ctx, unsigned char *pattern);
+EXTERN int load_patternfile(char *path, unsigned char **patterns, int *count);
+
+#undef EXTERN
+
+#endif
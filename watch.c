@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#if LINUX
+#  include <errno.h>
+#  include <limits.h>
+#  include <poll.h>
+#  include <unistd.h>
+#  include <sys/inotify.h>
+#endif
+
+#include <serial.h>
+#include <command.h>
+#include <pattern.h>
+#include <crc16.h>
+#include <frame.h>
+#include <checkpoint.h>
+#include <upload.h>
+#include <options.h>
+#include <timing.h>
+#include <framecache.h>
+
+#define WATCH_SRC 1
+#include <watch.h>
+#undef WATCH_SRC
+
+#include <cmddesc.h>
+
+#define DEFAULT_DEBOUNCE_MS (200)
+#define MAX_WATCHED         (256)
+#define PATTERN_SUFFIX      ".mmm"
+#define DISPLAY_DURATION    (1)
+
+#if LINUX
+
+#define EVENT_BUF_LEN (64 * (sizeof(struct inotify_event) + NAME_MAX + 1))
+
+typedef struct {
+  char               name[NAME_MAX + 1];
+  unsigned long long due;       /* time of the pending reload, 0 if none */
+} WATCHED;
+
+/* what the device shows, whichever file it came from */
+typedef struct {
+  unsigned char     *patterns;  /* last sent, NULL if none */
+  int                count;
+} SENT;
+
+static volatile sig_atomic_t stop_watching;
+
+static int read_events(int fd, WATCHED *watched, int *nwatched,
+                       unsigned long long due);
+static void reload_file(SERHDL hdl, char *dir, WATCHED *w, SENT *sent);
+static int send_patterns(SERHDL hdl, unsigned char *patterns, int count);
+static void stop_handler(int sig);
+
+
+/*
+ * Sends every .mmm file of <dir> again as soon as it has been saved: a
+ * single pattern with 'D', an animation as 'G'/'I' upload. Events of one
+ * file are collected until it has been quiet for --debounce ms, and a file
+ * whose patterns equal the ones last sent to the device, by any file, is
+ * left alone. Runs until SIGINT/SIGTERM.
+ */
+int watch_directory(SERHDL hdl, int myargc, char **myargv)
+{
+  int rc;
+  int fd;
+  WATCHED *watched;
+  int nwatched;
+  SENT sent;
+  unsigned long long debounce;
+  unsigned long long now;
+  unsigned long long next;
+  struct pollfd pfd;
+  int i;
+
+  if ((watched = calloc(MAX_WATCHED, sizeof(WATCHED))) == NULL)
+  {
+    rc = RET_WATCH_ERR_MEMORY;
+    goto EXIT;
+  }
+  nwatched = 0;
+  sent.patterns = NULL;
+  sent.count = 0;
+
+  if (((fd = inotify_init1(IN_CLOEXEC)) == -1) ||
+      (inotify_add_watch(fd, myargv[0],
+                         IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO) == -1))
+  {
+    fprintf(stderr, "watch of directory %s has failed.\n", myargv[0]);
+    rc = RET_WATCH_ERR_WATCH;
+    goto FREE_EXIT;
+  }
+
+  debounce = get_int_option("debounce", DEFAULT_DEBOUNCE_MS) * 1000ULL;
+  trace_responses(0);
+  stop_watching = 0;
+  signal(SIGINT, stop_handler);
+  signal(SIGTERM, stop_handler);
+
+  rc = RET_WATCH_OK;
+  while (!stop_watching)
+  {
+    /* sleep until the next file has settled, or forever */
+    now = get_time_us();
+    next = 0;
+    for (i = 0; i < nwatched; i++)
+    {
+      if ((watched[i].due != 0) && ((next == 0) || (watched[i].due < next)))
+      {
+        next = watched[i].due;
+      }
+    }
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, (next == 0) ? -1 :
+                      (next > now) ? (int) ((next - now + 999) / 1000) : 0)
+        == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      rc = RET_WATCH_ERR_WATCH;
+      break;
+    }
+
+    now = get_time_us();
+    if ((pfd.revents & POLLIN) &&
+        ((rc = read_events(fd, watched, &nwatched, now + debounce))
+         != RET_WATCH_OK))
+    {
+      break;
+    }
+
+    for (i = 0; i < nwatched; i++)
+    {
+      if ((watched[i].due != 0) && (watched[i].due <= now))
+      {
+        watched[i].due = 0;
+        reload_file(hdl, myargv[0], &watched[i], &sent);
+      }
+    }
+  }
+
+  close(fd);
+
+FREE_EXIT:
+  free(sent.patterns);
+  free(watched);
+
+EXIT:
+  return rc;
+}
+
+
+/* (re)starts the debounce period of every .mmm file named in an event */
+static int read_events(int fd, WATCHED *watched, int *nwatched,
+                       unsigned long long due)
+{
+  int rc;
+  char buf[EVENT_BUF_LEN]
+       __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  struct inotify_event *event;
+  char *pos;
+  size_t namelen;
+  size_t suffixlen;
+  int i;
+
+  rc = read(fd, buf, sizeof(buf));
+  if (rc == -1)
+  {
+    rc = (errno == EINTR) ? RET_WATCH_OK : RET_WATCH_ERR_WATCH;
+    goto EXIT;
+  }
+
+  suffixlen = strlen(PATTERN_SUFFIX);
+  for (pos = buf; pos < buf + rc;
+       pos += sizeof(struct inotify_event) + event->len)
+  {
+    event = (struct inotify_event *) pos;
+    namelen = (event->len > 0) ? strlen(event->name) : 0;
+    if ((namelen <= suffixlen) ||
+        (strcmp(event->name + namelen - suffixlen, PATTERN_SUFFIX) != 0))
+    {
+      continue;
+    }
+
+    for (i = 0; i < *nwatched; i++)
+    {
+      if (strcmp(watched[i].name, event->name) == 0)
+      {
+        break;
+      }
+    }
+    if (i == *nwatched)
+    {
+      if (*nwatched == MAX_WATCHED)
+      {
+        fprintf(stderr, "more than %d files, ignoring %s.\n", MAX_WATCHED,
+                event->name);
+        continue;
+      }
+      snprintf(watched[i].name, sizeof(watched[i].name), "%s", event->name);
+      (*nwatched)++;
+    }
+    watched[i].due = due;
+  }
+
+  rc = RET_WATCH_OK;
+
+EXIT:
+  return rc;
+}
+
+
+static void reload_file(SERHDL hdl, char *dir, WATCHED *w, SENT *sent)
+{
+  char path[PATH_MAX];
+  unsigned char *patterns;
+  int count;
+  unsigned long long start;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, w->name);
+  if (load_patternfile(path, &patterns, &count) != RET_SOURCE_OK)
+  {
+    /* keep what was sent, the next save will be tried again */
+    return;
+  }
+
+  if ((sent->patterns != NULL) && (sent->count == count) &&
+      (memcmp(sent->patterns, patterns, count * LINES_PER_PATTERN) == 0))
+  {
+    printf("%s: unchanged\n", w->name);
+    free(patterns);
+    return;
+  }
+
+  start = get_time_us();
+  if (send_patterns(hdl, patterns, count) != RET_COMMAND_OK)
+  {
+    fprintf(stderr, "%s: sending has failed.\n", w->name);
+    /* the device may show anything now, the next save is sent anyway */
+    free(sent->patterns);
+    sent->patterns = NULL;
+    free(patterns);
+    return;
+  }
+
+  printf("%s: %s %d pattern%s in %.1f ms\n", w->name,
+         (count == 1) ? "displayed" : "stored", count, (count == 1) ? "" : "s",
+         (get_time_us() - start) / 1000.0);
+  fflush(stdout);
+
+  free(sent->patterns);
+  sent->patterns = patterns;
+  sent->count = count;
+}
+
+
+static int send_patterns(SERHDL hdl, unsigned char *patterns, int count)
+{
+  int rc;
+  MEMORY_SOURCE source;
+  unsigned char frame[FRAME_ENCODED_LEN(CMD_NPARAM(CMD_DISPLAYPATTERN))];
+  unsigned char response[CMD_RSPLEN(CMD_DISPLAYPATTERN)];
+
+  if (count > 1)
+  {
+    source.patterns = patterns;
+    source.count = count;
+    source.next = 0;
+    rc = upload_patterns(hdl, next_memory_pattern, &source, DISPLAY_DURATION,
+                         0, NULL);
+    goto EXIT;
+  }
+
+  if ((rc = send_frame(hdl, frame, cached_display_frame(patterns, frame)))
+      != RET_COMMAND_OK)
+  {
+    goto EXIT;
+  }
+  rc = RECEIVE_RSP(hdl, CMD_DISPLAYPATTERN, response);
+
+EXIT:
+  return rc;
+}
+
+
+static void stop_handler(int sig)
+{
+  stop_watching = 1;
+}
+
+#endif
+
+
+#if WIN
+
+int watch_directory(SERHDL hdl, int myargc, char **myargv)
+{
+  fprintf(stderr, "watch needs inotify.\n");
+  return RET_WATCH_ERR_WATCH;
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#define RET_WATCH_OK         (0)
+#define RET_WATCH_ERR_MEMORY (1)
+#define RET_WATCH_ERR_WATCH  (2)
+
+#if WATCH_SRC
+# define EXTERN 
+#else
+# define EXTERN extern
+#endif
+
+EXTERN int watch_directory(SERHDL hdl, int myargc, char **myargv);
+
+#undef EXTERN
+
+#endif